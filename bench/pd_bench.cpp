@@ -0,0 +1,642 @@
+// pardus-bench - HTTP load generator
+// Usage: pardus-bench [options] [host] [port]
+//    Loads host:port, 127.0.0.1 and SERVER_PORT by default, for a fixed
+//    duration from event driven threads, then reports throughput and
+//    latency percentiles.
+//
+// Without --rate the load is closed loop: every connection keeps its
+// pipeline full. Given --expected-rate, the rate the load was meant to
+// reach, latencies are also corrected for coordinated omission after the
+// run, with requests due on each connection at its share of that rate.
+// With --rate the load is open loop at that many requests per second,
+// spread over the connections, and latency runs from the time a request
+// was due rather than when it could be sent.
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/uio.h>
+
+#include "pd_net.h"
+#include "pd_selector.h"
+#include "pd_histogram.h"
+
+using namespace pardus::nio;
+using pardus::metrics::Histogram;
+
+typedef std::chrono::steady_clock Clock;
+
+#define BENCH_INBUFF (64 << 10)
+
+/***************************
+* Settings
+**************************/
+struct BenchConfig {
+    std::string host = "127.0.0.1";
+    int port = SERVER_PORT;
+    unsigned connections = 64;
+    unsigned threads = 0;           // 0 for one per core
+    double duration = 10;           // seconds
+    unsigned pipeline = 1;          // requests in flight per connection
+    bool keepAlive = true;
+    double rate = 0;                // requests per second, 0 for closed loop
+    double expectedRate = 0;        // closed loop target for the latency correction, 0 for none
+    std::string method = "GET";
+    std::string path = "/";
+    std::string headers;            // extra header lines, CRLF terminated
+    std::string requestFile;        // raw request, overrides method/path/headers
+};
+
+static BenchConfig config;
+
+struct BenchOption {
+    const char *name;
+    const char *help;
+    void (*set)(const char *value);
+};
+
+const BenchOption bench_options[] = {
+    {"--connections", "connections kept open",
+     [](const char *v){ config.connections = std::max(1ul, std::stoul(v)); }},
+    {"--threads", "load threads, 0 for one per core",
+     [](const char *v){ config.threads = std::stoul(v); }},
+    {"--duration", "seconds to run",
+     [](const char *v){ config.duration = std::stod(v); }},
+    {"--pipeline", "requests in flight per connection",
+     [](const char *v){ config.pipeline = std::max(1ul, std::stoul(v)); }},
+    {"--keepalive", "0 to open a connection per request",
+     [](const char *v){ config.keepAlive = std::stoi(v) != 0; }},
+    {"--rate", "requests per second over all connections, 0 for as fast as possible",
+     [](const char *v){ config.rate = std::stod(v); }},
+    {"--expected-rate", "closed loop: requests per second meant, to correct latencies by, 0 for none",
+     [](const char *v){ config.expectedRate = std::stod(v); }},
+    {"--method", "request method",
+     [](const char *v){ config.method = v; }},
+    {"--path", "request target",
+     [](const char *v){ config.path = v; }},
+    {"--header", "extra request header line, may be repeated",
+     [](const char *v){ config.headers += std::string(v) + "\r\n"; }},
+    {"--request-file", "file holding the raw request to send",
+     [](const char *v){ config.requestFile = v; }},
+};
+
+static void usage(const char *prog) {
+    std::fprintf(stderr, "Usage: %s [options] [host] [port]\nOptions:\n", prog);
+    for (const BenchOption &o : bench_options)
+        std::fprintf(stderr, "  %s=VALUE\t%s\n", o.name, o.help);
+}
+
+// Parse --name=value, return false if name is unknown
+static bool parse_option(const char *arg) {
+    const char *eq = std::strchr(arg, '=');
+    if (eq == nullptr)
+        return false;
+    for (const BenchOption &o : bench_options) {
+        if (std::strncmp(o.name, arg, eq - arg) == 0 && o.name[eq - arg] == '\0') {
+            o.set(eq + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Request sent over and over, from the template options
+//    Return empty on error
+static std::string build_request() {
+    std::string req;
+    if (!config.requestFile.empty()) {
+        std::ifstream in(config.requestFile, std::ios::binary);
+        if (!in)
+            return req;
+        std::stringstream ss;
+        ss << in.rdbuf();
+        req = ss.str();
+        // Files written with plain newlines get CRLF line ends
+        if (req.find("\r\n") == std::string::npos) {
+            std::string crlf;
+            for (char c : req) {
+                if (c == '\n')
+                    crlf += '\r';
+                crlf += c;
+            }
+            req.swap(crlf);
+        }
+    } else {
+        req = config.method + " " + config.path + " HTTP/1.1\r\n"
+            + "Host: " + config.host + ":" + std::to_string(config.port) + "\r\n"
+            + config.headers + "\r\n";
+    }
+    if (!config.keepAlive) {
+        size_t eol = req.find("\r\n");
+        if (eol != std::string::npos)
+            req.insert(eol + 2, "Connection: close\r\n");
+    }
+    return req;
+}
+
+
+/***************************
+* Load generation
+**************************/
+// Totals of one thread, merged at the end
+struct BenchStats {
+    Histogram latency;              // ns
+    uint64_t responses = 0;
+    uint64_t non2xx = 0;
+    uint64_t bytes = 0;
+    uint64_t connects = 0;
+    uint64_t connectErrors = 0;
+    uint64_t readErrors = 0;        // resets, malformed responses
+    uint64_t writeErrors = 0;
+    uint64_t lost = 0;              // requests in flight on a connection that closed
+    uint64_t unanswered = 0;        // requests still in flight when the run ended
+};
+
+// BenchConnection - One client connection of a load thread
+// Requests go out of a buffer holding pipeline + 1 copies of the request,
+// so any run of unsent requests is contiguous. Responses are framed by
+// Content-Length, by chunked transfer coding, or by the end of the
+// connection without either.
+struct BenchConnection {
+    SocketChannel mChan;
+    SelectionKey *mKey = nullptr;
+    ByteBuffer mIn{BENCH_INBUFF};
+    size_t mOutPos = 0;             // unsent requests are mOut[mOutPos, mOutEnd)
+    size_t mOutEnd = 0;
+    std::vector<Clock::time_point> mStarts;     // of the requests in flight, a ring
+    size_t mFirst = 0;
+    size_t mInflight = 0;
+    Clock::time_point mNextDue;     // open loop only
+    bool mInBody = false;
+    uint64_t mBodyLeft = 0;         // of the body, or of the chunk and its CRLF
+    bool mChunked = false;          // body in chunked transfer coding
+    bool mTrailers = false;         // past the last chunk, in the trailer section
+    bool mToEof = false;            // body runs to the end of the connection
+    bool mClose = false;            // server closes after this response
+};
+
+// BenchThread - Event loop driving a share of the connections
+class BenchThread {
+public:
+    BenchThread(const std::string &request, unsigned connections, double rate);
+    ~BenchThread();
+    void run(Clock::time_point stop);
+    BenchStats &stats();
+
+private:
+    bool open(BenchConnection *conn);
+    void drop(BenchConnection *conn);
+    void queue(BenchConnection *conn, Clock::time_point now);
+    bool flush(BenchConnection *conn);
+    bool receive(BenchConnection *conn, Clock::time_point now);
+    bool parse(BenchConnection *conn, Clock::time_point now);
+    void complete(BenchConnection *conn, Clock::time_point now);
+    void updateInterest(BenchConnection *conn);
+
+private:
+    SocketAddress mRemote;
+    std::string mOut;
+    size_t mRequestLength;
+    unsigned mPipeline;
+    bool mHead;
+    std::chrono::nanoseconds mInterval{0};  // between requests of a connection, open loop
+    Selector mSelector;
+    std::vector<BenchConnection*> mConns;
+    BenchStats mStats;
+};
+
+BenchThread::BenchThread(const std::string &request, unsigned connections, double rate)
+        : mRemote(config.host, config.port), mRequestLength(request.size()),
+          mPipeline(config.keepAlive ? config.pipeline : 1),
+          mHead(request.compare(0, 5, "HEAD ") == 0) {
+    for (unsigned i = 0; i <= mPipeline; i++)
+        mOut += request;
+    if (rate > 0)
+        mInterval = std::chrono::nanoseconds(static_cast<long long>(1e9 * connections / rate));
+    for (unsigned i = 0; i < connections; i++) {
+        auto *conn = new BenchConnection;
+        conn->mStarts.resize(mPipeline);
+        mConns.push_back(conn);
+    }
+}
+
+BenchThread::~BenchThread() {
+    for (BenchConnection *conn : mConns) {
+        if (conn->mKey)
+            conn->mKey->cancel();
+        delete conn;
+    }
+}
+
+BenchStats &BenchThread::stats() {
+    return mStats;
+}
+
+// Connect conn and register it for reading
+//    Return false on error
+bool BenchThread::open(BenchConnection *conn) {
+    conn->mChan = SocketChannel();
+    mStats.connects++;
+    if (conn->mChan.connect(mRemote) < 0 || conn->mChan.configureBlocking(false) < 0) {
+        mStats.connectErrors++;
+        conn->mChan.close();
+        return false;
+    }
+    conn->mKey = mSelector.registerChannel(conn->mChan, SelectionKey::OP_READ, conn);
+    if (conn->mKey == nullptr) {
+        mStats.connectErrors++;
+        conn->mChan.close();
+        return false;
+    }
+    conn->mIn.clear();
+    conn->mOutPos = conn->mOutEnd = 0;
+    conn->mFirst = conn->mInflight = 0;
+    conn->mInBody = conn->mToEof = conn->mClose = false;
+    conn->mChunked = conn->mTrailers = false;
+    return true;
+}
+
+// Close conn, counting what was in flight as lost
+void BenchThread::drop(BenchConnection *conn) {
+    mStats.lost += conn->mInflight;
+    conn->mInflight = 0;
+    if (conn->mKey) {
+        conn->mKey->cancel();
+        conn->mKey = nullptr;
+    }
+    conn->mChan.close();
+}
+
+// Queue requests until the pipeline is full, or in open loop until the
+// next one is not due yet
+void BenchThread::queue(BenchConnection *conn, Clock::time_point now) {
+    size_t add = 0;
+    while (conn->mInflight < mPipeline) {
+        Clock::time_point start = now;
+        if (mInterval.count() > 0) {
+            if (conn->mNextDue > now)
+                break;
+            start = conn->mNextDue;
+            conn->mNextDue += mInterval;
+        }
+        conn->mStarts[(conn->mFirst + conn->mInflight) % mPipeline] = start;
+        conn->mInflight++;
+        add++;
+    }
+    if (add == 0)
+        return;
+    // All copies are alike, only the offset into the current one matters
+    size_t unsent = conn->mOutEnd - conn->mOutPos;
+    conn->mOutPos %= mRequestLength;
+    conn->mOutEnd = conn->mOutPos + unsent + add * mRequestLength;
+}
+
+// Write unsent requests until done or the socket is full
+//    Return false on error
+bool BenchThread::flush(BenchConnection *conn) {
+    while (conn->mOutPos < conn->mOutEnd) {
+        iovec iov;
+        iov.iov_base = &mOut[conn->mOutPos];
+        iov.iov_len = conn->mOutEnd - conn->mOutPos;
+        ssize_t n = conn->mChan.write(&iov, 1);
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        conn->mOutPos += n;
+    }
+    return true;
+}
+
+// Read and parse whatever arrived
+//    Return false once the connection is done with, by error or end of stream
+bool BenchThread::receive(BenchConnection *conn, Clock::time_point now) {
+    for (;;) {
+        if (!conn->mIn.hasRemaining()) {
+            // A response head larger than the input buffer
+            mStats.readErrors++;
+            return false;
+        }
+        ssize_t n = conn->mChan.read(conn->mIn);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            mStats.readErrors++;
+            return false;
+        }
+        if (n == 0) {
+            if (conn->mInBody && conn->mToEof)
+                complete(conn, now);
+            else if (conn->mInflight > 0 && !conn->mClose)
+                mStats.readErrors++;
+            return false;
+        }
+        mStats.bytes += n;
+        if (!parse(conn, now))
+            return false;
+    }
+}
+
+// Case insensitive value of header name in head, nullptr if absent
+static const char *find_header(const char *head, size_t length, const char *name) {
+    size_t nlen = std::strlen(name);
+    const char *end = head + length;
+    for (const char *line = head; line < end; ) {
+        const char *eol = static_cast<const char*>(memchr(line, '\n', end - line));
+        if (eol == nullptr)
+            eol = end;
+        if (static_cast<size_t>(eol - line) > nlen && line[nlen] == ':'
+                && strncasecmp(line, name, nlen) == 0) {
+            const char *v = line + nlen + 1;
+            while (v < eol && *v == ' ')
+                v++;
+            return v;
+        }
+        line = eol + 1;
+    }
+    return nullptr;
+}
+
+// Whether the header value at value, in a head ending at end, is a list
+// whose last coding is chunked
+static bool is_chunked(const char *value, const char *end) {
+    const char *eol = static_cast<const char*>(memchr(value, '\n', end - value));
+    if (eol == nullptr)
+        eol = end;
+    while (eol > value && (eol[-1] == '\r' || eol[-1] == ' ' || eol[-1] == '\t'))
+        eol--;
+    return eol - value >= 7 && strncasecmp(eol - 7, "chunked", 7) == 0
+           && (eol - value == 7 || eol[-8] == ',' || eol[-8] == ' ');
+}
+
+// Consume complete responses, and the body bytes of one in progress
+// Chunk data is skipped like a Content-Length body; the chunk-size and
+// trailer lines are read as whole lines.
+//    Return false on a malformed response or when the server is closing
+bool BenchThread::parse(BenchConnection *conn, Clock::time_point now) {
+    Byte *buff = conn->mIn.array();
+    size_t used = conn->mIn.pos();
+    size_t off = 0;
+    for (;;) {
+        if (conn->mInBody) {
+            if (conn->mToEof) {
+                off = used;
+                break;
+            }
+            uint64_t take = std::min<uint64_t>(conn->mBodyLeft, used - off);
+            conn->mBodyLeft -= take;
+            off += take;
+            if (conn->mBodyLeft > 0)
+                break;
+            if (conn->mChunked) {
+                const char *line = reinterpret_cast<const char*>(buff + off);
+                const char *eol = static_cast<const char*>(memmem(line, used - off, "\r\n", 2));
+                if (eol == nullptr)
+                    break;
+                off += eol + 2 - line;
+                if (conn->mTrailers) {
+                    if (eol != line)
+                        continue;   // a trailer field
+                } else {
+                    char *digits;
+                    uint64_t size = std::strtoull(line, &digits, 16);
+                    if (digits == line || !std::isxdigit(static_cast<unsigned char>(*line))) {
+                        mStats.readErrors++;
+                        return false;
+                    }
+                    if (size > 0) {
+                        conn->mBodyLeft = size + 2;
+                        continue;
+                    }
+                    conn->mTrailers = true;
+                    continue;
+                }
+            }
+            conn->mInBody = false;
+            complete(conn, now);
+            if (conn->mClose)
+                return false;
+            continue;
+        }
+        const char *head = reinterpret_cast<const char*>(buff + off);
+        const char *end = static_cast<const char*>(memmem(head, used - off, "\r\n\r\n", 4));
+        if (end == nullptr)
+            break;
+        size_t headLen = end + 4 - head;
+        if (conn->mInflight == 0 || headLen < 12 || std::strncmp(head, "HTTP/1.", 7) != 0) {
+            mStats.readErrors++;
+            return false;
+        }
+        int status = std::atoi(head + 9);
+        if (status < 200 || status > 299)
+            mStats.non2xx++;
+        const char *cl = find_header(head, headLen, "Content-Length");
+        const char *te = find_header(head, headLen, "Transfer-Encoding");
+        const char *connection = find_header(head, headLen, "Connection");
+        bool bodyless = mHead || status == 204 || status == 304;
+        conn->mClose = connection && strncasecmp(connection, "close", 5) == 0;
+        conn->mChunked = te && !bodyless && is_chunked(te, head + headLen);
+        conn->mTrailers = false;
+        conn->mToEof = cl == nullptr && !conn->mChunked && !bodyless;
+        conn->mBodyLeft = cl && !conn->mChunked && !bodyless ? std::strtoull(cl, nullptr, 10) : 0;
+        conn->mInBody = true;
+        off += headLen;
+    }
+    if (off > 0) {
+        std::memmove(buff, buff + off, used - off);
+        conn->mIn.pos(used - off);
+    }
+    return true;
+}
+
+// Account the response to the oldest request in flight
+void BenchThread::complete(BenchConnection *conn, Clock::time_point now) {
+    if (conn->mInflight == 0)
+        return;
+    Clock::time_point start = conn->mStarts[conn->mFirst];
+    conn->mFirst = (conn->mFirst + 1) % mPipeline;
+    conn->mInflight--;
+    mStats.responses++;
+    mStats.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count());
+}
+
+void BenchThread::updateInterest(BenchConnection *conn) {
+    int ops = SelectionKey::OP_READ;
+    if (conn->mOutPos < conn->mOutEnd)
+        ops |= SelectionKey::OP_WRITE;
+    if (conn->mKey->interestOps() != ops)
+        conn->mKey->interestOps(ops);
+}
+
+void BenchThread::run(Clock::time_point stop) {
+    Clock::time_point now = Clock::now();
+    for (size_t i = 0; i < mConns.size(); i++) {
+        BenchConnection *conn = mConns[i];
+        // Stagger the first requests of an open loop over one interval
+        conn->mNextDue = now + mInterval * i / std::max<size_t>(mConns.size(), 1);
+        if (open(conn))
+            queue(conn, now);
+    }
+
+    while ((now = Clock::now()) < stop) {
+        // Reconnect closed connections, then top up every pipeline
+        Clock::time_point wake = stop;
+        for (BenchConnection *conn : mConns) {
+            if (conn->mKey == nullptr) {
+                if (mInterval.count() > 0 && conn->mNextDue > now) {
+                    wake = std::min(wake, conn->mNextDue);
+                    continue;
+                }
+                if (!open(conn)) {
+                    // Retry when the next request is due, or shortly
+                    if (mInterval.count() > 0)
+                        conn->mNextDue += mInterval;
+                    wake = std::min(wake, mInterval.count() > 0 ? conn->mNextDue
+                                          : now + std::chrono::milliseconds(10));
+                    continue;
+                }
+            }
+            queue(conn, now);
+            if (!flush(conn)) {
+                mStats.writeErrors++;
+                drop(conn);
+                continue;
+            }
+            updateInterest(conn);
+            if (mInterval.count() > 0 && conn->mInflight < mPipeline)
+                wake = std::min(wake, conn->mNextDue);
+        }
+
+        long timeoutMs = std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count();
+        if (mSelector.select(std::max(0l, timeoutMs)) < 0)
+            continue;
+        now = Clock::now();
+        for (SelectionKey *key : mSelector.selectedKeys()) {
+            if (!key->isValid())
+                continue;
+            auto *conn = static_cast<BenchConnection*>(key->attachment());
+            if (key->isReadable() && !receive(conn, now)) {
+                drop(conn);
+                continue;
+            }
+            if (key->isWritable() && !flush(conn)) {
+                mStats.writeErrors++;
+                drop(conn);
+            }
+        }
+    }
+    // Time is up for what is still in flight
+    for (BenchConnection *conn : mConns)
+        mStats.unanswered += conn->mKey ? conn->mInflight : 0;
+}
+
+
+/***************************
+* Report
+**************************/
+static void print_latency(const char *label, const Histogram &h) {
+    const double ps[] = {50, 90, 99, 99.9};
+    std::printf("  %-10s", label);
+    for (double p : ps)
+        std::printf(" %10.3f", h.percentile(p) / 1e6);
+    std::printf(" %10.3f %10.3f\n", h.mean() / 1e6, h.max() / 1e6);
+}
+
+int main(int argc, char const *argv[]) {
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        if (std::strncmp(argv[i], "--", 2) == 0) {
+            if (!parse_option(argv[i])) {
+                std::fprintf(stderr, "Unknown option: %s\n", argv[i]);
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (positional++ == 0) {
+            config.host = argv[i];
+        } else {
+            config.port = std::stoi(argv[i]);
+        }
+    }
+
+    std::string request = build_request();
+    if (request.empty()) {
+        std::fprintf(stderr, "Cannot read request file %s: %s\n",
+                     config.requestFile.c_str(), std::strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (SocketAddress(config.host, config.port).getFamily() == AF_UNSPEC) {
+        std::fprintf(stderr, "Not an IP address: %s\n", config.host.c_str());
+        return EXIT_FAILURE;
+    }
+
+    unsigned ncpu = std::max(1u, std::thread::hardware_concurrency());
+    unsigned nthreads = std::min(config.threads ? config.threads : ncpu, config.connections);
+    std::printf("Running %.1fs test @ %s:%d\n", config.duration, config.host.c_str(), config.port);
+    std::printf("  %u threads, %u connections, pipeline %u, keep-alive %s, ",
+                nthreads, config.connections, config.keepAlive ? config.pipeline : 1,
+                config.keepAlive ? "on" : "off");
+    if (config.rate > 0)
+        std::printf("open loop at %.0f req/s\n", config.rate);
+    else
+        std::printf("closed loop\n");
+
+    std::vector<BenchThread*> threads;
+    for (unsigned i = 0; i < nthreads; i++) {
+        unsigned conns = config.connections / nthreads + (i < config.connections % nthreads);
+        threads.push_back(new BenchThread(request, conns, config.rate * conns / config.connections));
+    }
+    Clock::time_point start = Clock::now();
+    Clock::time_point stop = start + std::chrono::nanoseconds(static_cast<long long>(config.duration * 1e9));
+    std::vector<std::thread> runners;
+    for (BenchThread *t : threads)
+        runners.emplace_back([t, stop]() { t->run(stop); });
+    for (std::thread &r : runners)
+        r.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    BenchStats total;
+    for (BenchThread *t : threads) {
+        BenchStats &s = t->stats();
+        total.latency.merge(s.latency);
+        total.responses += s.responses;
+        total.non2xx += s.non2xx;
+        total.bytes += s.bytes;
+        total.connects += s.connects;
+        total.connectErrors += s.connectErrors;
+        total.readErrors += s.readErrors;
+        total.writeErrors += s.writeErrors;
+        total.lost += s.lost;
+        total.unanswered += s.unanswered;
+        delete t;
+    }
+
+    std::printf("Requests: %llu in %.2fs, %.0f req/s, %.2f MB/s\n",
+                static_cast<unsigned long long>(total.responses), seconds,
+                total.responses / seconds, total.bytes / seconds / 1e6);
+    std::printf("Connections: %llu opened, errors: connect %llu, read %llu, write %llu, "
+                "lost in flight %llu, unanswered at the end %llu, non-2xx %llu\n",
+                static_cast<unsigned long long>(total.connects),
+                static_cast<unsigned long long>(total.connectErrors),
+                static_cast<unsigned long long>(total.readErrors),
+                static_cast<unsigned long long>(total.writeErrors),
+                static_cast<unsigned long long>(total.lost),
+                static_cast<unsigned long long>(total.unanswered),
+                static_cast<unsigned long long>(total.non2xx));
+    std::printf("Latency (ms)      p50        p90        p99      p99.9       mean        max\n");
+    if (config.rate > 0) {
+        print_latency("from due", total.latency);
+    } else {
+        print_latency("measured", total.latency);
+        // A connection was meant to send its share of the expected rate
+        if (config.expectedRate > 0)
+            print_latency("corrected", total.latency.corrected(
+                static_cast<uint64_t>(1e9 * config.connections / config.expectedRate)));
+    }
+    return total.responses > 0 ? 0 : EXIT_FAILURE;
+}
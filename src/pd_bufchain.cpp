@@ -0,0 +1,299 @@
+#include "pd_bufchain.h"
+#include "pd_bufpool.h"
+#include "pd_net.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+namespace pardus {
+namespace nio {
+
+// Segment - Header at the front of a pooled block, its bytes follow it
+struct ByteBufferChain::Segment {
+    size_t refs;        // pieces referring to it, in any chain
+    size_t block;       // size asked of the BufferPool
+    size_t capacity;    // bytes after the header
+    size_t fill;        // bytes written, the rest is free to append to
+
+    Byte *data() {
+        return reinterpret_cast<Byte*>(this + 1);
+    }
+};
+
+
+/*********************************
+* ByteBufferChain implementation
+*********************************/
+ByteBufferChain::ByteBufferChain() {
+}
+
+// Chain whose appends take segments of segmentSize bytes, header included
+ByteBufferChain::ByteBufferChain(size_t segmentSize)
+        : mSegmentSize(std::max(segmentSize, sizeof(Segment) + 1)) {
+}
+
+// The copy shares the segments of src
+ByteBufferChain::ByteBufferChain(const ByteBufferChain &src)
+        : mPieces(src.mPieces), mSize(src.mSize), mSegmentSize(src.mSegmentSize) {
+    for (const Piece &p : mPieces)
+        retain(p.segment);
+}
+
+ByteBufferChain& ByteBufferChain::operator=(const ByteBufferChain &src) {
+    if (this == &src)
+        return *this;
+    for (const Piece &p : src.mPieces)
+        retain(p.segment);
+    clear();
+    mPieces = src.mPieces;
+    mSize = src.mSize;
+    mSegmentSize = src.mSegmentSize;
+    return *this;
+}
+
+ByteBufferChain::ByteBufferChain(ByteBufferChain &&src) noexcept
+        : mPieces(std::move(src.mPieces)), mSize(src.mSize), mSegmentSize(src.mSegmentSize) {
+    src.mPieces.clear();
+    src.mSize = 0;
+}
+
+ByteBufferChain& ByteBufferChain::operator=(ByteBufferChain &&src) noexcept {
+    if (this == &src)
+        return *this;
+    clear();
+    mPieces.swap(src.mPieces);
+    mSize = src.mSize;
+    mSegmentSize = src.mSegmentSize;
+    src.mSize = 0;
+    return *this;
+}
+
+ByteBufferChain::~ByteBufferChain() {
+    clear();
+}
+
+// Number of bytes held
+size_t ByteBufferChain::size() const {
+    return mSize;
+}
+
+bool ByteBufferChain::empty() const {
+    return mSize == 0;
+}
+
+// Number of pieces the bytes are in, what iov() needs to describe them all
+size_t ByteBufferChain::segmentCount() const {
+    return mPieces.size();
+}
+
+// Drop every byte, segments no other chain shares go back to the BufferPool
+void ByteBufferChain::clear() {
+    for (const Piece &p : mPieces)
+        release(p.segment);
+    mPieces.clear();
+    mSize = 0;
+}
+
+// Copy length bytes of data to the end
+void ByteBufferChain::append(const char *data, size_t length) {
+    while (length > 0) {
+        size_t n = length;
+        Byte *dst = reserve(n);
+        std::memcpy(dst, data, n);
+        commit(n);
+        data += n;
+        length -= n;
+    }
+}
+
+void ByteBufferChain::append(const std::string &str) {
+    append(str.data(), str.size());
+}
+
+// Add the bytes of src to the end, sharing its segments
+void ByteBufferChain::append(const ByteBufferChain &src) {
+    // A copy first, src may be this chain
+    std::deque<Piece> pieces(src.mPieces);
+    size_t size = src.mSize;
+    for (const Piece &p : pieces)
+        retain(p.segment);
+    mPieces.insert(mPieces.end(), pieces.begin(), pieces.end());
+    mSize += size;
+}
+
+// Copy length bytes of data to the front, into a segment of their own
+void ByteBufferChain::prepend(const char *data, size_t length) {
+    if (length == 0)
+        return;
+    Segment *segment = newSegment(length);
+    std::memcpy(segment->data(), data, length);
+    segment->fill = length;
+    mPieces.push_front(Piece{segment, 0, length});
+    mSize += length;
+}
+
+void ByteBufferChain::prepend(const std::string &str) {
+    prepend(str.data(), str.size());
+}
+
+// Add the bytes of src to the front, sharing its segments
+void ByteBufferChain::prepend(const ByteBufferChain &src) {
+    std::deque<Piece> pieces(src.mPieces);
+    size_t size = src.mSize;
+    for (const Piece &p : pieces)
+        retain(p.segment);
+    mPieces.insert(mPieces.begin(), pieces.begin(), pieces.end());
+    mSize += size;
+}
+
+// Chain of the bytes [offset, offset + length), sharing the segments
+// The slice is cut short at the end of this chain.
+ByteBufferChain ByteBufferChain::slice(size_t offset, size_t length) const {
+    ByteBufferChain out(mSegmentSize);
+    for (const Piece &p : mPieces) {
+        if (length == 0)
+            break;
+        size_t n = p.end - p.begin;
+        if (offset >= n) {
+            offset -= n;
+            continue;
+        }
+        size_t take = std::min(n - offset, length);
+        retain(p.segment);
+        out.mPieces.push_back(Piece{p.segment, p.begin + offset, p.begin + offset + take});
+        out.mSize += take;
+        length -= take;
+        offset = 0;
+    }
+    return out;
+}
+
+// Drop n bytes from the front, e.g. once a write sent them
+void ByteBufferChain::consume(size_t n) {
+    n = std::min(n, mSize);
+    mSize -= n;
+    while (n > 0) {
+        Piece &p = mPieces.front();
+        size_t k = std::min(n, p.end - p.begin);
+        p.begin += k;
+        n -= k;
+        if (p.begin == p.end) {
+            release(p.segment);
+            mPieces.pop_front();
+        }
+    }
+}
+
+// Describe the bytes from the front in place, in up to max iovecs
+//    Return number of iovecs filled
+int ByteBufferChain::iov(iovec *iov, int max) const {
+    int n = 0;
+    for (const Piece &p : mPieces) {
+        if (n >= max)
+            break;
+        iov[n].iov_base = p.segment->data() + p.begin;
+        iov[n++].iov_len = p.end - p.begin;
+    }
+    return n;
+}
+
+// Copy up to length bytes starting at offset to dst
+//    Return number of bytes copied
+size_t ByteBufferChain::copy(Byte *dst, size_t offset, size_t length) const {
+    size_t copied = 0;
+    for (const Piece &p : mPieces) {
+        if (copied == length)
+            break;
+        size_t n = p.end - p.begin;
+        if (offset >= n) {
+            offset -= n;
+            continue;
+        }
+        size_t take = std::min(n - offset, length - copied);
+        std::memcpy(dst + copied, p.segment->data() + p.begin + offset, take);
+        copied += take;
+        offset = 0;
+    }
+    return copied;
+}
+
+// Copy of every byte, the chain is left as it is
+std::string ByteBufferChain::toString() const {
+    std::string str(mSize, '\0');
+    copy(&str[0], 0, mSize);
+    return str;
+}
+
+// Send from the front with one writev() of up to CHAIN_MAX_IOV segments,
+// the bytes sent are consumed
+//    Return number of bytes sent
+//    On error, return -1 and sets errno
+ssize_t ByteBufferChain::write(SocketChannel &chan) {
+    iovec vec[CHAIN_MAX_IOV];
+    int n = iov(vec, CHAIN_MAX_IOV);
+    if (n == 0)
+        return 0;
+    ssize_t sent;
+    do {
+        sent = chan.write(vec, n);
+    } while (sent < 0 && errno == EINTR);
+    if (sent > 0)
+        consume(static_cast<size_t>(sent));
+    return sent;
+}
+
+// Segment with room for at least capacity bytes after its header
+// The whole size class of the pool block is used.
+ByteBufferChain::Segment* ByteBufferChain::newSegment(size_t capacity) {
+    size_t block = BufferPool::blockSize(sizeof(Segment) + capacity);
+    Byte *raw = BufferPool::allocate(block);
+    Segment *segment = new (raw) Segment();
+    segment->refs = 1;
+    segment->block = block;
+    segment->capacity = block - sizeof(Segment);
+    segment->fill = 0;
+    return segment;
+}
+
+void ByteBufferChain::retain(Segment *segment) {
+    segment->refs++;
+}
+
+void ByteBufferChain::release(Segment *segment) {
+    if (--segment->refs > 0)
+        return;
+    size_t block = segment->block;
+    segment->~Segment();
+    BufferPool::deallocate(reinterpret_cast<Byte*>(segment), block);
+}
+
+// Room to write up to length bytes at the end, length is cut to what
+// fits. The last segment is written on as long as no chain refers to
+// bytes past the end of this one.
+Byte* ByteBufferChain::reserve(size_t &length) {
+    if (!mPieces.empty()) {
+        Piece &tail = mPieces.back();
+        Segment *segment = tail.segment;
+        if (tail.end == segment->fill && segment->fill < segment->capacity) {
+            length = std::min(length, segment->capacity - segment->fill);
+            return segment->data() + segment->fill;
+        }
+    }
+    Segment *segment = newSegment(mSegmentSize - sizeof(Segment));
+    mPieces.push_back(Piece{segment, 0, 0});
+    length = std::min(length, segment->capacity);
+    return segment->data();
+}
+
+// Account for length bytes written at reserve()
+void ByteBufferChain::commit(size_t length) {
+    Piece &tail = mPieces.back();
+    tail.end += length;
+    tail.segment->fill += length;
+    mSize += length;
+}
+
+} // namespace nio
+} // namespace pardus
@@ -0,0 +1,87 @@
+#ifndef PD_BUFCHAIN_H
+#define PD_BUFCHAIN_H
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "pd_types.h"
+
+#define CHAIN_SEGMENT_BYTES 16384   // storage of a segment, header included
+#define CHAIN_MAX_IOV 64            // iovecs handed to one writev()
+
+namespace pardus {
+namespace nio {
+
+class SocketChannel;
+
+// ByteBufferChain - Sequence of bytes held in linked pooled segments
+// Appending fills the last segment, then takes a new one from the
+// BufferPool, so bytes already held are never moved and the memory used
+// follows the size. Segments are reference counted: copies, slices and
+// chains appended or prepended to one another share them instead of the
+// bytes. Appending into a shared segment only writes past the bytes any
+// chain refers to, so the chains sharing it stay intact.
+// consume() drops bytes from the front, e.g. once a partial write sent
+// them, and iov() describes the bytes in place for writev().
+// Reference counts are not atomic: a chain, and the chains sharing its
+// segments, belong to one thread at a time, like a ByteBuffer.
+class ByteBufferChain {
+public:
+    ByteBufferChain();
+    explicit ByteBufferChain(size_t segmentSize);
+    ByteBufferChain(const ByteBufferChain &src);
+    ByteBufferChain& operator=(const ByteBufferChain &src);
+    ByteBufferChain(ByteBufferChain &&src) noexcept;
+    ByteBufferChain& operator=(ByteBufferChain &&src) noexcept;
+    ~ByteBufferChain();
+
+    size_t size() const;
+    bool empty() const;
+    size_t segmentCount() const;
+    void clear();
+
+    void append(const char *data, size_t length);
+    void append(const std::string &str);
+    void append(const ByteBufferChain &src);
+    void prepend(const char *data, size_t length);
+    void prepend(const std::string &str);
+    void prepend(const ByteBufferChain &src);
+    ByteBufferChain slice(size_t offset, size_t length) const;
+    void consume(size_t n);
+
+    int iov(iovec *iov, int max) const;
+    size_t copy(Byte *dst, size_t offset, size_t length) const;
+    std::string toString() const;
+
+    ssize_t write(SocketChannel &chan);
+
+private:
+    struct Segment;
+
+    // Piece - Bytes [begin, end) of a segment
+    struct Piece {
+        Segment *segment;
+        size_t begin;
+        size_t end;
+    };
+
+    Segment *newSegment(size_t capacity);
+    static void retain(Segment *segment);
+    static void release(Segment *segment);
+    Byte *reserve(size_t &length);
+    void commit(size_t length);
+
+private:
+    std::deque<Piece> mPieces;
+    size_t mSize = 0;
+    size_t mSegmentSize = CHAIN_SEGMENT_BYTES;
+};
+
+} // namespace nio
+} // namespace pardus
+
+
+#endif //PD_BUFCHAIN_H
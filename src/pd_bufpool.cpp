@@ -0,0 +1,176 @@
+#include "pd_bufpool.h"
+
+#include <new>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#define POOL_MIN_SHIFT 9       // smallest class, 512 B
+#define POOL_CLASSES 8         // largest class, 64 KB
+#define POOL_MAX_CACHED 64     // free blocks kept per class and thread
+
+namespace pardus {
+namespace nio {
+
+namespace {
+
+struct FreeBlock {
+    FreeBlock *next;
+};
+
+// Counter written by its owning thread only, read by anyone
+struct Counter {
+    std::atomic<int64_t> mVal{0};
+    void add(int64_t n) {
+        mVal.store(mVal.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    int64_t get() const { return mVal.load(std::memory_order_relaxed); }
+};
+
+struct ThreadCache;
+
+// All live thread caches, plus counters of the threads that exited
+struct Registry {
+    std::mutex mMutex;
+    std::vector<ThreadCache*> mCaches;
+    BufferPoolStats mRetired;
+};
+
+Registry &registry() {
+    static Registry reg;
+    return reg;
+}
+
+struct ThreadCache {
+    FreeBlock *mFree[POOL_CLASSES] = {};
+    size_t mCount[POOL_CLASSES] = {};
+    Counter mHits, mMisses, mReleases, mDrops, mBytesInUse, mBytesCached;
+
+    ThreadCache() {
+        Registry &reg = registry();
+        std::lock_guard<std::mutex> lck(reg.mMutex);
+        reg.mCaches.push_back(this);
+    }
+
+    ~ThreadCache();
+
+    void collect(BufferPoolStats &st) const {
+        st.hits += mHits.get();
+        st.misses += mMisses.get();
+        st.releases += mReleases.get();
+        st.drops += mDrops.get();
+        st.bytesInUse += mBytesInUse.get();
+        st.bytesCached += mBytesCached.get();
+    }
+};
+
+// Set once the cache of this thread is destroyed, buffers released later
+// by thread_local or static destructors go straight to the heap
+thread_local bool cache_destroyed = false;
+
+ThreadCache::~ThreadCache() {
+    cache_destroyed = true;
+    for (size_t c = 0; c < POOL_CLASSES; c++) {
+        while (FreeBlock *b = mFree[c]) {
+            mFree[c] = b->next;
+            ::operator delete(b);
+        }
+    }
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lck(reg.mMutex);
+    reg.mCaches.erase(std::find(reg.mCaches.begin(), reg.mCaches.end(), this));
+    collect(reg.mRetired);
+    reg.mRetired.bytesCached -= mBytesCached.get();
+}
+
+ThreadCache *cache() {
+    if (cache_destroyed)
+        return nullptr;
+    static thread_local ThreadCache tc;
+    return &tc;
+}
+
+// Size class of capacity, POOL_CLASSES if it's too large to pool
+size_t sizeClass(size_t capacity) {
+    size_t c = 0;
+    size_t size = size_t(1) << POOL_MIN_SHIFT;
+    while (size < capacity && c < POOL_CLASSES) {
+        size <<= 1;
+        c++;
+    }
+    return c;
+}
+
+} // namespace
+
+
+// Size of the block backing a buffer of capacity bytes
+size_t BufferPool::blockSize(size_t capacity) {
+    size_t c = sizeClass(capacity);
+    return c < POOL_CLASSES ? size_t(1) << (POOL_MIN_SHIFT + c) : capacity;
+}
+
+// Return storage for at least capacity bytes, nullptr for capacity 0
+Byte* BufferPool::allocate(size_t capacity) {
+    if (capacity == 0)
+        return nullptr;
+    size_t c = sizeClass(capacity);
+    size_t size = blockSize(capacity);
+    ThreadCache *tcp = cache();
+    if (tcp == nullptr)
+        return static_cast<Byte*>(::operator new(size));
+    ThreadCache &tc = *tcp;
+    tc.mBytesInUse.add(size);
+
+    if (c < POOL_CLASSES && tc.mFree[c]) {
+        FreeBlock *b = tc.mFree[c];
+        tc.mFree[c] = b->next;
+        tc.mCount[c]--;
+        tc.mHits.add(1);
+        tc.mBytesCached.add(-static_cast<int64_t>(size));
+        return reinterpret_cast<Byte*>(b);
+    }
+    tc.mMisses.add(1);
+    return static_cast<Byte*>(::operator new(size));
+}
+
+// Hand back storage returned by allocate(capacity)
+void BufferPool::deallocate(Byte *buff, size_t capacity) {
+    if (buff == nullptr)
+        return;
+    size_t c = sizeClass(capacity);
+    size_t size = blockSize(capacity);
+    ThreadCache *tcp = cache();
+    if (tcp == nullptr) {
+        ::operator delete(buff);
+        return;
+    }
+    ThreadCache &tc = *tcp;
+    tc.mBytesInUse.add(-static_cast<int64_t>(size));
+
+    if (c < POOL_CLASSES && tc.mCount[c] < POOL_MAX_CACHED) {
+        FreeBlock *b = reinterpret_cast<FreeBlock*>(buff);
+        b->next = tc.mFree[c];
+        tc.mFree[c] = b;
+        tc.mCount[c]++;
+        tc.mReleases.add(1);
+        tc.mBytesCached.add(size);
+        return;
+    }
+    tc.mDrops.add(1);
+    ::operator delete(buff);
+}
+
+// Snapshot of the counters of every thread
+BufferPoolStats BufferPool::stats() {
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lck(reg.mMutex);
+    BufferPoolStats st = reg.mRetired;
+    for (const ThreadCache *tc : reg.mCaches)
+        tc->collect(st);
+    return st;
+}
+
+} // namespace nio
+} // namespace pardus
@@ -0,0 +1,39 @@
+#ifndef PD_BUFPOOL_H
+#define PD_BUFPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "pd_types.h"
+
+namespace pardus {
+namespace nio {
+
+// BufferPoolStats - Counters of BufferPool, summed over all threads
+struct BufferPoolStats {
+    uint64_t hits = 0;        // allocations served from a free list
+    uint64_t misses = 0;      // allocations that went to malloc
+    uint64_t releases = 0;    // blocks handed back to a free list
+    uint64_t drops = 0;       // blocks freed because the free list was full
+    int64_t bytesInUse = 0;   // bytes held by live ByteBuffers
+    int64_t bytesCached = 0;  // bytes sitting in free lists
+};
+
+// BufferPool - Allocator of ByteBuffer storage
+// Blocks are rounded up to power of two size classes from 512 B to 64 KB,
+// and freed blocks go to free lists of the calling thread, so steady state
+// allocation is a pointer pop without locks or malloc. Larger requests go
+// straight to the heap.
+class BufferPool {
+public:
+    static Byte *allocate(size_t capacity);
+    static void deallocate(Byte *buff, size_t capacity);
+    static size_t blockSize(size_t capacity);
+    static BufferPoolStats stats();
+};
+
+} // namespace nio
+} // namespace pardus
+
+
+#endif //PD_BUFPOOL_H
@@ -0,0 +1,133 @@
+#include "pd_bytescan.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define PD_BYTESCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace pardus {
+namespace nio {
+namespace bytescan {
+
+namespace {
+
+typedef const Byte *(*FindFn)(const Byte *, const Byte *, const Byte *, size_t);
+
+// Scalar fallback, also finishes the tails of the vector loops
+const Byte *findScalar(const Byte *p, const Byte *end, const Byte *needle, size_t length) {
+    if (static_cast<size_t>(end - p) < length)
+        return nullptr;
+    const Byte *last = end - length;
+    while (p <= last) {
+        p = static_cast<const Byte*>(std::memchr(p, needle[0], last - p + 1));
+        if (p == nullptr)
+            return nullptr;
+        if (std::memcmp(p + 1, needle + 1, length - 1) == 0)
+            return p;
+        p++;
+    }
+    return nullptr;
+}
+
+#ifdef PD_BYTESCAN_X86
+
+// Candidates are the positions where both the first and the last byte of
+// the needle match; only those are verified with memcmp. For needles of
+// one or two bytes the two compares are the whole match.
+
+__attribute__((target("sse2")))
+const Byte *findSse2(const Byte *p, const Byte *end, const Byte *needle, size_t length) {
+    size_t n = end - p;
+    if (n < length)
+        return nullptr;
+    size_t starts = n - length + 1;
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[length - 1]);
+    size_t i = 0;
+    for (; i + 16 <= starts; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + length - 1));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last))));
+        while (mask) {
+            unsigned bit = __builtin_ctz(mask);
+            if (length <= 2 || std::memcmp(p + i + bit + 1, needle + 1, length - 2) == 0)
+                return p + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return findScalar(p + i, end, needle, length);
+}
+
+__attribute__((target("avx2")))
+const Byte *findAvx2(const Byte *p, const Byte *end, const Byte *needle, size_t length) {
+    size_t n = end - p;
+    if (n < length)
+        return nullptr;
+    size_t starts = n - length + 1;
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[length - 1]);
+    size_t i = 0;
+    for (; i + 32 <= starts; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + length - 1));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last))));
+        while (mask) {
+            unsigned bit = __builtin_ctz(mask);
+            if (length <= 2 || std::memcmp(p + i + bit + 1, needle + 1, length - 2) == 0)
+                return p + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return findSse2(p + i, end, needle, length);
+}
+
+#endif // PD_BYTESCAN_X86
+
+struct Dispatch {
+    FindFn mFind;
+    const char *mName;
+
+    Dispatch() : mFind(findScalar), mName("scalar") {
+#ifdef PD_BYTESCAN_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            mFind = findAvx2;
+            mName = "avx2";
+        } else if (__builtin_cpu_supports("sse2")) {
+            mFind = findSse2;
+            mName = "sse2";
+        }
+#endif
+    }
+};
+
+const Dispatch &dispatch() {
+    static const Dispatch d;
+    return d;
+}
+
+} // namespace
+
+
+const Byte *findByte(const Byte *begin, const Byte *end, Byte b) {
+    return dispatch().mFind(begin, end, &b, 1);
+}
+
+const Byte *find(const Byte *begin, const Byte *end, const Byte *needle, size_t length) {
+    if (length == 0)
+        return begin;
+    return dispatch().mFind(begin, end, needle, length);
+}
+
+const char *implementation() {
+    return dispatch().mName;
+}
+
+} // namespace bytescan
+} // namespace nio
+} // namespace pardus
@@ -0,0 +1,32 @@
+#ifndef PD_BYTESCAN_H
+#define PD_BYTESCAN_H
+
+#include <cstddef>
+
+#include "pd_types.h"
+
+namespace pardus {
+namespace nio {
+
+// Vectorized byte scanning used by ByteBuffer
+// The AVX2 or SSE2 implementation is picked once at runtime from the
+// features of the CPU, other targets use the scalar one.
+namespace bytescan {
+
+// Return pointer to the first b in [begin, end), nullptr if not found
+const Byte *findByte(const Byte *begin, const Byte *end, Byte b);
+
+// Return pointer to the first needle[0, length) in [begin, end),
+// nullptr if not found
+const Byte *find(const Byte *begin, const Byte *end, const Byte *needle, size_t length);
+
+// Name of the selected implementation: "avx2", "sse2" or "scalar"
+const char *implementation();
+
+} // namespace bytescan
+
+} // namespace nio
+} // namespace pardus
+
+
+#endif //PD_BYTESCAN_H
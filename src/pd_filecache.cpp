@@ -0,0 +1,358 @@
+#include "pd_filecache.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <sys/inotify.h>
+
+// zlib declares its own Byte, keep it from clashing with pd_types.h
+#define Byte zlib_Byte
+#include <zlib.h>
+#undef Byte
+
+#include "pd_http.h"
+
+namespace pardus {
+namespace http {
+
+namespace {
+
+const uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE
+                            | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF
+                            | IN_ONLYDIR;
+
+int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// FNV-1a, only used to derive the ETag from the content
+uint64_t fnv1a(const std::string &data) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : data) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+size_t footprint(const CachedAsset &asset) {
+    size_t bytes = asset.path.size();
+    for (const AssetVariant &v : asset.variants) {
+        bytes += v.body.size() + v.etag.size() + v.ok[0].size() + v.ok[1].size()
+                 + v.notModified[0].size() + v.notModified[1].size();
+    }
+    return bytes;
+}
+
+// Compress in as one gzip member at the best level, it is done once per load
+//    Return false on failure
+bool gzipCompress(const std::string &in, std::string &out) {
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    out.resize(deflateBound(&zs, in.size()));
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    zs.avail_in = static_cast<uInt>(in.size());
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = static_cast<uInt>(out.size());
+    int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END;
+}
+
+// Directory part of path, "" for the document root itself
+std::string dirName(const char *path) {
+    const char *slash = std::strrchr(path, '/');
+    return slash ? std::string(path, slash - path) : std::string();
+}
+
+} // namespace
+
+
+/***************************
+* CachedAsset implementation
+**************************/
+// Asset of path holding body, with its header blocks serialized
+std::shared_ptr<CachedAsset> CachedAsset::build(const std::string &path, std::string body,
+                                                time_t mtime, const char *contentType) {
+    std::shared_ptr<CachedAsset> asset = std::make_shared<CachedAsset>();
+    asset->path = path;
+    asset->mtime = mtime;
+    asset->variants[IDENTITY].body = std::move(body);
+
+    const std::string &identity = asset->variants[IDENTITY].body;
+    std::string &gzip = asset->variants[GZIP].body;
+    if (isCompressible(contentType) && gzipCompress(identity, gzip) && gzip.size() < identity.size())
+        asset->hasGzip = true;
+    else
+        std::string().swap(gzip);
+
+    char date[HTTP_DATE_SIZE + 1];
+    formatHttpDate(mtime, date, sizeof(date));
+    // Responses vary by Accept-Encoding only if there is a choice
+    const char *vary = asset->hasGzip ? "Vary: Accept-Encoding\r\n" : "";
+
+    for (int e = IDENTITY; e < (asset->hasGzip ? ENCODINGS : GZIP); e++) {
+        AssetVariant &v = asset->variants[e];
+        const char *encoding = e == GZIP ? "Content-Encoding: gzip\r\n" : "";
+        char etag[48];
+        std::snprintf(etag, sizeof(etag), "\"%016llx-%zx%s\"",
+                      static_cast<unsigned long long>(fnv1a(identity)), identity.size(),
+                      e == GZIP ? "-gzip" : "");
+        v.etag = etag;
+
+        for (int keepAlive = 0; keepAlive < 2; keepAlive++) {
+            const char *connection = keepAlive ? "keep-alive" : "close";
+            char head[512];
+            int n = std::snprintf(head, sizeof(head),
+                                  "HTTP/1.1 200 OK\r\n"
+                                  "Content-Type: %s\r\n"
+                                  "Content-Length: %zu\r\n"
+                                  "%s%s"
+                                  "ETag: %s\r\n"
+                                  "Last-Modified: %s\r\n"
+                                  "Connection: %s\r\n"
+                                  "\r\n",
+                                  contentType, v.body.size(), encoding, vary, etag, date,
+                                  connection);
+            v.ok[keepAlive].assign(head, n);
+            n = std::snprintf(head, sizeof(head),
+                              "HTTP/1.1 304 Not Modified\r\n"
+                              "%s"
+                              "ETag: %s\r\n"
+                              "Last-Modified: %s\r\n"
+                              "Connection: %s\r\n"
+                              "\r\n",
+                              vary, etag, date, connection);
+            v.notModified[keepAlive].assign(head, n);
+        }
+    }
+    return asset;
+}
+
+// Whether files of contentType are worth a gzip variant
+bool CachedAsset::isCompressible(const char *contentType) {
+    static const char *types[] = {"text/", "javascript", "json", "xml", "wasm"};
+    for (const char *t : types) {
+        if (std::strstr(contentType, t))
+            return true;
+    }
+    return false;
+}
+
+// Variant to send to a client that accepts gzip or not
+const AssetVariant& CachedAsset::select(bool acceptGzip) const {
+    return variants[acceptGzip && hasGzip ? GZIP : IDENTITY];
+}
+
+// Evaluate the request preconditions against variant, a null header is
+// absent. If-Modified-Since is ignored when If-None-Match is present.
+//    Return true if 304 Not Modified should be answered
+bool CachedAsset::isNotModified(const AssetVariant &variant,
+                                const char *ifNoneMatch, size_t inmLength,
+                                const char *ifModifiedSince, size_t imsLength) const {
+    if (ifNoneMatch)
+        return etagListMatches(ifNoneMatch, inmLength, variant.etag.c_str());
+    if (ifModifiedSince) {
+        time_t since = parseHttpDate(ifModifiedSince, imsLength);
+        return since != -1 && mtime <= since;
+    }
+    return false;
+}
+
+
+/***************************
+* FileCache implementation
+**************************/
+FileCache::FileCache(const std::string &docRoot, size_t maxBytes, size_t maxFileBytes)
+        : mDocRoot(docRoot), mMaxBytes(maxBytes), mMaxFileBytes(maxFileBytes) {
+    // Without notifications nothing could be invalidated, so nothing is cached
+    if (maxBytes > 0 && maxFileBytes > 0)
+        mInotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+}
+
+FileCache::~FileCache() {
+    if (mInotifyFd >= 0)
+        ::close(mInotifyFd);
+}
+
+bool FileCache::isEnabled() {
+    return mInotifyFd >= 0;
+}
+
+// Largest file that is cached
+size_t FileCache::maxFileBytes() {
+    return mMaxFileBytes;
+}
+
+// Cached asset of path [path, path+length), relative to the document root
+//    Return nullptr on a miss
+std::shared_ptr<const CachedAsset> FileCache::get(const char *path, size_t length) {
+    if (mInotifyFd < 0)
+        return nullptr;
+    if (nowMs() >= mNextPoll.load(std::memory_order_relaxed))
+        poll();
+
+    thread_local std::string key;
+    key.assign(path, length);
+    std::lock_guard<std::mutex> lock(mLock);
+    auto it = mIndex.find(key);
+    if (it == mIndex.end()) {
+        mStats.misses++;
+        return nullptr;
+    }
+    mStats.hits++;
+    mLru.splice(mLru.begin(), mLru, it->second);
+    return *it->second;
+}
+
+// Watch the directory of path, call before reading the file to cache
+// epoch receives the value to pass to put().
+//    Return false if changes of the file could not be noticed
+bool FileCache::watch(const char *path, uint64_t &epoch) {
+    if (mInotifyFd < 0)
+        return false;
+    std::string dir = dirName(path);
+    std::lock_guard<std::mutex> lock(mLock);
+    epoch = mEpoch;
+    if (mWatched.count(dir))
+        return true;
+    std::string full = dir.empty() ? mDocRoot : mDocRoot + "/" + dir;
+    int wd = inotify_add_watch(mInotifyFd, full.c_str(), WATCH_MASK);
+    if (wd < 0)
+        return false;
+    mWatches[wd] = dir;
+    mWatched[dir] = wd;
+    return true;
+}
+
+// Insert asset, read after watch() returned epoch
+// It is dropped if events arrived meanwhile, it might be stale already.
+void FileCache::put(std::shared_ptr<const CachedAsset> asset, uint64_t epoch) {
+    if (footprint(*asset) > mMaxBytes)
+        return;
+    std::lock_guard<std::mutex> lock(mLock);
+    if (epoch != mEpoch)
+        return;
+    auto it = mIndex.find(asset->path);
+    if (it != mIndex.end()) {
+        mStats.bytesResident -= footprint(**it->second);
+        mLru.erase(it->second);
+        mIndex.erase(it);
+    }
+    mStats.bytesResident += footprint(*asset);
+    mLru.push_front(std::move(asset));
+    mIndex[mLru.front()->path] = mLru.begin();
+    evict();
+}
+
+// Drop every entry
+void FileCache::clear() {
+    std::lock_guard<std::mutex> lock(mLock);
+    eraseAll();
+}
+
+// Start over in a child after fork()
+// The inotify instance is shared with the parent and events one process
+// reads never reach the other, so the child takes its own and drops the
+// entries and watches it inherited. Caching stops if that fails.
+void FileCache::reopen() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mInotifyFd < 0)
+        return;
+    ::close(mInotifyFd);
+    mInotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    mWatches.clear();
+    mWatched.clear();
+    mIndex.clear();
+    mLru.clear();
+    mStats.bytesResident = 0;
+    mEpoch++;
+    mNextPoll.store(0, std::memory_order_relaxed);
+}
+
+FileCacheStats FileCache::stats() {
+    std::lock_guard<std::mutex> lock(mLock);
+    FileCacheStats stats = mStats;
+    stats.entries = mLru.size();
+    return stats;
+}
+
+// Drain pending inotify events, only one thread at a time
+void FileCache::poll() {
+    std::unique_lock<std::mutex> pollLock(mPollLock, std::try_to_lock);
+    if (!pollLock.owns_lock())
+        return;
+    mNextPoll.store(nowMs() + FILECACHE_POLL_MS, std::memory_order_relaxed);
+
+    alignas(inotify_event) char buf[4096];
+    for (;;) {
+        ssize_t n = ::read(mInotifyFd, buf, sizeof(buf));
+        if (n <= 0)
+            return;
+
+        std::lock_guard<std::mutex> lock(mLock);
+        mEpoch++;
+        for (char *p = buf; p < buf + n; ) {
+            inotify_event *ev = reinterpret_cast<inotify_event*>(p);
+            p += sizeof(inotify_event) + ev->len;
+
+            if (ev->mask & IN_IGNORED) {
+                // Watch removed, the directory is gone
+                auto it = mWatches.find(ev->wd);
+                if (it != mWatches.end()) {
+                    mWatched.erase(it->second);
+                    mWatches.erase(it);
+                }
+            }
+            if (ev->mask & (IN_Q_OVERFLOW | IN_ISDIR | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                // Events lost or a directory changed, paths can not be trusted
+                eraseAll();
+                continue;
+            }
+            auto it = mWatches.find(ev->wd);
+            if (it == mWatches.end() || ev->len == 0)
+                continue;
+            erase(it->second.empty() ? std::string(ev->name)
+                                     : it->second + "/" + ev->name);
+        }
+    }
+}
+
+// Drop the entry of path, mLock held
+void FileCache::erase(const std::string &path) {
+    auto it = mIndex.find(path);
+    if (it == mIndex.end())
+        return;
+    mStats.bytesResident -= footprint(**it->second);
+    mStats.invalidations++;
+    mLru.erase(it->second);
+    mIndex.erase(it);
+}
+
+// Drop every entry, mLock held
+void FileCache::eraseAll() {
+    mStats.invalidations += mLru.size();
+    mStats.bytesResident = 0;
+    mIndex.clear();
+    mLru.clear();
+}
+
+// Drop least recently used entries until under the size limit, mLock held
+void FileCache::evict() {
+    while (mStats.bytesResident > mMaxBytes && !mLru.empty()) {
+        mStats.bytesResident -= footprint(*mLru.back());
+        mStats.evictions++;
+        mIndex.erase(mLru.back()->path);
+        mLru.pop_back();
+    }
+}
+
+} // namespace http
+} // namespace pardus
@@ -0,0 +1,110 @@
+#ifndef PD_FILECACHE_H
+#define PD_FILECACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#define FILECACHE_POLL_MS 50
+
+namespace pardus {
+namespace http {
+
+// AssetVariant - One content coding of a CachedAsset
+struct AssetVariant {
+    std::string body;
+    std::string etag;           // strong validator, quoted
+    std::string ok[2];          // 200 header block, [keepAlive]
+    std::string notModified[2]; // 304 header block, [keepAlive]
+};
+
+// CachedAsset - File held in memory with its serialized response headers
+// Compressible files also get a gzip variant, built once when the file is
+// loaded, if it is smaller. Immutable once built; an invalidated asset
+// stays valid for responses still referencing it.
+struct CachedAsset {
+    enum Encoding {
+        IDENTITY,
+        GZIP,
+        ENCODINGS
+    };
+
+    std::string path;           // relative to the document root
+    time_t mtime = 0;
+    bool hasGzip = false;
+    AssetVariant variants[ENCODINGS];
+
+    static std::shared_ptr<CachedAsset> build(const std::string &path, std::string body,
+                                              time_t mtime, const char *contentType);
+    static bool isCompressible(const char *contentType);
+    const AssetVariant &select(bool acceptGzip) const;
+    bool isNotModified(const AssetVariant &variant,
+                       const char *ifNoneMatch, size_t inmLength,
+                       const char *ifModifiedSince, size_t imsLength) const;
+};
+
+struct FileCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;      // dropped to stay under the size limit
+    uint64_t invalidations;  // dropped because the file changed
+    size_t entries;
+    size_t bytesResident;    // bodies and header blocks
+};
+
+// FileCache - LRU cache of small files of a document root
+// Shared by all threads. Directories holding cached files are watched with
+// inotify; the events are drained at most every FILECACHE_POLL_MS by the
+// lookups, so a changed file is dropped without any filesystem access on
+// the hit path. A process forked off has to reopen() it before use.
+class FileCache {
+public:
+    FileCache(const std::string &docRoot, size_t maxBytes, size_t maxFileBytes);
+    FileCache(const FileCache &) = delete;
+    FileCache& operator=(const FileCache &) = delete;
+    ~FileCache();
+
+    bool isEnabled();
+    size_t maxFileBytes();
+    std::shared_ptr<const CachedAsset> get(const char *path, size_t length);
+    bool watch(const char *path, uint64_t &epoch);
+    void put(std::shared_ptr<const CachedAsset> asset, uint64_t epoch);
+    void clear();
+    void reopen();
+    FileCacheStats stats();
+
+private:
+    typedef std::list<std::shared_ptr<const CachedAsset>> Lru;
+
+    void poll();
+    void erase(const std::string &path);
+    void eraseAll();
+    void evict();
+
+private:
+    std::string mDocRoot;
+    size_t mMaxBytes;
+    size_t mMaxFileBytes;
+    int mInotifyFd = -1;
+    std::atomic<int64_t> mNextPoll{0};
+    std::mutex mPollLock;
+
+    std::mutex mLock;
+    Lru mLru;                                           // most recent first
+    std::unordered_map<std::string, Lru::iterator> mIndex;
+    std::unordered_map<int, std::string> mWatches;      // wd to directory
+    std::unordered_map<std::string, int> mWatched;      // directory to wd
+    uint64_t mEpoch = 0;                                // bumped by every drained event
+    FileCacheStats mStats{};
+};
+
+} // namespace http
+} // namespace pardus
+
+
+#endif //PD_FILECACHE_H
@@ -0,0 +1,142 @@
+#include "pd_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace pardus {
+namespace metrics {
+
+namespace {
+
+const size_t SUB_HALF = HISTOGRAM_SUB_COUNT / 2;
+
+// First value counted by bucket
+uint64_t bucketLow(size_t bucket) {
+    if (bucket < HISTOGRAM_SUB_COUNT)
+        return bucket;
+    unsigned shift = bucket / SUB_HALF - 1;
+    return static_cast<uint64_t>(bucket - SUB_HALF * shift) << shift;
+}
+
+} // namespace
+
+
+/***************************
+* Histogram implementation
+**************************/
+Histogram::Histogram() {
+    std::memset(mCounts, 0, sizeof(mCounts));
+}
+
+// Index of the bucket counting value
+// Values under HISTOGRAM_SUB_COUNT map to themselves; above, the top
+// HISTOGRAM_SUB_BITS bits of value select a bucket of its power of two.
+size_t Histogram::bucketOf(uint64_t value) {
+    if (value < HISTOGRAM_SUB_COUNT)
+        return value;
+    unsigned shift = 63 - __builtin_clzll(value) - (HISTOGRAM_SUB_BITS - 1);
+    return SUB_HALF * shift + (value >> shift);
+}
+
+// Largest value counted by bucket
+uint64_t Histogram::bucketHigh(size_t bucket) {
+    if (bucket < HISTOGRAM_SUB_COUNT)
+        return bucket;
+    unsigned shift = bucket / SUB_HALF - 1;
+    // Wraps to UINT64_MAX for the last bucket
+    return (static_cast<uint64_t>(bucket - SUB_HALF * shift + 1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t value, uint64_t count) {
+    mCounts[bucketOf(value)] += count;
+    mCount += count;
+    mMin = std::min(mMin, value);
+    mMax = std::max(mMax, value);
+    mSum += static_cast<double>(value) * count;
+}
+
+// Record value, and the values the samples that were not taken while it
+// lasted would have had, when one was due every expectedInterval
+// Corrects for coordinated omission: a closed loop client stalled by one
+// slow response stops sending the requests that would have seen the stall.
+void Histogram::recordCorrected(uint64_t value, uint64_t expectedInterval) {
+    record(value);
+    if (expectedInterval == 0)
+        return;
+    for (uint64_t missing = value - std::min(value, expectedInterval);
+         missing >= expectedInterval; missing -= expectedInterval)
+        record(missing);
+}
+
+void Histogram::merge(const Histogram &other) {
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+        mCounts[i] += other.mCounts[i];
+    mCount += other.mCount;
+    mMin = std::min(mMin, other.mMin);
+    mMax = std::max(mMax, other.mMax);
+    mSum += other.mSum;
+}
+
+// Copy corrected after the fact as if recorded with recordCorrected()
+//    Return the corrected copy
+Histogram Histogram::corrected(uint64_t expectedInterval) const {
+    Histogram h(*this);
+    if (expectedInterval == 0)
+        return h;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (mCounts[i] == 0)
+            continue;
+        uint64_t value = bucketLow(i);
+        for (uint64_t missing = value - std::min(value, expectedInterval);
+             missing >= expectedInterval; missing -= expectedInterval)
+            h.record(missing, mCounts[i]);
+    }
+    return h;
+}
+
+void Histogram::reset() {
+    std::memset(mCounts, 0, sizeof(mCounts));
+    mCount = 0;
+    mMin = UINT64_MAX;
+    mMax = 0;
+    mSum = 0;
+}
+
+uint64_t Histogram::count() const {
+    return mCount;
+}
+
+uint64_t Histogram::min() const {
+    return mCount ? mMin : 0;
+}
+
+uint64_t Histogram::max() const {
+    return mMax;
+}
+
+double Histogram::mean() const {
+    return mCount ? mSum / mCount : 0;
+}
+
+// Value at or below which p percent of the recorded values fall
+//    Return the largest value of the bucket reaching p, at most max()
+//    Return 0 when empty
+uint64_t Histogram::percentile(double p) const {
+    if (mCount == 0)
+        return 0;
+    if (p <= 0)
+        return mMin;
+    uint64_t rank = static_cast<uint64_t>(std::ceil(std::min(p, 100.0) / 100 * mCount));
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += mCounts[i];
+        if (seen >= rank)
+            return std::min(bucketHigh(i), mMax);
+    }
+    return mMax;
+}
+
+} // namespace metrics
+} // namespace pardus
@@ -0,0 +1,62 @@
+#ifndef PD_HISTOGRAM_H
+#define PD_HISTOGRAM_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Values below 2^HISTOGRAM_SUB_BITS are counted exactly, larger ones in
+// buckets 1/2^(HISTOGRAM_SUB_BITS-1) of their magnitude wide
+#define HISTOGRAM_SUB_BITS 7
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 2) * (HISTOGRAM_SUB_COUNT / 2))
+
+namespace pardus {
+namespace metrics {
+
+// Histogram - Log-linear histogram of 64 bit values, after HdrHistogram
+// Covers the whole uint64_t range with a relative error under 1/64 in a
+// fixed array of counts, so record() is a few instructions and never
+// allocates. Not thread safe; keep one per thread and merge() them.
+class Histogram {
+public:
+    Histogram();
+
+    void record(uint64_t value, uint64_t count = 1);
+    void recordCorrected(uint64_t value, uint64_t expectedInterval);
+    void merge(const Histogram &other);
+    Histogram corrected(uint64_t expectedInterval) const;
+    void reset();
+
+    uint64_t count() const;
+    uint64_t min() const;
+    uint64_t max() const;
+    double mean() const;
+    uint64_t percentile(double p) const;
+
+    template <class Fn>
+    void forEachBucket(Fn &&fn) const;
+
+    static size_t bucketOf(uint64_t value);
+    static uint64_t bucketHigh(size_t bucket);
+
+private:
+    uint64_t mCounts[HISTOGRAM_BUCKETS];
+    uint64_t mCount = 0;
+    uint64_t mMin = UINT64_MAX;
+    uint64_t mMax = 0;
+    double mSum = 0;
+};
+
+// Call fn(highestValue, count) for every non-empty bucket in value order
+template <class Fn>
+void Histogram::forEachBucket(Fn &&fn) const {
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+        if (mCounts[i])
+            fn(bucketHigh(i), mCounts[i]);
+}
+
+} // namespace metrics
+} // namespace pardus
+
+
+#endif //PD_HISTOGRAM_H
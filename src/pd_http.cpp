@@ -0,0 +1,716 @@
+#include "pd_http.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <strings.h>
+#include <algorithm>
+#include <time.h>
+
+#include "pd_bytescan.h"
+
+namespace pardus {
+namespace http {
+
+const Byte CRLF[2] = {'\r', '\n'};
+const Byte CRLFCRLF[4] = {'\r', '\n', '\r', '\n'};
+
+namespace {
+
+// Longest chunk-size line accepted, extensions included
+const size_t MAX_CHUNK_LINE = 1024;
+
+// token characters of RFC 9110
+bool isTchar(unsigned char c) {
+    static const char *extra = "!#$%&'*+-.^_`|~";
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+           || (c != 0 && std::strchr(extra, c) != nullptr);
+}
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Whether parameters [p, p+len) of a list element carry "q=0", which
+// refuses the element; "q=0.000" is the same weight
+bool isZeroWeight(const char *p, size_t len) {
+    const char *end = p + len;
+    while (p < end) {
+        while (p < end && (*p == ';' || isOws(*p)))
+            p++;
+        if (end - p >= 2 && (p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+            p += 2;
+            if (p == end || *p != '0')
+                return false;
+            for (p++; p < end && !isOws(*p) && *p != ';'; p++) {
+                if (*p != '.' && *p != '0')
+                    return false;
+            }
+            return true;
+        }
+        while (p < end && *p != ';')
+            p++;
+    }
+    return false;
+}
+
+} // namespace
+
+
+/***************************
+* Slice implementation
+**************************/
+const char* Slice::data(ByteBuffer &buf) const {
+    return buf.array() + offset;
+}
+
+// Copy of the viewed bytes
+std::string Slice::toString(ByteBuffer &buf) const {
+    return std::string(data(buf), length);
+}
+
+bool Slice::equals(ByteBuffer &buf, const char *str) const {
+    return std::strlen(str) == length && std::memcmp(data(buf), str, length) == 0;
+}
+
+bool Slice::equalsIgnoreCase(ByteBuffer &buf, const char *str) const {
+    return tokenEquals(data(buf), length, str);
+}
+
+
+/***************************
+* HttpRequest implementation
+**************************/
+// First header named name (case insensitive), nullptr if absent
+const HttpHeader* HttpRequest::header(ByteBuffer &buf, const char *name) const {
+    for (size_t i = 0; i < headerCount; i++) {
+        if (headers[i].name.equalsIgnoreCase(buf, name))
+            return &headers[i];
+    }
+    return nullptr;
+}
+
+
+/*********************************
+* HttpRequestParser implementation
+*********************************/
+HttpRequestParser::HttpRequestParser() {
+}
+
+HttpRequestParser::HttpRequestParser(const HttpLimits &limits) : mLimits(limits) {
+    mLimits.maxHeaders = std::min(mLimits.maxHeaders, static_cast<size_t>(HTTP_MAX_HEADERS));
+}
+
+// Start parsing a new request at offset begin,
+// e.g. at request().end of the previous one for pipelined requests
+void HttpRequestParser::reset(size_t begin) {
+    mRequest.method = Slice();
+    mRequest.target = Slice();
+    mRequest.version = Slice();
+    mRequest.versionMinor = 1;
+    mRequest.headerCount = 0;
+    mRequest.body = Slice();
+    mRequest.bodySpilled = 0;
+    mRequest.contentLength = 0;
+    mRequest.chunked = false;
+    mRequest.keepAlive = true;
+    mRequest.begin = begin;
+    mRequest.end = begin;
+    mState = ST_HEAD;
+    mError = 0;
+    mScan = begin;
+    mBodyWrite = begin;
+    mChunkLeft = 0;
+}
+
+HttpRequest& HttpRequestParser::request() {
+    return mRequest;
+}
+
+// HTTP status code describing the last PARSE_ERROR, e.g. 400 or 431
+int HttpRequestParser::error() {
+    return mError;
+}
+
+// Whether the request head is still being received
+bool HttpRequestParser::inHead() {
+    return mState == ST_HEAD;
+}
+
+HttpRequestParser::Status HttpRequestParser::fail(int status) {
+    mState = ST_ERROR;
+    mError = status;
+    return PARSE_ERROR;
+}
+
+// Move the current request to the front of buf to make room for more data
+// Every offset held by the parser and the request is shifted accordingly.
+void HttpRequestParser::compact(ByteBuffer &buf) {
+    size_t shift = mRequest.begin;
+    if (shift == 0)
+        return;
+    size_t used = buf.pos() - shift;
+    std::memmove(buf.array(), buf.array() + shift, used);
+    buf.pos(used);
+
+    mRequest.method.offset -= std::min(shift, mRequest.method.offset);
+    mRequest.target.offset -= std::min(shift, mRequest.target.offset);
+    mRequest.version.offset -= std::min(shift, mRequest.version.offset);
+    for (size_t i = 0; i < mRequest.headerCount; i++) {
+        mRequest.headers[i].name.offset -= shift;
+        mRequest.headers[i].value.offset -= shift;
+    }
+    mRequest.body.offset -= std::min(shift, mRequest.body.offset);
+    mRequest.begin -= shift;
+    mRequest.end -= std::min(shift, mRequest.end);
+    mScan -= shift;
+    mBodyWrite -= shift;
+}
+
+// Move the body received so far out of buf to the end of body, making room
+// in buf for the rest of it; the head stays in place. Of a chunked body only
+// the decoded bytes are moved, the framing after them is shifted down.
+//    Return number of bytes freed in buf, 0 when there is no body to move
+size_t HttpRequestParser::spill(ByteBuffer &buf, ByteBufferChain &body) {
+    Byte *base = buf.array();
+    size_t end = buf.pos();
+    size_t offset = mRequest.body.offset;
+
+    switch (mState) {
+    case ST_BODY:
+        body.append(base + offset, end - offset);
+        mRequest.bodySpilled += end - offset;
+        buf.pos(offset);
+        return end - offset;
+
+    case ST_CHUNK_SIZE:
+    case ST_CHUNK_DATA:
+    case ST_TRAILERS: {
+        size_t freed = mScan - offset;
+        body.append(base + offset, mBodyWrite - offset);
+        mRequest.bodySpilled += mBodyWrite - offset;
+        std::memmove(base + offset, base + mScan, end - mScan);
+        buf.pos(end - freed);
+        mScan = offset;
+        mBodyWrite = offset;
+        return freed;
+    }
+
+    default:
+        return 0;
+    }
+}
+
+// Parse what has arrived in [request().begin, buf.pos())
+//    Return PARSE_DONE once the whole request including its body is there
+//    Return PARSE_INCOMPLETE when more data is needed
+//    Return PARSE_ERROR on a malformed request, error() gives the status code
+HttpRequestParser::Status HttpRequestParser::parse(ByteBuffer &buf) {
+    Byte *base = buf.array();
+    size_t end = buf.pos();
+
+    for (;;) {
+        switch (mState) {
+        case ST_HEAD: {
+            Status st = parseHead(buf, end);
+            if (st != PARSE_DONE)
+                return st;
+            break;
+        }
+
+        case ST_BODY:
+            if (mRequest.bodySpilled + (end - mRequest.body.offset) < mRequest.contentLength)
+                return PARSE_INCOMPLETE;
+            mRequest.body.length = mRequest.contentLength - mRequest.bodySpilled;
+            mRequest.end = mRequest.body.offset + mRequest.body.length;
+            mState = ST_DONE;
+            break;
+
+        case ST_CHUNK_SIZE: {
+            const Byte *at = nio::bytescan::find(base + mScan, base + end, CRLF, 2);
+            if (at == nullptr) {
+                if (end - mScan > MAX_CHUNK_LINE)
+                    return fail(400);
+                return PARSE_INCOMPLETE;
+            }
+            Status st = parseChunkSize(buf, mScan, at - base);
+            if (st != PARSE_DONE)
+                return st;
+            mScan = at - base + 2;
+            break;
+        }
+
+        case ST_CHUNK_DATA: {
+            size_t n = std::min(end - mScan, mChunkLeft);
+            std::memmove(base + mBodyWrite, base + mScan, n);
+            mBodyWrite += n;
+            mScan += n;
+            mChunkLeft -= n;
+            if (mChunkLeft > 0 || end - mScan < 2)
+                return PARSE_INCOMPLETE;
+            if (std::memcmp(base + mScan, CRLF, 2) != 0)
+                return fail(400);
+            mScan += 2;
+            mState = ST_CHUNK_SIZE;
+            break;
+        }
+
+        case ST_TRAILERS: {
+            // Trailer fields are skipped, the body is already complete
+            if (end - mScan < 2)
+                return PARSE_INCOMPLETE;
+            size_t stop;
+            if (std::memcmp(base + mScan, CRLF, 2) == 0) {
+                stop = mScan + 2;
+            } else {
+                const Byte *at = nio::bytescan::find(base + mScan, base + end, CRLFCRLF, 4);
+                if (at == nullptr) {
+                    if (end - mScan > mLimits.maxHeaderBytes)
+                        return fail(431);
+                    return PARSE_INCOMPLETE;
+                }
+                stop = at - base + 4;
+            }
+            mRequest.body.length = mBodyWrite - mRequest.body.offset;
+            mRequest.end = stop;
+            mState = ST_DONE;
+            break;
+        }
+
+        case ST_DONE:
+            return PARSE_DONE;
+
+        case ST_ERROR:
+            return PARSE_ERROR;
+        }
+    }
+}
+
+// Find the end of the header block, then parse request line and headers
+HttpRequestParser::Status HttpRequestParser::parseHead(ByteBuffer &buf, size_t end) {
+    Byte *base = buf.array();
+    size_t begin = mRequest.begin;
+
+    // Tolerate empty lines ahead of the request line (RFC 9112 section 2.2)
+    while (begin + 2 <= end && std::memcmp(base + begin, CRLF, 2) == 0)
+        begin += 2;
+    if (begin != mRequest.begin) {
+        mRequest.begin = begin;
+        mScan = std::max(mScan, begin);
+    }
+
+    const Byte *at = nio::bytescan::find(base + mScan, base + end, CRLFCRLF, 4);
+    if (at == nullptr) {
+        if (end - begin > mLimits.maxHeaderBytes)
+            return fail(431);
+        // The terminator may straddle this read and the next one
+        mScan = std::max(begin, end >= 3 ? end - 3 : 0);
+        return PARSE_INCOMPLETE;
+    }
+
+    size_t headEnd = at - base + 4;
+    if (headEnd - begin > mLimits.maxHeaderBytes)
+        return fail(431);
+
+    const Byte *eol = nio::bytescan::find(base + begin, at + 2, CRLF, 2);
+    size_t lineEnd = eol - base;
+    Status st = parseRequestLine(buf, begin, lineEnd);
+    if (st != PARSE_DONE)
+        return st;
+    st = parseHeaderFields(buf, lineEnd + 2, headEnd - 2);
+    if (st != PARSE_DONE)
+        return st;
+
+    mRequest.body.offset = headEnd;
+    mRequest.end = headEnd;
+    mScan = headEnd;
+    mBodyWrite = headEnd;
+    if (mRequest.chunked) {
+        mState = ST_CHUNK_SIZE;
+    } else if (mRequest.contentLength > 0) {
+        mState = ST_BODY;
+    } else {
+        mState = ST_DONE;
+    }
+    return PARSE_DONE;
+}
+
+// method SP request-target SP HTTP-version, in [begin, end)
+HttpRequestParser::Status HttpRequestParser::parseRequestLine(ByteBuffer &buf, size_t begin, size_t end) {
+    const char *base = buf.array();
+    size_t p = begin;
+
+    while (p < end && isTchar(static_cast<unsigned char>(base[p])))
+        p++;
+    if (p == begin || p >= end || base[p] != ' ')
+        return fail(400);
+    mRequest.method.offset = begin;
+    mRequest.method.length = p - begin;
+
+    size_t target = ++p;
+    while (p < end && static_cast<unsigned char>(base[p]) > ' ' && base[p] != 0x7f)
+        p++;
+    if (p == target || p >= end || base[p] != ' ')
+        return fail(400);
+    mRequest.target.offset = target;
+    mRequest.target.length = p - target;
+
+    size_t version = ++p;
+    size_t len = end - version;
+    const char *v = base + version;
+    if (len != 8 || std::memcmp(v, "HTTP/", 5) != 0 || v[6] != '.'
+        || !std::isdigit(static_cast<unsigned char>(v[5]))
+        || !std::isdigit(static_cast<unsigned char>(v[7])))
+        return fail(400);
+    if (v[5] != '1')
+        return fail(505);
+    mRequest.version.offset = version;
+    mRequest.version.length = len;
+    mRequest.versionMinor = v[7] - '0';
+    // HTTP/1.0 closes by default, HTTP/1.1 keeps the connection alive
+    mRequest.keepAlive = mRequest.versionMinor >= 1;
+    return PARSE_DONE;
+}
+
+// Header fields in [begin, end), each line terminated by CRLF
+HttpRequestParser::Status HttpRequestParser::parseHeaderFields(ByteBuffer &buf, size_t begin, size_t end) {
+    const char *base = buf.array();
+    bool hasLength = false;
+    bool connClose = false;
+    bool connKeepAlive = false;
+
+    size_t line = begin;
+    while (line < end) {
+        const Byte *eol = nio::bytescan::find(base + line, base + end + 2, CRLF, 2);
+        size_t lineEnd = eol - base;
+
+        // Obsolete line folding is rejected
+        if (isOws(base[line]))
+            return fail(400);
+        size_t p = line;
+        while (p < lineEnd && isTchar(static_cast<unsigned char>(base[p])))
+            p++;
+        if (p == line || p >= lineEnd || base[p] != ':')
+            return fail(400);
+        if (mRequest.headerCount >= mLimits.maxHeaders)
+            return fail(431);
+
+        HttpHeader &h = mRequest.headers[mRequest.headerCount++];
+        h.name.offset = line;
+        h.name.length = p - line;
+
+        size_t vbegin = p + 1;
+        size_t vend = lineEnd;
+        while (vbegin < vend && isOws(base[vbegin]))
+            vbegin++;
+        while (vend > vbegin && isOws(base[vend - 1]))
+            vend--;
+        for (size_t i = vbegin; i < vend; i++) {
+            if (base[i] == '\0' || base[i] == '\r' || base[i] == '\n')
+                return fail(400);
+        }
+        h.value.offset = vbegin;
+        h.value.length = vend - vbegin;
+
+        const char *value = base + vbegin;
+        size_t vlen = vend - vbegin;
+        if (h.name.equalsIgnoreCase(buf, "Content-Length")) {
+            if (vlen == 0 || vlen > 19)
+                return fail(400);
+            size_t n = 0;
+            for (size_t i = 0; i < vlen; i++) {
+                if (!std::isdigit(static_cast<unsigned char>(value[i])))
+                    return fail(400);
+                n = n * 10 + (value[i] - '0');
+            }
+            if (hasLength && n != mRequest.contentLength)
+                return fail(400);
+            if (n > mLimits.maxBodyBytes)
+                return fail(413);
+            hasLength = true;
+            mRequest.contentLength = n;
+        } else if (h.name.equalsIgnoreCase(buf, "Transfer-Encoding")) {
+            if (!tokenEquals(value, vlen, "chunked"))
+                return fail(501);
+            mRequest.chunked = true;
+        } else if (h.name.equalsIgnoreCase(buf, "Connection")) {
+            connClose = connClose || hasToken(value, vlen, "close");
+            connKeepAlive = connKeepAlive || hasToken(value, vlen, "keep-alive");
+        }
+        line = lineEnd + 2;
+    }
+
+    if (mRequest.chunked && hasLength) {
+        // Transfer-Encoding overrides Content-Length, but the framing is
+        // suspicious, so the connection is closed afterwards
+        mRequest.contentLength = 0;
+        connClose = true;
+    }
+    if (connClose)
+        mRequest.keepAlive = false;
+    else if (connKeepAlive)
+        mRequest.keepAlive = true;
+    return PARSE_DONE;
+}
+
+// chunk-size [ chunk-ext ], in [begin, end)
+HttpRequestParser::Status HttpRequestParser::parseChunkSize(ByteBuffer &buf, size_t begin, size_t end) {
+    const char *base = buf.array();
+    size_t size = 0;
+    size_t p = begin;
+    int digit;
+    while (p < end && (digit = hexValue(base[p])) >= 0) {
+        if (size > (mLimits.maxBodyBytes >> 4) + 1)
+            return fail(413);
+        size = (size << 4) | static_cast<size_t>(digit);
+        p++;
+    }
+    if (p == begin || (p < end && base[p] != ';' && !isOws(base[p])))
+        return fail(400);
+
+    if (size == 0) {
+        mState = ST_TRAILERS;
+        return PARSE_DONE;
+    }
+    if (mRequest.bodySpilled + (mBodyWrite - mRequest.body.offset) + size > mLimits.maxBodyBytes)
+        return fail(413);
+    mChunkLeft = size;
+    mState = ST_CHUNK_DATA;
+    return PARSE_DONE;
+}
+
+
+/***************************
+* Response head parsing
+**************************/
+// Status line and header fields of head [head, head+length), which ends
+// with the empty line
+//    Return 0 on success
+//    On error, return -1 and sets errno to EPROTO
+int parseResponseHead(const char *head, size_t length, HttpResponseHead &resp) {
+    const char *end = head + length;
+    resp = HttpResponseHead();
+    if (length < 4 || std::memcmp(end - 4, CRLFCRLF, 4) != 0) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    // HTTP/1.x SSS reason
+    const Byte *p = head;
+    const Byte *eol = nio::bytescan::find(p, end, CRLF, 2);
+    if (eol - p < 12 || std::strncmp(p, "HTTP/1.", 7) != 0
+        || !std::isdigit(static_cast<unsigned char>(p[7])) || p[8] != ' '
+        || !std::isdigit(static_cast<unsigned char>(p[9]))
+        || !std::isdigit(static_cast<unsigned char>(p[10]))
+        || !std::isdigit(static_cast<unsigned char>(p[11]))
+        || (eol - p > 12 && p[12] != ' ')) {
+        errno = EPROTO;
+        return -1;
+    }
+    resp.versionMinor = p[7] - '0';
+    resp.status = (p[9] - '0') * 100 + (p[10] - '0') * 10 + (p[11] - '0');
+    resp.reason = eol - p > 12 ? p + 13 : eol;
+    resp.reasonLength = eol - resp.reason;
+
+    bool connClose = false, connKeepAlive = false;
+    for (const Byte *line = eol + 2; line < end - 2; line = eol + 2) {
+        eol = nio::bytescan::find(line, end, CRLF, 2);
+        const Byte *colon = nio::bytescan::findByte(line, eol, ':');
+        if (colon == nullptr || colon == line) {
+            errno = EPROTO;
+            return -1;
+        }
+        const Byte *v = colon + 1, *ve = eol;
+        while (v < ve && isOws(*v))
+            v++;
+        while (ve > v && isOws(ve[-1]))
+            ve--;
+        HttpField f{line, static_cast<size_t>(colon - line), v, static_cast<size_t>(ve - v)};
+        resp.fields.push_back(f);
+
+        if (tokenEquals(f.name, f.nameLength, "Content-Length")) {
+            // Digits only, repeats have to agree
+            if (f.valueLength == 0 || f.valueLength > 19) {
+                errno = EPROTO;
+                return -1;
+            }
+            uint64_t n = 0;
+            for (size_t i = 0; i < f.valueLength; i++) {
+                if (!std::isdigit(static_cast<unsigned char>(v[i]))) {
+                    errno = EPROTO;
+                    return -1;
+                }
+                n = n * 10 + (v[i] - '0');
+            }
+            if (resp.hasLength && n != resp.contentLength) {
+                errno = EPROTO;
+                return -1;
+            }
+            resp.hasLength = true;
+            resp.contentLength = n;
+        } else if (tokenEquals(f.name, f.nameLength, "Transfer-Encoding")) {
+            // Only a final chunked coding frames the body, RFC 9112 section
+            // 6.3; repeated fields extend one list, empty elements are skipped
+            resp.transferEncoded = true;
+            const Byte *last = ve;
+            while (last > v && (isOws(last[-1]) || last[-1] == ','))
+                last--;
+            const Byte *first = last;
+            while (first > v && first[-1] != ',')
+                first--;
+            while (first < last && isOws(*first))
+                first++;
+            if (first < last)
+                resp.chunked = tokenEquals(first, last - first, "chunked");
+        } else if (tokenEquals(f.name, f.nameLength, "Connection")) {
+            connClose = connClose || hasToken(v, ve - v, "close");
+            connKeepAlive = connKeepAlive || hasToken(v, ve - v, "keep-alive");
+        }
+    }
+
+    resp.keepAlive = resp.versionMinor >= 1 ? !connClose : connKeepAlive;
+    if (resp.transferEncoded && resp.hasLength) {
+        resp.hasLength = false;
+        resp.contentLength = 0;
+        resp.keepAlive = false;
+    }
+    return 0;
+}
+
+
+/***************************
+* Header value helpers
+**************************/
+bool isOws(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// Case insensitive compare of [p, p+len) and token
+bool tokenEquals(const char *p, size_t len, const char *token) {
+    return std::strlen(token) == len && strncasecmp(p, token, len) == 0;
+}
+
+// Whether comma separated list [list, list+length) has token, case insensitive
+bool hasToken(const char *list, size_t length, const char *token) {
+    size_t i = 0;
+    while (i < length) {
+        const char *comma = static_cast<const char*>(std::memchr(list + i, ',', length - i));
+        size_t end = comma ? comma - list : length;
+        size_t b = i, e = end;
+        while (b < e && isOws(list[b]))
+            b++;
+        while (e > b && isOws(list[e - 1]))
+            e--;
+        if (tokenEquals(list + b, e - b, token))
+            return true;
+        i = end + 1;
+    }
+    return false;
+}
+
+// Whether a request with method [method, method+length) may be repeated
+// without changing its effect, RFC 9110 section 9.2.2
+bool isIdempotent(const char *method, size_t length) {
+    return tokenEquals(method, length, "GET") || tokenEquals(method, length, "HEAD")
+           || tokenEquals(method, length, "PUT") || tokenEquals(method, length, "DELETE")
+           || tokenEquals(method, length, "OPTIONS") || tokenEquals(method, length, "TRACE");
+}
+
+// chunk-size of chunk line [line, line+length), extensions are ignored
+//    Return false if there is no size or it is over 15 hex digits
+bool parseChunkSize(const char *line, size_t length, uint64_t &size) {
+    size = 0;
+    size_t p = 0;
+    int digit;
+    while (p < length && (digit = hexValue(line[p])) >= 0) {
+        if (p == 15)
+            return false;
+        size = (size << 4) | static_cast<uint64_t>(digit);
+        p++;
+    }
+    return p > 0 && (p == length || line[p] == ';' || line[p] == '\r' || line[p] == '\n' || isOws(line[p]));
+}
+
+// Write t as an IMF-fixdate to buf[0, size), size should be at least
+// HTTP_DATE_SIZE
+//    Return length of the date, 0 if it does not fit
+size_t formatHttpDate(time_t t, char *buf, size_t size) {
+    struct tm tm;
+    if (gmtime_r(&t, &tm) == nullptr)
+        return 0;
+    return strftime(buf, size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+// Parse an IMF-fixdate, the obsolete formats are not accepted
+//    Return the time, or -1 if str is not a valid date
+time_t parseHttpDate(const char *str, size_t length) {
+    char date[HTTP_DATE_SIZE + 1];
+    if (length >= sizeof(date))
+        return -1;
+    std::memcpy(date, str, length);
+    date[length] = '\0';
+
+    struct tm tm;
+    std::memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (end == nullptr || *end != '\0')
+        return -1;
+    return timegm(&tm);
+}
+
+// Weak comparison of etag against If-None-Match value [list, list+length)
+//    Return true if the list is "*" or holds etag
+bool etagListMatches(const char *list, size_t length, const char *etag) {
+    size_t etagLength = std::strlen(etag);
+    size_t p = 0;
+    while (p < length) {
+        while (p < length && (isOws(list[p]) || list[p] == ','))
+            p++;
+        size_t begin = p;
+        while (p < length && list[p] != ',')
+            p++;
+        size_t end = p;
+        while (end > begin && isOws(list[end - 1]))
+            end--;
+        if (end - begin == 1 && list[begin] == '*')
+            return true;
+        if (end - begin >= 2 && list[begin] == 'W' && list[begin + 1] == '/')
+            begin += 2;
+        if (end - begin == etagLength && std::memcmp(list + begin, etag, etagLength) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Whether Accept-Encoding value [list, list+length) allows coding
+// An explicit entry for coding takes precedence over "*".
+bool acceptsEncoding(const char *list, size_t length, const char *coding) {
+    int star = -1;  // -1 absent, 0 refused, 1 accepted
+    size_t p = 0;
+    while (p < length) {
+        while (p < length && (isOws(list[p]) || list[p] == ','))
+            p++;
+        size_t begin = p;
+        while (p < length && list[p] != ',' && list[p] != ';' && !isOws(list[p]))
+            p++;
+        size_t end = p;
+        while (p < length && list[p] != ',')
+            p++;
+
+        bool refused = isZeroWeight(list + end, p - end);
+        if (tokenEquals(list + begin, end - begin, coding))
+            return !refused;
+        if (end - begin == 1 && list[begin] == '*')
+            star = refused ? 0 : 1;
+    }
+    return star == 1;
+}
+
+} // namespace http
+} // namespace pardus
@@ -1,5 +1,165 @@
 #ifndef PD_HTTP_H
 #define PD_HTTP_H
 
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <vector>
 
-#endif //PD_HTTP_H
\ No newline at end of file
+#include "pd_net.h"
+#include "pd_bufchain.h"
+
+#define HTTP_MAX_HEADERS 64
+
+namespace pardus {
+namespace http {
+
+using nio::ByteBuffer;
+using nio::ByteBufferChain;
+
+// Slice - View of length bytes at offset of a ByteBuffer
+struct Slice {
+    size_t offset = 0;
+    size_t length = 0;
+
+    const char *data(ByteBuffer &buf) const;
+    std::string toString(ByteBuffer &buf) const;
+    bool equals(ByteBuffer &buf, const char *str) const;
+    bool equalsIgnoreCase(ByteBuffer &buf, const char *str) const;
+};
+
+struct HttpHeader {
+    Slice name;
+    Slice value;
+};
+
+// HttpRequest - Parsed request, every field is a view into the parsed buffer
+struct HttpRequest {
+    Slice method;
+    Slice target;
+    Slice version;
+    int versionMinor = 1;
+    HttpHeader headers[HTTP_MAX_HEADERS];
+    size_t headerCount = 0;
+    Slice body;
+    size_t bodySpilled = 0;     // body bytes moved out by HttpRequestParser::spill(), ahead of body
+    size_t contentLength = 0;
+    bool chunked = false;
+    bool keepAlive = true;
+    size_t begin = 0;   // offset of the first byte of the request
+    size_t end = 0;     // offset just past the request, next pipelined request starts here
+
+    const HttpHeader *header(ByteBuffer &buf, const char *name) const;
+};
+
+// HttpLimits - Size limits enforced by HttpRequestParser
+struct HttpLimits {
+    size_t maxHeaderBytes = 8192;       // request line and headers
+    size_t maxHeaders = HTTP_MAX_HEADERS;
+    size_t maxBodyBytes = 1 << 20;
+};
+
+// HttpRequestParser - Resumable HTTP/1.1 request parser
+// The request is read from [begin, buf.pos()) of a ByteBuffer that is being
+// filled by SocketChannel::read(). Call parse() after every read; scanning
+// resumes where the last call stopped. Content-Length and chunked bodies are
+// supported. Chunked bodies are decoded in place, so the body is always one
+// contiguous Slice. A body too large for the buffer is moved out of it with
+// spill() whenever the buffer fills up; the Slice then holds only what came
+// after the last spill.
+class HttpRequestParser {
+public:
+    enum Status {
+        PARSE_INCOMPLETE,
+        PARSE_DONE,
+        PARSE_ERROR
+    };
+
+    HttpRequestParser();
+    explicit HttpRequestParser(const HttpLimits &limits);
+
+    void reset(size_t begin = 0);
+    Status parse(ByteBuffer &buf);
+    void compact(ByteBuffer &buf);
+    size_t spill(ByteBuffer &buf, ByteBufferChain &body);
+
+    HttpRequest &request();
+    int error();
+    bool inHead();
+
+private:
+    enum State {
+        ST_HEAD,
+        ST_BODY,
+        ST_CHUNK_SIZE,
+        ST_CHUNK_DATA,
+        ST_TRAILERS,
+        ST_DONE,
+        ST_ERROR
+    };
+
+    Status fail(int status);
+    Status parseHead(ByteBuffer &buf, size_t end);
+    Status parseRequestLine(ByteBuffer &buf, size_t begin, size_t end);
+    Status parseHeaderFields(ByteBuffer &buf, size_t begin, size_t end);
+    Status parseChunkSize(ByteBuffer &buf, size_t begin, size_t end);
+
+private:
+    HttpLimits mLimits;
+    HttpRequest mRequest;
+    State mState = ST_HEAD;
+    int mError = 0;
+    size_t mScan = 0;       // where the next scan resumes
+    size_t mBodyWrite = 0;  // end of the decoded chunked body so far
+    size_t mChunkLeft = 0;  // bytes of the current chunk still to come
+};
+
+// HttpField - Header field of a response, pointing into the parsed head
+struct HttpField {
+    const char *name;
+    size_t nameLength;
+    const char *value;      // without the whitespace around it
+    size_t valueLength;
+};
+
+// HttpResponseHead - Status line and header fields of a response
+// Filled by parseResponseHead(), the pointers are into the bytes parsed.
+// The framing follows RFC 9112 section 6.3: a Transfer-Encoding overrides
+// any Content-Length, which is then dropped along with keepAlive, as the
+// response may be an attempt at response splitting.
+struct HttpResponseHead {
+    int versionMinor = 1;
+    int status = 0;
+    const char *reason = nullptr;
+    size_t reasonLength = 0;
+    std::vector<HttpField> fields;
+    bool transferEncoded = false;
+    bool chunked = false;           // the final transfer coding is chunked
+    bool hasLength = false;         // the body is contentLength bytes
+    uint64_t contentLength = 0;
+    bool keepAlive = true;
+};
+
+extern const Byte CRLF[2];
+extern const Byte CRLFCRLF[4];
+
+bool isOws(char c);
+bool tokenEquals(const char *p, size_t len, const char *token);
+bool hasToken(const char *list, size_t length, const char *token);
+bool isIdempotent(const char *method, size_t length);
+bool parseChunkSize(const char *line, size_t length, uint64_t &size);
+int parseResponseHead(const char *head, size_t length, HttpResponseHead &resp);
+
+// IMF-fixdate of RFC 9110, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+#define HTTP_DATE_SIZE 30
+
+size_t formatHttpDate(time_t t, char *buf, size_t size);
+time_t parseHttpDate(const char *str, size_t length);
+bool etagListMatches(const char *list, size_t length, const char *etag);
+bool acceptsEncoding(const char *list, size_t length, const char *coding);
+
+} // namespace http
+} // namespace pardus
+
+
+#endif //PD_HTTP_H
@@ -0,0 +1,635 @@
+#include "pd_http_client.h"
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <strings.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "pd_bytescan.h"
+#include "pd_http.h"
+
+namespace pardus {
+namespace http {
+
+namespace {
+
+// Longest response head accepted, status line and headers
+const size_t MAX_HEAD_BYTES = 64 << 10;
+
+// Bytes asked from recv() at a time
+const size_t READ_CHUNK = 16 << 10;
+
+// Append req to out the way it goes on the wire
+void serialize(const ClientRequest &req, const std::string &host, int port, std::string &out) {
+    bool hasHost = false, hasLength = false;
+    for (const auto &h : req.headers) {
+        hasHost = hasHost || strcasecmp(h.first.c_str(), "Host") == 0;
+        hasLength = hasLength || strcasecmp(h.first.c_str(), "Content-Length") == 0
+                    || strcasecmp(h.first.c_str(), "Transfer-Encoding") == 0;
+    }
+    out += req.method;
+    out += ' ';
+    out += req.target;
+    out += " HTTP/1.1\r\n";
+    if (!hasHost && !host.empty() && host[0] == '/') {
+        // A Unix domain socket path is no authority
+        out += "Host: localhost\r\n";
+    } else if (!hasHost) {
+        bool v6 = host.find(':') != std::string::npos;
+        out += "Host: ";
+        out += v6 ? "[" + host + "]" : host;
+        if (port != 80)
+            out += ":" + std::to_string(port);
+        out += "\r\n";
+    }
+    for (const auto &h : req.headers) {
+        out += h.first;
+        out += ": ";
+        out += h.second;
+        out += "\r\n";
+    }
+    if (!hasLength && (!req.body.empty() || req.method == "POST" || req.method == "PUT"
+                       || req.method == "PATCH"))
+        out += "Content-Length: " + std::to_string(req.body.size()) + "\r\n";
+    out += "\r\n";
+    out += req.body;
+}
+
+// ResponseReader - Responses read off a blocking connection, in order
+// Bytes past a response are kept for the next one, as pipelined responses
+// arrive back to back.
+class ResponseReader {
+public:
+    ResponseReader(SocketChannel &chan, size_t maxBytes) : mChan(chan), mMaxBytes(maxBytes) {}
+
+    int read(bool headRequest, ClientResponse &resp);
+    int fill();
+
+    bool isClean() { return mPos == mBuf.size() && !mEof; }
+
+private:
+    const Byte *begin() { return mBuf.data() + mPos; }
+    const Byte *end() { return mBuf.data() + mBuf.size(); }
+    int fillOrFail();
+    int readHead(ClientResponse &resp, HttpResponseHead &head);
+    int readChunked(std::string &body);
+
+    SocketChannel &mChan;
+    size_t mMaxBytes;
+    std::string mBuf;
+    size_t mPos = 0;        // start of what is not consumed yet
+    bool mEof = false;
+};
+
+// Receive what is available, blocking until something is
+//    Return 1 when bytes were added, 0 at end of stream
+//    On error, return -1 and sets errno
+int ResponseReader::fill() {
+    if (mPos > 0 && mPos >= mBuf.size() / 2) {
+        mBuf.erase(0, mPos);
+        mPos = 0;
+    }
+    size_t old = mBuf.size();
+    mBuf.resize(old + READ_CHUNK);
+    ssize_t n;
+    while ((n = ::recv(mChan.getFd(), &mBuf[old], READ_CHUNK, 0)) < 0 && errno == EINTR) {}
+    mBuf.resize(old + std::max<ssize_t>(n, 0));
+    if (n < 0)
+        return -1;
+    if (n == 0) {
+        mEof = true;
+        return 0;
+    }
+    return 1;
+}
+
+// fill(), an early end of stream being an error
+int ResponseReader::fillOrFail() {
+    int rc = fill();
+    if (rc == 0)
+        errno = ECONNRESET;
+    if (rc > 0 && mBuf.size() - mPos > mMaxBytes + MAX_HEAD_BYTES) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    return rc > 0 ? 0 : -1;
+}
+
+// Status line and headers of resp, head tells how the body is framed
+//    Return 0 when read, -1 with errno set otherwise, EPROTO if malformed
+int ResponseReader::readHead(ClientResponse &resp, HttpResponseHead &head) {
+    const Byte *eoh;
+    size_t scanned = 0;     // past mPos, fill() may move the bytes
+    while ((eoh = nio::bytescan::find(begin() + scanned, end(), CRLFCRLF, 4)) == nullptr) {
+        size_t have = mBuf.size() - mPos;
+        if (have > MAX_HEAD_BYTES) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        scanned = have >= 3 ? have - 3 : 0;
+        if (fillOrFail() < 0)
+            return -1;
+    }
+
+    if (parseResponseHead(begin(), eoh + 4 - begin(), head) < 0)
+        return -1;
+    resp.versionMinor = head.versionMinor;
+    resp.status = head.status;
+    resp.keepAlive = head.keepAlive;
+    resp.headers.clear();
+    resp.body.clear();
+    for (const HttpField &f : head.fields)
+        resp.headers.emplace_back(std::string(f.name, f.nameLength), std::string(f.value, f.valueLength));
+    mPos = eoh + 4 - mBuf.data();
+    return 0;
+}
+
+// Decode a chunked body into body, trailers are skipped
+//    Return 0 when read, -1 with errno set otherwise
+int ResponseReader::readChunked(std::string &body) {
+    for (;;) {
+        const Byte *eol;
+        while ((eol = nio::bytescan::find(begin(), end(), CRLF, 2)) == nullptr)
+            if (fillOrFail() < 0)
+                return -1;
+        uint64_t size;
+        if (!parseChunkSize(begin(), eol - begin(), size) || size > mMaxBytes) {
+            errno = EPROTO;
+            return -1;
+        }
+        mPos = eol + 2 - mBuf.data();
+        if (size == 0)
+            break;
+        while (mBuf.size() - mPos < size + 2)
+            if (fillOrFail() < 0)
+                return -1;
+        if (body.size() + size > mMaxBytes) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        body.append(begin(), size);
+        if (std::memcmp(begin() + size, CRLF, 2) != 0) {
+            errno = EPROTO;
+            return -1;
+        }
+        mPos += size + 2;
+    }
+    // Trailer fields up to an empty line
+    for (;;) {
+        const Byte *eol;
+        while ((eol = nio::bytescan::find(begin(), end(), CRLF, 2)) == nullptr)
+            if (fillOrFail() < 0)
+                return -1;
+        bool last = eol == begin();
+        mPos = eol + 2 - mBuf.data();
+        if (last)
+            return 0;
+    }
+}
+
+// Read the next response, the answer to a HEAD request if headRequest
+// Interim 1xx responses are skipped.
+//    Return 0 on success
+//    On error, return -1 and sets errno
+int ResponseReader::read(bool headRequest, ClientResponse &resp) {
+    HttpResponseHead head;
+    do {
+        if (readHead(resp, head) < 0)
+            return -1;
+    } while (resp.status / 100 == 1 && resp.status != 101);
+
+    if (headRequest || resp.status / 100 == 1 || resp.status == 204 || resp.status == 304)
+        return 0;
+    if (head.chunked)
+        return readChunked(resp.body);
+    if (!head.hasLength) {
+        // Delimited by the end of the connection
+        resp.keepAlive = false;
+        int rc;
+        while ((rc = fill()) > 0)
+            if (mBuf.size() - mPos > mMaxBytes) {
+                errno = EMSGSIZE;
+                return -1;
+            }
+        if (rc < 0)
+            return -1;
+        resp.body.assign(begin(), end());
+        mPos = mBuf.size();
+        return 0;
+    }
+    uint64_t length = head.contentLength;
+    if (length > mMaxBytes) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    while (mBuf.size() - mPos < length)
+        if (fillOrFail() < 0)
+            return -1;
+    resp.body.assign(begin(), length);
+    mPos += length;
+    return 0;
+}
+
+} // namespace
+
+
+/***************************
+* AddressCache implementation
+**************************/
+AddressCache::AddressCache(int ttlMs, int negativeTtlMs)
+        : mTtlMs(ttlMs), mNegativeTtlMs(negativeTtlMs) {
+}
+
+// Addresses of host at port, from the cache while fresh
+//    Return 0 on success
+//    On error, return a getaddrinfo() error code, see gai_strerror()
+int AddressCache::resolve(const std::string &host, int port, std::vector<SocketAddress> &addrs) {
+    std::string key = host + ":" + std::to_string(port);
+    Clock::time_point now = Clock::now();
+    {
+        std::lock_guard<std::mutex> lck(mMutex);
+        mStats.lookups++;
+        auto it = mEntries.find(key);
+        if (it != mEntries.end() && it->second.expires > now) {
+            mStats.hits++;
+            addrs = it->second.addrs;
+            return it->second.error;
+        }
+    }
+
+    // Not under the lock, a slow lookup must not hold up the others
+    int error = SocketAddress::resolve(host, port, addrs);
+    std::lock_guard<std::mutex> lck(mMutex);
+    int ttl = error == 0 ? mTtlMs : mNegativeTtlMs;
+    mEntries[key] = Entry{addrs, error, now + std::chrono::milliseconds(ttl)};
+    return error;
+}
+
+void AddressCache::clear() {
+    std::lock_guard<std::mutex> lck(mMutex);
+    mEntries.clear();
+}
+
+AddressCacheStats AddressCache::stats() {
+    std::lock_guard<std::mutex> lck(mMutex);
+    return mStats;
+}
+
+
+/***************************
+* ConnectionPool implementation
+**************************/
+// Use cache for the addresses, or one of its own if null
+ConnectionPool::ConnectionPool(const ClientConfig &config, AddressCache *cache)
+        : mConfig(config), mCache(cache ? *cache : mOwnCache) {
+}
+
+ConnectionPool::~ConnectionPool() {
+    clear();
+}
+
+const ClientConfig& ConnectionPool::config() {
+    return mConfig;
+}
+
+AddressCache& ConnectionPool::addresses() {
+    return mCache;
+}
+
+// An idle connection is healthy when there is nothing to read: no end of
+// stream, no reset and no bytes the server should not have sent
+bool ConnectionPool::isHealthy(SocketChannel &chan) {
+    pollfd pfd = {chan.getFd(), POLLIN | POLLRDHUP, 0};
+    return poll(&pfd, 1, 0) == 0;
+}
+
+// Connect chan to host at port, trying its addresses in turn
+// A host starting with / is the path of a Unix domain socket.
+//    Return 0 on success
+//    On error, return -1 and sets errno, EHOSTUNREACH if host does not resolve
+int ConnectionPool::connect(const std::string &host, int port, SocketChannel &chan) {
+    if (!host.empty() && host[0] == '/') {
+        SocketChannel attempt;
+        if (attempt.connect(host) < 0)
+            return -1;
+        if (mConfig.ioTimeoutMs > 0)
+            attempt.setSoTimeout(mConfig.ioTimeoutMs);
+        chan = std::move(attempt);
+        return 0;
+    }
+    std::vector<SocketAddress> addrs;
+    if (mCache.resolve(host, port, addrs) != 0) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    for (const SocketAddress &addr : addrs) {
+        SocketChannel attempt;
+        if (attempt.connect(addr, mConfig.connectTimeoutMs) < 0)
+            continue;
+        if (mConfig.ioTimeoutMs > 0)
+            attempt.setSoTimeout(mConfig.ioTimeoutMs);
+        chan = std::move(attempt);
+        return 0;
+    }
+    return -1;
+}
+
+// Lend out a connection to host at port, an idle one unless fresh
+//    Return 0 on success
+//    On error, return -1 and sets errno
+int ConnectionPool::acquire(const std::string &host, int port, PooledConnection &conn, bool fresh) {
+    conn.endpoint = host + ":" + std::to_string(port);
+    conn.reused = false;
+    conn.reusable = false;
+    conn.addrs.clear();
+    if (!fresh && takeIdle(conn)) {
+        if (!conn.chan.isBlocking()) {
+            conn.chan.configureBlocking(true);
+            if (mConfig.ioTimeoutMs > 0)
+                conn.chan.setSoTimeout(mConfig.ioTimeoutMs);
+        }
+        return 0;
+    }
+    int rc = connect(host, port, conn.chan);
+    countConnect(rc == 0);
+    return rc;
+}
+
+// Lend out a non-blocking connection to host at port, an idle one unless
+// fresh, without waiting for a new one to connect
+// Once the connection is writable, finishConnect() completes the connect.
+//    Return 0 when the connection is ready, 1 while it connects
+//    On error, return -1 and sets errno, EHOSTUNREACH if host does not resolve
+int ConnectionPool::open(const std::string &host, int port, PooledConnection &conn, bool fresh) {
+    conn.endpoint = host + ":" + std::to_string(port);
+    conn.reused = false;
+    conn.reusable = false;
+    conn.addrs.clear();
+    if (!fresh && takeIdle(conn)) {
+        if (conn.chan.isBlocking())
+            conn.chan.configureBlocking(false);
+        return 0;
+    }
+    if (!host.empty() && host[0] == '/') {
+        SocketChannel attempt;
+        int rc = attempt.startConnect(host);
+        if (rc >= 0)
+            conn.chan = std::move(attempt);
+        countConnect(rc >= 0);
+        return rc < 0 ? -1 : 0;
+    }
+    if (mCache.resolve(host, port, conn.addrs) != 0) {
+        countConnect(false);
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    std::reverse(conn.addrs.begin(), conn.addrs.end());
+    return connectNext(conn);
+}
+
+// Complete the connect of a connection lent out by open(), the next address
+// is tried if it failed
+//    Return 0 once connected, 1 while connecting
+//    On error, return -1 and sets errno
+int ConnectionPool::finishConnect(PooledConnection &conn) {
+    if (conn.chan.finishConnect() == 0) {
+        conn.addrs.clear();
+        countConnect(true);
+        return 0;
+    }
+    if (errno == EINPROGRESS)
+        return 1;
+    return connectNext(conn);
+}
+
+// Start connecting conn to the next address left
+//    Return 0 when connected at once, 1 while connecting
+//    On error, return -1 and sets errno once no address is left
+int ConnectionPool::connectNext(PooledConnection &conn) {
+    int err = errno;
+    while (!conn.addrs.empty()) {
+        SocketChannel attempt;
+        int rc = attempt.startConnect(conn.addrs.back());
+        conn.addrs.pop_back();
+        if (rc >= 0 || errno == EINPROGRESS) {
+            conn.chan = std::move(attempt);
+            if (rc < 0)
+                return 1;
+            conn.addrs.clear();
+            countConnect(true);
+            return 0;
+        }
+        err = errno;
+    }
+    countConnect(false);
+    errno = err;
+    return -1;
+}
+
+// Take the most recently used idle connection of conn.endpoint into conn
+//    Return false if there is none
+bool ConnectionPool::takeIdle(PooledConnection &conn) {
+    Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lck(mMutex);
+    auto it = mIdle.find(conn.endpoint);
+    while (it != mIdle.end() && !it->second.empty()) {
+        Idle &idle = it->second.back();
+        bool expired = now - idle.since > std::chrono::milliseconds(mConfig.idleTimeoutMs);
+        if (!expired && isHealthy(idle.chan)) {
+            conn.chan = std::move(idle.chan);
+            conn.reused = true;
+            it->second.pop_back();
+            mStats.reuses++;
+            return true;
+        }
+        it->second.pop_back();
+        mStats.evictions++;
+    }
+    return false;
+}
+
+void ConnectionPool::countConnect(bool ok) {
+    std::lock_guard<std::mutex> lck(mMutex);
+    if (ok)
+        mStats.connects++;
+    else
+        mStats.connectFailures++;
+}
+
+// Take conn back, keeping it for reuse if the borrower marked it reusable
+// The oldest idle connection of the endpoint is closed when it has
+// maxIdlePerEndpoint already.
+void ConnectionPool::release(PooledConnection &conn) {
+    if (!conn.reusable || mConfig.maxIdlePerEndpoint == 0 || !conn.chan.isOpen()) {
+        conn.chan.close();
+        return;
+    }
+    std::lock_guard<std::mutex> lck(mMutex);
+    std::vector<Idle> &idle = mIdle[conn.endpoint];
+    if (idle.size() >= mConfig.maxIdlePerEndpoint)
+        idle.erase(idle.begin());
+    idle.push_back(Idle{std::move(conn.chan), Clock::now()});
+    conn.reusable = false;
+}
+
+// Close idle connections that expired or were closed by their server
+// Eviction happens on acquire() anyway, call this to not hold on to the
+// descriptors of endpoints no longer used.
+//    Return number of connections closed
+size_t ConnectionPool::evictIdle() {
+    Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lck(mMutex);
+    size_t n = 0;
+    for (auto it = mIdle.begin(); it != mIdle.end();) {
+        std::vector<Idle> &idle = it->second;
+        auto dead = std::remove_if(idle.begin(), idle.end(), [&](Idle &i) {
+            return now - i.since > std::chrono::milliseconds(mConfig.idleTimeoutMs)
+                   || !isHealthy(i.chan);
+        });
+        n += idle.end() - dead;
+        idle.erase(dead, idle.end());
+        it = idle.empty() ? mIdle.erase(it) : std::next(it);
+    }
+    mStats.evictions += n;
+    return n;
+}
+
+// Close every idle connection
+void ConnectionPool::clear() {
+    std::lock_guard<std::mutex> lck(mMutex);
+    mIdle.clear();
+}
+
+ConnectionPoolStats ConnectionPool::stats() {
+    std::lock_guard<std::mutex> lck(mMutex);
+    ConnectionPoolStats s = mStats;
+    s.idle = 0;
+    for (const auto &e : mIdle)
+        s.idle += e.second.size();
+    return s;
+}
+
+
+/***************************
+* HttpClient implementation
+**************************/
+// Value of header name, case insensitive, nullptr if absent
+const std::string *ClientResponse::header(const char *name) const {
+    for (const auto &h : headers)
+        if (strcasecmp(h.first.c_str(), name) == 0)
+            return &h.second;
+    return nullptr;
+}
+
+HttpClient::HttpClient(ConnectionPool &pool) : mPool(pool) {
+}
+
+// Send reqs[0, n) on conn and read their responses into resps
+// Writing polls for responses too: a server answering a long batch while
+// it is still being sent must not fill up the socket buffers both ways.
+// If the server closes meanwhile, what it answered before is still read.
+//    Return 0 on success, conn.reusable tells whether it can be kept
+//    On error, return -1 and sets errno; received responses were read
+int HttpClient::exchange(PooledConnection &conn, const std::string &host, int port,
+                         const ClientRequest *reqs, size_t n, ClientResponse *resps,
+                         size_t &received) {
+    received = 0;
+    conn.reusable = false;
+    std::string out;
+    for (size_t i = 0; i < n; i++)
+        serialize(reqs[i], host, port, out);
+
+    int fd = conn.chan.getFd();
+    int timeout = mPool.config().ioTimeoutMs > 0 ? mPool.config().ioTimeoutMs : -1;
+    ResponseReader reader(conn.chan, mPool.config().maxResponseBytes);
+    size_t off = 0;
+    while (off < out.size()) {
+        pollfd pfd = {fd, POLLIN | POLLOUT, 0};
+        int ready = poll(&pfd, 1, timeout);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready <= 0) {
+            if (ready == 0)
+                errno = ETIMEDOUT;
+            return -1;
+        }
+        if (pfd.revents & POLLIN) {
+            int rc = reader.fill();
+            if (rc < 0)
+                return -1;
+            if (rc == 0)
+                break;
+        }
+        if (pfd.revents & (POLLOUT | POLLERR | POLLHUP)) {
+            ssize_t w = ::send(fd, out.data() + off, out.size() - off, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (w < 0 && (errno == EPIPE || errno == ECONNRESET))
+                break;
+            if (w < 0 && errno != EAGAIN && errno != EINTR)
+                return -1;
+            off += std::max<ssize_t>(w, 0);
+        }
+    }
+
+    for (; received < n; received++) {
+        if (reader.read(reqs[received].method == "HEAD", resps[received]) < 0)
+            return -1;
+    }
+    bool keepAlive = true;
+    for (size_t i = 0; i < n; i++)
+        keepAlive = keepAlive && resps[i].keepAlive;
+    conn.reusable = keepAlive && off == out.size() && reader.isClean();
+    return 0;
+}
+
+// Pipeline reqs[0, n) on one connection to host at port, responses in resps
+// A stale pooled connection is replaced once, if every request is
+// idempotent; others are never sent twice.
+//    Return number of responses read, n unless an error stopped it, then
+//    errno is set
+int HttpClient::pipeline(const std::string &host, int port, const ClientRequest *reqs, size_t n,
+                         ClientResponse *resps) {
+    bool replayable = true;
+    for (size_t i = 0; i < n; i++)
+        replayable = replayable && isIdempotent(reqs[i].method.data(), reqs[i].method.size());
+
+    PooledConnection conn;
+    if (mPool.acquire(host, port, conn) < 0)
+        return 0;
+    size_t received;
+    int rc = exchange(conn, host, port, reqs, n, resps, received);
+    if (rc < 0 && conn.reused && received == 0 && replayable
+        && (errno == ECONNRESET || errno == EPIPE)) {
+        mPool.release(conn);
+        if (mPool.acquire(host, port, conn, true) < 0)
+            return 0;
+        rc = exchange(conn, host, port, reqs, n, resps, received);
+    }
+    int err = errno;
+    mPool.release(conn);
+    errno = err;
+    return static_cast<int>(received);
+}
+
+// Send req to host at port, its response in resp
+//    Return 0 on success
+//    On error, return -1 and sets errno
+int HttpClient::execute(const std::string &host, int port, const ClientRequest &req,
+                        ClientResponse &resp) {
+    return pipeline(host, port, &req, 1, &resp) == 1 ? 0 : -1;
+}
+
+// GET target from host at port
+//    Return 0 on success
+//    On error, return -1 and sets errno
+int HttpClient::get(const std::string &host, int port, const std::string &target,
+                    ClientResponse &resp) {
+    ClientRequest req;
+    req.target = target;
+    return execute(host, port, req, resp);
+}
+
+} // namespace http
+} // namespace pardus
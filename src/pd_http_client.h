@@ -0,0 +1,187 @@
+#ifndef PD_HTTP_CLIENT_H
+#define PD_HTTP_CLIENT_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "pd_net.h"
+
+#define CLIENT_CONNECT_TIMEOUT_MS 1000
+#define CLIENT_IO_TIMEOUT_MS 5000
+#define CLIENT_MAX_IDLE_PER_ENDPOINT 32
+// Below the idle timeout of pardus itself, so that the pool lets go of a
+// connection before the server does
+#define CLIENT_IDLE_TIMEOUT_MS 4000
+// getaddrinfo() gives no TTL, names are kept this long; failures briefly
+#define CLIENT_DNS_TTL_MS 30000
+#define CLIENT_DNS_NEGATIVE_TTL_MS 1000
+#define CLIENT_MAX_RESPONSE_BYTES (16 << 20)
+
+namespace pardus {
+namespace http {
+
+using nio::SocketAddress;
+using nio::SocketChannel;
+
+typedef std::vector<std::pair<std::string, std::string>> HeaderList;
+
+struct AddressCacheStats {
+    uint64_t lookups = 0;
+    uint64_t hits = 0;
+};
+
+// AddressCache - Addresses of host names, resolved once per TTL
+// Lookups of different names run in parallel, the cache is only locked to
+// find or store an entry. Concurrent misses of one name may each resolve it.
+class AddressCache {
+public:
+    explicit AddressCache(int ttlMs = CLIENT_DNS_TTL_MS, int negativeTtlMs = CLIENT_DNS_NEGATIVE_TTL_MS);
+    AddressCache(const AddressCache &) = delete;
+    AddressCache& operator=(const AddressCache &) = delete;
+
+    int resolve(const std::string &host, int port, std::vector<SocketAddress> &addrs);
+    void clear();
+    AddressCacheStats stats();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry {
+        std::vector<SocketAddress> addrs;
+        int error;
+        Clock::time_point expires;
+    };
+
+    std::mutex mMutex;
+    std::unordered_map<std::string, Entry> mEntries;
+    int mTtlMs;
+    int mNegativeTtlMs;
+    AddressCacheStats mStats;
+};
+
+// ClientConfig - Settings of a ConnectionPool and the HttpClients using it
+struct ClientConfig {
+    int connectTimeoutMs = CLIENT_CONNECT_TIMEOUT_MS;     // per address tried
+    int ioTimeoutMs = CLIENT_IO_TIMEOUT_MS;               // a read or write making no progress
+    size_t maxIdlePerEndpoint = CLIENT_MAX_IDLE_PER_ENDPOINT;   // 0 disables reuse
+    int idleTimeoutMs = CLIENT_IDLE_TIMEOUT_MS;           // idle connections older are closed
+    size_t maxResponseBytes = CLIENT_MAX_RESPONSE_BYTES;
+};
+
+// PooledConnection - Connection lent out by a ConnectionPool
+struct PooledConnection {
+    SocketChannel chan;
+    std::string endpoint;   // host:port it was acquired for
+    std::vector<SocketAddress> addrs;   // left to try should the connect of open() fail, last first
+    bool reused = false;    // was idle in the pool, may have been closed meanwhile
+    bool reusable = false;  // set by the borrower when it can take more requests
+};
+
+struct ConnectionPoolStats {
+    uint64_t connects = 0;
+    uint64_t connectFailures = 0;
+    uint64_t reuses = 0;
+    uint64_t evictions = 0;     // idle connections found dead or expired
+    size_t idle = 0;
+};
+
+// ConnectionPool - Keep-alive connections per endpoint, shared by threads
+// Idle connections are taken most recently used first, being the least
+// likely to have been closed by the server. Before one is lent out it is
+// polled: readable means the server closed it or sent something unasked,
+// and it is evicted, as are those idle longer than idleTimeoutMs. New
+// connections are made to the addresses of the AddressCache in turn, each
+// given connectTimeoutMs. Hosts starting with / are Unix domain sockets.
+// acquire() lends out blocking connections and waits for them to connect;
+// open() lends out non-blocking ones for event loops, whose connect goes on
+// until finishConnect() completes it, the caller timing it.
+class ConnectionPool {
+public:
+    explicit ConnectionPool(const ClientConfig &config = ClientConfig(),
+                            AddressCache *cache = nullptr);
+    ConnectionPool(const ConnectionPool &) = delete;
+    ConnectionPool& operator=(const ConnectionPool &) = delete;
+    ~ConnectionPool();
+
+    int acquire(const std::string &host, int port, PooledConnection &conn, bool fresh = false);
+    int open(const std::string &host, int port, PooledConnection &conn, bool fresh = false);
+    int finishConnect(PooledConnection &conn);
+    void release(PooledConnection &conn);
+    size_t evictIdle();
+    void clear();
+
+    const ClientConfig &config();
+    AddressCache &addresses();
+    ConnectionPoolStats stats();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Idle {
+        SocketChannel chan;
+        Clock::time_point since;
+    };
+
+    int connect(const std::string &host, int port, SocketChannel &chan);
+    int connectNext(PooledConnection &conn);
+    bool takeIdle(PooledConnection &conn);
+    void countConnect(bool ok);
+    static bool isHealthy(SocketChannel &chan);
+
+    ClientConfig mConfig;
+    AddressCache mOwnCache;
+    AddressCache &mCache;
+    std::mutex mMutex;
+    std::unordered_map<std::string, std::vector<Idle>> mIdle;   // oldest first
+    ConnectionPoolStats mStats;
+};
+
+struct ClientRequest {
+    std::string method = "GET";
+    std::string target = "/";
+    HeaderList headers;     // Host and Content-Length are added when missing
+    std::string body;
+};
+
+struct ClientResponse {
+    int status = 0;
+    int versionMinor = 1;
+    HeaderList headers;
+    std::string body;       // chunked bodies are decoded
+    bool keepAlive = true;
+
+    const std::string *header(const char *name) const;
+};
+
+// HttpClient - HTTP/1.1 requests over the connections of a ConnectionPool
+// A batch of requests is pipelined: written out at once on one connection,
+// the responses read back in order. A reused connection that fails before
+// any response byte arrives was most likely closed by the server while
+// idle, the batch is then sent once more on a new connection. Safe to use
+// from several threads.
+class HttpClient {
+public:
+    explicit HttpClient(ConnectionPool &pool);
+
+    int execute(const std::string &host, int port, const ClientRequest &req, ClientResponse &resp);
+    int pipeline(const std::string &host, int port, const ClientRequest *reqs, size_t n,
+                 ClientResponse *resps);
+    int get(const std::string &host, int port, const std::string &target, ClientResponse &resp);
+
+private:
+    int exchange(PooledConnection &conn, const std::string &host, int port,
+                 const ClientRequest *reqs, size_t n, ClientResponse *resps, size_t &received);
+
+    ConnectionPool &mPool;
+};
+
+} // namespace http
+} // namespace pardus
+
+
+#endif //PD_HTTP_CLIENT_H
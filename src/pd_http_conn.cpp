@@ -0,0 +1,665 @@
+#include "pd_http_conn.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <poll.h>
+#include <unistd.h>
+
+#include "pd_metrics.h"
+#include "pd_log.h"
+
+namespace pardus {
+namespace http {
+
+using metrics::Metrics;
+
+namespace {
+
+const char HELLO[] = "Hello from server";
+
+// Room kept in the output buffer for a status line and headers
+const size_t RESPONSE_RESERVE = 256;
+
+} // namespace
+
+const char *statusReason(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 408: return "Request Timeout";
+    case 413: return "Content Too Large";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    case 504: return "Gateway Timeout";
+    case 505: return "HTTP Version Not Supported";
+    default: return "Unknown";
+    }
+}
+
+
+/******************************
+* HttpConnection implementation
+******************************/
+HttpConnection::HttpConnection(SocketChannel chan, const HttpServerConfig &config)
+        : mChan(std::move(chan)), mConfig(config), mParser(config.limits),
+          mOpened(std::chrono::steady_clock::now()) {
+    Metrics::count(metrics::CONNECTIONS_OPENED);
+}
+
+HttpConnection::~HttpConnection() {
+    closeFile();
+    Metrics::count(metrics::CONNECTIONS_CLOSED);
+}
+
+SocketChannel& HttpConnection::channel() {
+    return mChan;
+}
+
+// Number of requests answered so far
+size_t HttpConnection::requestCount() {
+    return mRequests;
+}
+
+// Whether part of a request head has arrived, as opposed to the connection
+// being idle between requests or receiving a body
+bool HttpConnection::readingHead() {
+    return mParser.inHead() && mIn.pos() > mParser.request().begin;
+}
+
+void HttpConnection::close() {
+    closeFile();
+    mAsset.reset();
+    mBody.clear();
+    if (mProxy)
+        mProxy->abort();
+    if (mChan.isOpen()) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        mChan.close();
+        Metrics::record(metrics::STAGE_CLOSE, std::chrono::steady_clock::now() - start);
+    }
+}
+
+void HttpConnection::closeFile() {
+    if (mFile >= 0) {
+        ::close(mFile);
+        mFile = -1;
+        mFileLeft = 0;
+    }
+}
+
+// Serve a blocking channel until the client closes, an error occurs, it
+// stays idle for idleTimeoutMs, takes longer than headerTimeoutMs to send
+// a request head or stops taking data for writeTimeoutMs
+void HttpConnection::serve() {
+    if (mConfig.idleTimeoutMs > 0)
+        mChan.setSoTimeout(mConfig.idleTimeoutMs);
+    if (mConfig.writeTimeoutMs > 0)
+        mChan.setSendTimeout(mConfig.writeTimeoutMs);
+    onReadable();
+    close();
+}
+
+// Answer every complete request in mIn, appending responses to mOut
+// Stops after a response with a file or proxied body, which has to go out
+// first.
+//    Return true when it stopped early, call again after flush
+bool HttpConnection::process() {
+    typedef std::chrono::steady_clock Clock;
+    if (!mFirstByte && mIn.pos() > 0) {
+        mFirstByte = true;
+        Metrics::record(metrics::STAGE_FIRST_BYTE, Clock::now() - mOpened);
+    }
+    while (!mClose && mFile < 0 && !mAsset && !proxying()) {
+        Clock::time_point start = Clock::now();
+        HttpRequestParser::Status st = mParser.parse(mIn);
+        Clock::time_point parsed = Clock::now();
+        HttpRequest &req = mParser.request();
+        mParseTime += parsed - start;
+
+        if (st == HttpRequestParser::PARSE_INCOMPLETE) {
+            if (req.begin == mIn.pos()) {
+                // Everything consumed, start over at the front
+                mIn.clear();
+                mParser.reset(0);
+                mParseTime = Clock::duration::zero();
+            } else if (!mIn.hasRemaining()) {
+                // Make room: drop the requests before this one, or move
+                // the body received so far to mBody. The head stays at the
+                // front; the buffer grows so that reads of the body are not
+                // squeezed after a large one. A body over maxBodyBytes
+                // fails parsing, only a head too large is left here.
+                if (req.begin > 0) {
+                    mParser.compact(mIn);
+                } else if (!mParser.inHead()) {
+                    mParser.spill(mIn, mBody);
+                    if (mIn.remaining() < BUFFSIZE / 2)
+                        growInput(mIn.pos() + BUFFSIZE);
+                } else if (!respond(431, "text/plain", nullptr, 0, false)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // A request is counted once answered: one that finds mOut full is
+        // parsed again after flush
+        if (st == HttpRequestParser::PARSE_ERROR) {
+            mBody.clear();
+            if (!respond(mParser.error(), "text/plain", nullptr, 0, false))
+                return true;
+            Metrics::record(metrics::STAGE_PARSE, mParseTime);
+            mParseTime = Clock::duration::zero();
+            Metrics::count(metrics::REQUESTS);
+            logAccess(req.method, req.target, req.version);
+            return false;
+        }
+
+        // A spilled body is completed in mBody, handlers find it whole there
+        if (req.bodySpilled > 0 && req.body.length > 0) {
+            mBody.append(req.body.data(mIn), req.body.length);
+            req.body.length = 0;
+        }
+        size_t max = mConfig.maxRequestsPerConnection;
+        bool keepAlive = req.keepAlive && (max == 0 || mRequests + 1 < max);
+        if (!handle(req, keepAlive))
+            return true;
+        Metrics::record(metrics::STAGE_PARSE, mParseTime);
+        mParseTime = Clock::duration::zero();
+        Metrics::count(metrics::REQUESTS);
+        mBody.clear();
+        Metrics::record(metrics::STAGE_HANDLER, Clock::now() - parsed);
+        if (!proxying())
+            logAccess(req.method, req.target, req.version);
+        mRequests++;
+        mParser.reset(req.end);
+    }
+    return mFile >= 0 || mAsset || proxying();
+}
+
+// Make mIn hold capacity bytes, keeping those received
+void HttpConnection::growInput(size_t capacity) {
+    nio::ByteBuffer grown(capacity);
+    grown.clear();
+    grown.put(mIn.array(), 0, mIn.pos());
+    mIn = std::move(grown);
+}
+
+// Produce the response of req
+//    Return false when mOut has no room left for it
+bool HttpConnection::handle(HttpRequest &req, bool keepAlive) {
+    bool head = req.method.equals(mIn, "HEAD");
+    if (mConfig.metrics && req.target.equals(mIn, "/metrics")) {
+        if (!head && !req.method.equals(mIn, "GET"))
+            return respond(405, "text/plain", nullptr, 0, keepAlive);
+        return handleMetrics(keepAlive, head);
+    }
+    if (mConfig.proxy)
+        return handleProxy(req, keepAlive);
+    if (mConfig.staticFiles) {
+        if (!head && !req.method.equals(mIn, "GET"))
+            return respond(405, "text/plain", nullptr, 0, keepAlive);
+        return handleStatic(req, keepAlive, head);
+    }
+    if (!head && !req.method.equals(mIn, "GET") && !req.method.equals(mIn, "POST"))
+        return respond(405, "text/plain", nullptr, 0, keepAlive);
+    return respond(200, "text/plain", HELLO, sizeof(HELLO) - 1, keepAlive, head);
+}
+
+// Answer with the Metrics in the Prometheus text format
+//    Return false when mOut has no room left for them
+bool HttpConnection::handleMetrics(bool keepAlive, bool headOnly) {
+    std::string body = Metrics::render();
+    return respond(200, "text/plain; version=0.0.4; charset=utf-8", body.data(), body.size(),
+                   keepAlive, headOnly);
+}
+
+// Answer req with a file under the document root
+// Only the headers go to mOut; the file is kept open in mFile and its
+// body is sent by flush().
+//    Return false when mOut has no room left for the headers
+bool HttpConnection::handleStatic(HttpRequest &req, bool keepAlive, bool headOnly) {
+    StaticFile file;
+    int status = mConfig.staticFiles->open(mIn, req.target, file);
+    if (status != 0)
+        return respond(status, "text/plain", nullptr, 0, keepAlive, headOnly);
+
+    if (file.asset) {
+        const HttpHeader *ae = file.asset->hasGzip ? req.header(mIn, "Accept-Encoding") : nullptr;
+        const AssetVariant &variant = file.asset->select(
+                ae && acceptsEncoding(ae->value.data(mIn), ae->value.length, "gzip"));
+        const HttpHeader *inm = req.header(mIn, "If-None-Match");
+        const HttpHeader *ims = req.header(mIn, "If-Modified-Since");
+        bool notModified = file.asset->isNotModified(variant,
+                inm ? inm->value.data(mIn) : nullptr, inm ? inm->value.length : 0,
+                ims ? ims->value.data(mIn) : nullptr, ims ? ims->value.length : 0);
+        const std::string &head = notModified ? variant.notModified[keepAlive]
+                                              : variant.ok[keepAlive];
+        mAssetIov[0].iov_base = const_cast<char*>(head.data());
+        mAssetIov[0].iov_len = head.size();
+        mAssetIov[1].iov_base = const_cast<char*>(variant.body.data());
+        mAssetIov[1].iov_len = notModified || headOnly ? 0 : variant.body.size();
+        mAsset = std::move(file.asset);
+        if (!keepAlive)
+            mClose = true;
+        Metrics::countResponse(notModified ? 304 : 200);
+        mLastStatus = notModified ? 304 : 200;
+        mLastLength = mAssetIov[1].iov_len;
+        return true;
+    }
+    if (!respond(200, file.contentType, "", file.size, keepAlive, true))
+        return false;
+    mLastLength = headOnly ? 0 : file.size;
+    if (!headOnly && file.size > 0) {
+        mFile = file.release();
+        mFileOffset = 0;
+        mFileLeft = file.size;
+    }
+    return true;
+}
+
+// Forward req to an upstream of the ReverseProxy
+// Nothing is sent here; mProxy takes the request on after mOut, see
+// flushProxy(), which logs it once the response head is known.
+//    Return true
+bool HttpConnection::handleProxy(HttpRequest &req, bool keepAlive) {
+    if (!mProxy)
+        mProxy.reset(new ProxyRelay(*mConfig.proxy));
+    mProxy->start(mIn, req, mBody, keepAlive, mChan.getRemoteAddr());
+    mProxyMethod = req.method;
+    mProxyTarget = req.target;
+    mProxyVersion = req.version;
+    return true;
+}
+
+// Whether a proxied response is left to send
+bool HttpConnection::proxying() {
+    return mProxy && mProxy->isActive();
+}
+
+// Upstream connection the proxied request waits for, null if none
+SocketChannel* HttpConnection::upstream() {
+    return proxying() ? mProxy->upstream() : nullptr;
+}
+
+// Longest wait for upstream() to get ready
+int HttpConnection::upstreamTimeoutMs() {
+    return proxying() ? mProxy->timeoutMs() : 0;
+}
+
+// upstream() did not get ready in time, the next call fails the attempt
+void HttpConnection::expireUpstream() {
+    if (proxying())
+        mProxy->expire();
+}
+
+// Append a response to mOut, a null body sends the reason phrase
+//    Return false when mOut has no room left for it
+bool HttpConnection::respond(int status, const char *contentType, const char *body,
+                             size_t length, bool keepAlive, bool headOnly) {
+    const char *reason = statusReason(status);
+    if (body == nullptr) {
+        body = reason;
+        length = std::strlen(reason);
+    }
+    size_t bodyLength = headOnly ? 0 : length;
+    if (mOut.remaining() < RESPONSE_RESERVE + bodyLength) {
+        if (mOut.pos() > 0)
+            return false;
+        mOut.allocate(std::max(static_cast<size_t>(BUFFSIZE), RESPONSE_RESERVE + bodyLength));
+        mOut.clear();
+    }
+
+    int n = std::snprintf(mOut.array() + mOut.pos(), mOut.remaining(),
+                          "HTTP/1.1 %d %s\r\n"
+                          "Content-Type: %s\r\n"
+                          "Content-Length: %zu\r\n"
+                          "Connection: %s\r\n"
+                          "\r\n",
+                          status, reason, contentType, length,
+                          keepAlive ? "keep-alive" : "close");
+    mOut.pos(mOut.pos() + n);
+    mOut.put(const_cast<char*>(body), 0, bodyLength);
+    if (!keepAlive)
+        mClose = true;
+    Metrics::countResponse(status);
+    mLastStatus = status;
+    mLastLength = bodyLength;
+    return true;
+}
+
+// Log the last response, the one to the request line given by its parts,
+// in the Common Log Format
+// Connections adopted from io_uring have no remote address, it shows as -.
+void HttpConnection::logAccess(const Slice &method, const Slice &target, const Slice &version) {
+    if (!log::accessEnabled())
+        return;
+    log::Text m{method.data(mIn), method.length};
+    log::Text t{target.data(mIn), target.length};
+    log::Text v{version.data(mIn), version.length};
+    PD_LOG_ACCESS("%s - - [%s] \"%s %s %s\" %d %zu", mChan.getRemoteAddr(), log::ClfTime(),
+                  m, t, v, mLastStatus, mLastLength);
+}
+
+// Write out mOut, then the pending file body or proxied response if any
+//    Return WANT_WRITE if the socket buffer filled up first
+//    Return CLOSE on error or once the last response is sent
+//    Return WANT_READ otherwise
+HttpConnection::Action HttpConnection::flush() {
+    if (!mDraining && mOut.pos() > 0) {
+        mOut.flip();
+        mDraining = true;
+    }
+    if (!mWriting && (mDraining || mAsset || mFile >= 0 || proxying())) {
+        mWriting = true;
+        mWriteStart = std::chrono::steady_clock::now();
+    }
+    if (mAsset)
+        return flushAsset();
+    if (mDraining) {
+        while (mOut.hasRemaining()) {
+            ssize_t nwrite = mChan.write(mOut);
+            if (nwrite < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return WANT_WRITE;
+                return CLOSE;
+            }
+            Metrics::count(metrics::BYTES_SENT, nwrite);
+        }
+        mOut.clear();
+        mDraining = false;
+    }
+    if (mFile >= 0)
+        return flushFile();
+    if (proxying())
+        return flushProxy();
+    return written();
+}
+
+// All output is sent, time the write
+//    Return CLOSE after the last response, WANT_READ otherwise
+HttpConnection::Action HttpConnection::written() {
+    if (mWriting) {
+        mWriting = false;
+        Metrics::record(metrics::STAGE_WRITE, std::chrono::steady_clock::now() - mWriteStart);
+    }
+    return mClose ? CLOSE : WANT_READ;
+}
+
+// Write out mOut and the pending cached response with writev()
+HttpConnection::Action HttpConnection::flushAsset() {
+    for (;;) {
+        iovec iov[3];
+        int iovcnt = 0;
+        if (mDraining && mOut.hasRemaining()) {
+            iov[iovcnt].iov_base = mOut.array() + mOut.pos();
+            iov[iovcnt++].iov_len = mOut.remaining();
+        }
+        for (iovec &v : mAssetIov) {
+            if (v.iov_len > 0)
+                iov[iovcnt++] = v;
+        }
+        if (iovcnt == 0)
+            break;
+
+        ssize_t nwrite = mChan.write(iov, iovcnt);
+        if (nwrite < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return WANT_WRITE;
+            return CLOSE;
+        }
+        Metrics::count(metrics::BYTES_SENT, nwrite);
+        size_t left = nwrite;
+        if (mDraining) {
+            size_t k = std::min(left, mOut.remaining());
+            mOut.pos(mOut.pos() + k);
+            left -= k;
+        }
+        for (iovec &v : mAssetIov) {
+            size_t k = std::min(left, v.iov_len);
+            v.iov_base = static_cast<char*>(v.iov_base) + k;
+            v.iov_len -= k;
+            left -= k;
+        }
+    }
+    mOut.clear();
+    mDraining = false;
+    mAsset.reset();
+    return written();
+}
+
+// Send the rest of mFile with sendfile()
+HttpConnection::Action HttpConnection::flushFile() {
+    while (mFileLeft > 0) {
+        ssize_t nsent = mChan.transferFrom(mFile, mFileOffset, mFileLeft);
+        if (nsent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return WANT_WRITE;
+        if (nsent <= 0)
+            return CLOSE;   // error, or the file shrank under us
+        Metrics::count(metrics::BYTES_SENT, nsent);
+        mFileOffset += nsent;
+        mFileLeft -= nsent;
+    }
+    closeFile();
+    return written();
+}
+
+// Take the proxied request on with mProxy, as far as the sockets allow
+// A blocking channel waits for the upstream here, a non-blocking one
+// returns WANT_UPSTREAM_READ or WANT_UPSTREAM_WRITE. A request no upstream
+// took is answered with mProxy->status(), which is written out next.
+HttpConnection::Action HttpConnection::flushProxy() {
+    for (;;) {
+        size_t n;
+        ProxyRelay::Result result = mProxy->relay(mChan, n);
+        Metrics::count(metrics::BYTES_SENT, n);
+        switch (result) {
+        case ProxyRelay::HEAD:
+            if (mProxy->closesClient())
+                mClose = true;
+            Metrics::countResponse(mProxy->status());
+            mLastStatus = mProxy->status();
+            mLastLength = mProxy->contentLength();
+            logAccess(mProxyMethod, mProxyTarget, mProxyVersion);
+            continue;
+        case ProxyRelay::REJECTED:
+            respond(mProxy->status(), "text/plain", nullptr, 0, !mProxy->closesClient());
+            logAccess(mProxyMethod, mProxyTarget, mProxyVersion);
+            return flush();
+        case ProxyRelay::WANT_UPSTREAM_READ:
+        case ProxyRelay::WANT_UPSTREAM_WRITE: {
+            bool reading = result == ProxyRelay::WANT_UPSTREAM_READ;
+            if (!mChan.isBlocking())
+                return reading ? WANT_UPSTREAM_READ : WANT_UPSTREAM_WRITE;
+            pollfd pfd;
+            pfd.fd = mProxy->upstream()->getFd();
+            pfd.events = reading ? POLLIN : POLLOUT;
+            int rc;
+            while ((rc = ::poll(&pfd, 1, mProxy->timeoutMs())) < 0 && errno == EINTR) {}
+            if (rc <= 0)
+                mProxy->expire();
+            continue;
+        }
+        case ProxyRelay::WANT_WRITE:
+            return WANT_WRITE;
+        case ProxyRelay::FAILED:
+            return CLOSE;
+        case ProxyRelay::DONE:
+            break;
+        }
+        return written();
+    }
+}
+
+// Read and answer requests until the channel has no more data
+// On a non-blocking channel this drains the socket, as needed with
+// edge-triggered readiness.
+//    Return WANT_READ when waiting for more requests
+//    Return WANT_WRITE when waiting for the socket to accept more data
+//    Return CLOSE when the connection should be closed
+HttpConnection::Action HttpConnection::onReadable() {
+    for (;;) {
+        bool more = !mDraining && process();
+        Action action = flush();
+        if (action != WANT_READ)
+            return action;
+        if (more)
+            continue;
+
+        if (mChan.isBlocking() && headerExpired())
+            return CLOSE;
+        if (mIn.capacity() == 0) {
+            mIn.allocate(BUFFSIZE);
+            mIn.clear();
+        }
+        ssize_t nread = mChan.read(mIn);
+        if (nread > 0) {
+            Metrics::count(metrics::BYTES_RECEIVED, nread);
+            continue;
+        }
+        if (nread < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (mChan.isBlocking())
+                return CLOSE;   // idle timeout
+            // Idle between requests, hand the buffers back to the pool
+            if (mIn.pos() == 0) {
+                mIn.deallocate();
+                mOut.deallocate();
+            }
+            return WANT_READ;
+        }
+        return CLOSE;
+    }
+}
+
+// Take received bytes into mIn, for callers doing the reads themselves
+//    Return number of bytes taken, less than length once mIn is full
+size_t HttpConnection::receive(const char *data, size_t length) {
+    if (mIn.capacity() == 0) {
+        mIn.allocate(BUFFSIZE);
+        mIn.clear();
+    }
+    size_t n = std::min(length, mIn.remaining());
+    mIn.put(const_cast<char*>(data), 0, n);
+    Metrics::count(metrics::BYTES_RECEIVED, n);
+    return n;
+}
+
+// Answer the requests received so far, for callers doing the writes
+// themselves. Output is described by up to max iovecs (3 are enough), to be
+// sent in order and reported with sent(). A static file body is not part
+// of it: once the headers before it are sent, sent() sends it with
+// sendfile(), the channel has to be non-blocking. So does a proxied
+// response, with splice().
+//    Return number of iovecs, 0 if there is nothing to send
+int HttpConnection::pending(iovec *iov, int max) {
+    if (!mDraining && mFile < 0 && !mAsset && !proxying()) {
+        process();
+        if (mOut.pos() > 0) {
+            mOut.flip();
+            mDraining = true;
+        }
+        if (!mWriting && (mDraining || mAsset || mFile >= 0 || proxying())) {
+            mWriting = true;
+            mWriteStart = std::chrono::steady_clock::now();
+        }
+    }
+    int n = 0;
+    if (mDraining && mOut.hasRemaining() && n < max) {
+        iov[n].iov_base = mOut.array() + mOut.pos();
+        iov[n++].iov_len = mOut.remaining();
+    }
+    if (mAsset) {
+        for (const iovec &v : mAssetIov) {
+            if (v.iov_len > 0 && n < max)
+                iov[n++] = v;
+        }
+    }
+    if (n == 0 && mFile < 0 && !proxying() && mIn.pos() == 0) {
+        // Idle between requests, hand the buffers back to the pool
+        mIn.deallocate();
+        mOut.deallocate();
+    }
+    return n;
+}
+
+// Account for n bytes of pending() output having been sent
+//    Return WANT_WRITE while output is left, see pending()
+//    Return WANT_WRITE as well if a file body is left but the socket is full
+//    Return CLOSE on error or once the last response is sent
+//    Return WANT_READ otherwise, more requests may be pending() already
+HttpConnection::Action HttpConnection::sent(size_t n) {
+    Metrics::count(metrics::BYTES_SENT, n);
+    if (mDraining) {
+        size_t k = std::min(n, mOut.remaining());
+        mOut.pos(mOut.pos() + k);
+        n -= k;
+        if (mOut.hasRemaining())
+            return WANT_WRITE;
+        mOut.clear();
+        mDraining = false;
+    }
+    if (mAsset) {
+        for (iovec &v : mAssetIov) {
+            size_t k = std::min(n, v.iov_len);
+            v.iov_base = static_cast<char*>(v.iov_base) + k;
+            v.iov_len -= k;
+            n -= k;
+        }
+        if (mAssetIov[0].iov_len > 0 || mAssetIov[1].iov_len > 0)
+            return WANT_WRITE;
+        mAsset.reset();
+    }
+    if (mFile >= 0)
+        return flushFile();
+    if (proxying())
+        return flushProxy();
+    return written();
+}
+
+// Whether the connection closes once pending() output is sent, so the
+// caller may queue the close right behind it
+bool HttpConnection::isLastResponse() {
+    return mClose && mFile < 0 && !proxying();
+}
+
+// Whether a static file body or proxied response is left to send, see sent()
+bool HttpConnection::isSendingFile() {
+    return (mFile >= 0 || proxying()) && !mDraining;
+}
+
+// Whether the request head being received is overdue, checked between
+// reads of a blocking channel; event loops time it with a Timer instead.
+// Bytes trickling in keep each read short of the idle timeout, so the
+// deadline counts from the first read of the head.
+bool HttpConnection::headerExpired() {
+    if (mConfig.headerTimeoutMs <= 0 || !readingHead()) {
+        mHeadTimed = false;
+        return false;
+    }
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (!mHeadTimed) {
+        mHeadTimed = true;
+        mHeadStart = now;
+        return false;
+    }
+    return now - mHeadStart >= std::chrono::milliseconds(mConfig.headerTimeoutMs);
+}
+
+// Continue a write that was blocked, then resume reading
+HttpConnection::Action HttpConnection::onWritable() {
+    Action action = flush();
+    if (action != WANT_READ)
+        return action;
+    return onReadable();
+}
+
+} // namespace http
+} // namespace pardus
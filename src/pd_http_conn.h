@@ -0,0 +1,133 @@
+#ifndef PD_HTTP_CONN_H
+#define PD_HTTP_CONN_H
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include "pd_net.h"
+#include "pd_http.h"
+#include "pd_static.h"
+#include "pd_proxy.h"
+
+namespace pardus {
+namespace http {
+
+using nio::SocketChannel;
+
+// HttpServerConfig - Settings shared by every connection of a server
+struct HttpServerConfig {
+    int idleTimeoutMs = 5000;               // keep-alive idle time before closing
+    int headerTimeoutMs = 10000;            // time to receive a whole request head
+    int writeTimeoutMs = 30000;             // time a response write may make no progress
+    size_t maxRequestsPerConnection = 1000; // 0 means unlimited
+    bool metrics = true;                    // answer GET /metrics with the Metrics
+    HttpLimits limits;
+    StaticFileHandler *staticFiles = nullptr;   // serves GET and HEAD when set
+    ReverseProxy *proxy = nullptr;              // forwards all but /metrics when set
+};
+
+// HttpConnection - HTTP/1.1 protocol state of one client connection
+// Requests are parsed from one input buffer; all complete pipelined
+// requests found in it are answered into one output buffer, which goes out
+// with a single write. A static file body is sent with sendfile() right
+// after the headers before it, a cached one goes out from memory together
+// with mOut in one writev(). A proxied response follows mOut the same way,
+// spliced from its upstream by a ProxyRelay. Works on blocking channels through serve(),
+// on non-blocking ones by calling onReadable()/onWritable() on readiness,
+// and with completion based I/O such as io_uring through receive(),
+// pending() and sent(), where the caller moves the bytes.
+// While a proxied request waits for its upstream, the non-blocking calls
+// return WANT_UPSTREAM_READ or WANT_UPSTREAM_WRITE: the caller waits for
+// upstream() to be ready for up to upstreamTimeoutMs(), calling
+// expireUpstream() if it is not, then onWritable() or sent(0).
+class HttpConnection {
+public:
+    enum Action {
+        WANT_READ,
+        WANT_WRITE,
+        WANT_UPSTREAM_READ,
+        WANT_UPSTREAM_WRITE,
+        CLOSE
+    };
+
+    HttpConnection(SocketChannel chan, const HttpServerConfig &config);
+    HttpConnection(const HttpConnection &) = delete;
+    HttpConnection& operator=(const HttpConnection &) = delete;
+    ~HttpConnection();
+
+    void serve();
+    Action onReadable();
+    Action onWritable();
+    size_t receive(const char *data, size_t length);
+    int pending(iovec *iov, int max);
+    Action sent(size_t n);
+    bool isLastResponse();
+    bool isSendingFile();
+    void close();
+
+    SocketChannel &channel();
+    size_t requestCount();
+    bool readingHead();
+    SocketChannel *upstream();
+    int upstreamTimeoutMs();
+    void expireUpstream();
+
+private:
+    bool process();
+    void growInput(size_t capacity);
+    bool handle(HttpRequest &req, bool keepAlive);
+    bool handleStatic(HttpRequest &req, bool keepAlive, bool headOnly);
+    bool handleMetrics(bool keepAlive, bool headOnly);
+    bool handleProxy(HttpRequest &req, bool keepAlive);
+    bool respond(int status, const char *contentType, const char *body,
+                 size_t length, bool keepAlive, bool headOnly = false);
+    void logAccess(const Slice &method, const Slice &target, const Slice &version);
+    Action flush();
+    Action flushFile();
+    Action flushAsset();
+    Action flushProxy();
+    bool proxying();
+    Action written();
+    void closeFile();
+    bool headerExpired();
+
+private:
+    SocketChannel mChan;
+    const HttpServerConfig &mConfig;
+    HttpRequestParser mParser;
+    nio::ByteBuffer mIn;
+    nio::ByteBufferChain mBody;   // request body spilled out of mIn when it filled up
+    nio::ByteBuffer mOut;
+    bool mDraining = false;   // mOut is flipped and being written out
+    bool mClose = false;      // close once mOut is written
+    int mFile = -1;           // body of the last response in mOut, sent after it
+    off_t mFileOffset = 0;
+    size_t mFileLeft = 0;
+    std::shared_ptr<const CachedAsset> mAsset;  // cached response, sent after mOut
+    iovec mAssetIov[2];       // unsent part of its header block and body
+    std::unique_ptr<ProxyRelay> mProxy;     // made on the first proxied request
+    Slice mProxyMethod;       // request line of the proxied request, logged
+    Slice mProxyTarget;       // once its response head is known
+    Slice mProxyVersion;
+    size_t mRequests = 0;
+    int mLastStatus = 0;      // of the last response, for the access log
+    size_t mLastLength = 0;   // body bytes of the last response
+    bool mHeadTimed = false;  // mHeadStart set, blocking channels only
+    std::chrono::steady_clock::time_point mHeadStart;
+
+    // Stage timing, see Metrics
+    std::chrono::steady_clock::time_point mOpened;
+    std::chrono::steady_clock::time_point mWriteStart;
+    std::chrono::steady_clock::duration mParseTime{0};  // of the request head so far
+    bool mFirstByte = false;
+    bool mWriting = false;    // mWriteStart set, output is pending
+};
+
+const char *statusReason(int status);
+
+} // namespace http
+} // namespace pardus
+
+
+#endif //PD_HTTP_CONN_H
@@ -1,128 +1,357 @@
 #include <iostream>
 #include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <signal.h>
+#include <poll.h>
 #include <unistd.h>
 #include <cstdlib>
 #include <thread>
+#include <mutex>
+#include <memory>
+#include <utility>
+#include <vector>
 #include <string>
 #include <cstring>
+#include <chrono>
+#include <pthread.h>
+#include <sched.h>
 
 #include "pd_util.h"
 #include "pd_net.h"
+#include "pd_selector.h"
+#include "pd_threadpool.h"
+#include "pd_timer.h"
+#include "pd_uring.h"
+#include "pd_bufpool.h"
+#include "pd_metrics.h"
+#include "pd_log.h"
+#include "pd_http_conn.h"
+#include "pd_proxy.h"
 #include "pd_http_server.h"
 
-std::string msg = "Hello from server";
+using namespace pardus::nio;
+using pardus::threadpool::ThreadPool;
+using pardus::http::HttpConnection;
+using pardus::http::HttpServerConfig;
+using pardus::http::StaticFileHandler;
+using pardus::http::ReverseProxy;
+using pardus::timer::Timer;
+using pardus::timer::TimerWheel;
+using pardus::metrics::Metrics;
+
+typedef std::chrono::steady_clock Clock;
 
 void server_iterative();
 void server_multiprocess();
 void server_multithread();
+void server_eventloop();
+void server_multireactor();
+void server_prefork();
+void server_uring();
 
+// Number of reactors of server_multireactor or workers of server_multithread,
+// 0 picks a default from the core count
+unsigned thread_count = 0;
 
-int main(int argc, char const *argv[]){
-    //server_iterative();
-    //server_multiprocess();
-    server_multithread();
-    return 0;
+HttpServerConfig server_config;
+
+// Directory served by the static file handler, empty answers every request
+// with a fixed greeting
+std::string doc_root = "public_html";
+
+// Connections the kernel queues on a listening socket before accept
+int listen_backlog = LISTENQ;
+
+// Pin each prefork worker to a core, like the reactors are
+bool pin_workers = false;
+
+// Options of the listening sockets, inherited by accepted ones. TCP_NODELAY
+// is on unless turned off: a file body sent right after its headers would
+// wait for the delayed ACK of the headers otherwise.
+SocketOptions socket_options = []{
+    SocketOptions opts;
+    opts.noDelay = 1;
+    return opts;
+}();
+
+// Memory for cached static files, and the largest file that is cached
+size_t cache_size = 32 << 20;
+size_t cache_max_file = 64 << 10;
+
+// Servers requests are forwarded to, none serves them locally
+std::vector<std::string> upstreams;
+ReverseProxy::Balance upstream_balance = ReverseProxy::ROUND_ROBIN;
+
+struct ServerMode {
+    const char *name;
+    void (*run)();
+};
+
+const ServerMode server_modes[] = {
+    {"iterative", server_iterative},
+    {"multiprocess", server_multiprocess},
+    {"multithread", server_multithread},
+    {"eventloop", server_eventloop},
+    {"multireactor", server_multireactor},
+    {"prefork", server_prefork},
+    {"uring", server_uring},
+};
+
+struct ServerOption {
+    const char *name;
+    const char *help;
+    void (*set)(const char *value);
+};
+
+const ServerOption server_options[] = {
+    {"--idle-timeout", "ms a keep-alive connection may stay idle",
+     [](const char *v){ server_config.idleTimeoutMs = std::stoi(v); }},
+    {"--header-timeout", "ms a client may take to send a request head",
+     [](const char *v){ server_config.headerTimeoutMs = std::stoi(v); }},
+    {"--write-timeout", "ms a response may wait for the client to take data",
+     [](const char *v){ server_config.writeTimeoutMs = std::stoi(v); }},
+    {"--max-requests", "requests served per connection, 0 for unlimited",
+     [](const char *v){ server_config.maxRequestsPerConnection = std::stoul(v); }},
+    {"--backlog", "pending connections queued by the kernel, capped by somaxconn",
+     [](const char *v){ listen_backlog = std::stoi(v); }},
+    {"--pin-workers", "1 to pin prefork workers to a core each",
+     [](const char *v){ pin_workers = std::stoi(v) != 0; }},
+    {"--socket", "low-latency, bulk-throughput and/or NAME=VALUE socket options, comma separated, on top of nodelay=1",
+     [](const char *v){
+        if(!SocketOptions::parse(v, socket_options)){
+            std::cerr << "Bad socket options: " << v << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+     }},
+    {"--metrics", "0 to not answer GET /metrics",
+     [](const char *v){ server_config.metrics = std::stoi(v) != 0; }},
+    {"--log-level", "debug, info, warn, error or off",
+     [](const char *v){
+        pardus::log::Level level;
+        if(!pardus::log::parseLevel(v, level)){
+            std::cerr << "Unknown log level: " << v << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        pardus::log::setLevel(level);
+     }},
+    {"--log-file", "file the server log is appended to, - for stdout, stderr by default",
+     [](const char *v){
+        if(pardus::log::openServerLog(v) < 0){
+            std::cerr << "Cannot open log file " << v << ": " << std::strerror(errno) << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+     }},
+    {"--access-log", "file requests are logged to in Common Log Format, - for stdout",
+     [](const char *v){
+        if(pardus::log::openAccessLog(v) < 0){
+            std::cerr << "Cannot open access log " << v << ": " << std::strerror(errno) << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+     }},
+    {"--doc-root", "directory of static files, empty to disable",
+     [](const char *v){ doc_root = v; }},
+    {"--cache-size", "bytes of static files kept in memory, 0 to disable",
+     [](const char *v){ cache_size = std::stoul(v); }},
+    {"--cache-max-file", "largest static file kept in memory",
+     [](const char *v){ cache_max_file = std::stoul(v); }},
+    {"--upstream", "HOST:PORT or unix:PATH to proxy requests to, may be repeated",
+     [](const char *v){ upstreams.push_back(v); }},
+    {"--balance", "round-robin or least-conn, how requests spread over upstreams",
+     [](const char *v){
+        if(!ReverseProxy::parseBalance(v, upstream_balance)){
+            std::cerr << "Unknown balance mode: " << v << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+     }},
+};
+
+static void usage(const char *prog){
+    std::cerr << "Usage: " << prog << " [options] [mode] [threads]" << std::endl << "Modes:";
+    for(const ServerMode &m : server_modes)
+        std::cerr << " " << m.name;
+    std::cerr << std::endl << "Options:" << std::endl;
+    for(const ServerOption &o : server_options)
+        std::cerr << "  " << o.name << "=VALUE\t" << o.help << std::endl;
 }
 
-//class Task{
-//public:
-//    Task() = default;
-//    Task(SocketChannel sockChan): mSockChan(std::move(sockChan)){}
-//    void operator()(){
-//        //Process accepted connections
-//        std::cout << "Waiting for connection from client" << std::endl;
-//        SocketChannel* accChan = new SocketChannel(std::move(sockchan.accept()));
-//        std::cout << "New connection from: " << accChan->get_socket().get_remote_addr().to_string() << std::endl;
-//
-//        pthread_t tid;
-//        int err;
-//        if((err = pthread_create(&tid, nullptr, connection_processor, accChan)) != 0){
-//            std::cerr << "Thread spawn error: " << std::strerror(errno) << std::endl;
-//        }
-//        pthread_detach(tid);
-//        std::cout << "Main thread continue listening from clients" << std::endl;
-//    }
-//
-//private:
-//    SocketChannel mSockChan;
-//};
-
-
-void connection_processor(SocketChannel accChan){
-    std::cout << "Worker thread processing connection from: " << accChan.get_remote_addr().to_string() << std::endl;
-
-    // Read from channel
-    ByteBuffer buffer(BUFFSIZE);
-    buffer.clear();
-    accChan.read(buffer);
-    buffer.flip();
-    std::cout << buffer.to_string() << std::endl;
-
-    // Write to channel
-    buffer.clear();
-    buffer.put((Byte*)msg.c_str(), 0, msg.size());
-    buffer.flip();
-    accChan.write(buffer);
-    accChan.close();
+// Parse --name=value, return false if name is unknown
+static bool parse_option(const char *arg){
+    const char *eq = std::strchr(arg, '=');
+    if(eq == nullptr)
+        return false;
+    for(const ServerOption &o : server_options){
+        if(std::strncmp(o.name, arg, eq - arg) == 0 && o.name[eq - arg] == '\0'){
+            o.set(eq + 1);
+            return true;
+        }
+    }
+    return false;
 }
 
+// Export the state of the buffer pool, the log, the file cache and the
+// upstream connections with the Metrics
+static void server_metrics(StaticFileHandler &staticFiles, ReverseProxy &proxy){
+    Metrics::addGauge("pardus_bytebuffer_bytes{state=\"in_use\"}", "ByteBuffer storage allocated",
+                      []{ return static_cast<double>(BufferPool::stats().bytesInUse); });
+    Metrics::addGauge("pardus_bytebuffer_bytes{state=\"cached\"}", "ByteBuffer storage allocated",
+                      []{ return static_cast<double>(BufferPool::stats().bytesCached); });
+    Metrics::addGauge("pardus_log_dropped_total", "Log records dropped with the log writer behind",
+                      []{ return static_cast<double>(pardus::log::dropped()); }, "counter");
+    if(server_config.proxy != nullptr){
+        pardus::http::ConnectionPool *pool = &proxy.pool();
+        Metrics::addGauge("pardus_upstream_connections_total{result=\"connected\"}",
+                          "Connections to upstreams",
+                          [pool]{ return static_cast<double>(pool->stats().connects); }, "counter");
+        Metrics::addGauge("pardus_upstream_connections_total{result=\"reused\"}",
+                          "Connections to upstreams",
+                          [pool]{ return static_cast<double>(pool->stats().reuses); }, "counter");
+        Metrics::addGauge("pardus_upstream_connections_total{result=\"failed\"}",
+                          "Connections to upstreams",
+                          [pool]{ return static_cast<double>(pool->stats().connectFailures); }, "counter");
+        Metrics::addGauge("pardus_upstream_connections_idle", "Keep-alive connections to upstreams",
+                          [pool]{ return static_cast<double>(pool->stats().idle); });
+    }
+    if(server_config.staticFiles == nullptr)
+        return;
+    pardus::http::FileCache *cache = &staticFiles.cache();
+    Metrics::addGauge("pardus_filecache_lookups_total{result=\"hit\"}", "File cache lookups",
+                      [cache]{ return static_cast<double>(cache->stats().hits); }, "counter");
+    Metrics::addGauge("pardus_filecache_lookups_total{result=\"miss\"}", "File cache lookups",
+                      [cache]{ return static_cast<double>(cache->stats().misses); }, "counter");
+    Metrics::addGauge("pardus_filecache_evictions_total", "Files dropped to stay under the size limit",
+                      [cache]{ return static_cast<double>(cache->stats().evictions); }, "counter");
+    Metrics::addGauge("pardus_filecache_invalidations_total", "Files dropped because they changed",
+                      [cache]{ return static_cast<double>(cache->stats().invalidations); }, "counter");
+    Metrics::addGauge("pardus_filecache_entries", "Files in the file cache",
+                      [cache]{ return static_cast<double>(cache->stats().entries); });
+    Metrics::addGauge("pardus_filecache_bytes", "Memory held by the file cache",
+                      [cache]{ return static_cast<double>(cache->stats().bytesResident); });
+}
 
-void server_multithread(){
-    SocketChannel sockchan;
-    int server_fd = sockchan.listen(SocketAddress("localhost", SERVER_PORT));
-    if(server_fd < 0){
-        std::cerr << "Bind to port SERVER_PORT failed: " << std::strerror(errno) << std::endl;
+// Usage: pardus [options] [mode] [threads]
+// The mode defaults to multithread, so that the strategies can be compared
+// against the same client load by restarting with a different mode.
+int main(int argc, char const *argv[]){
+    const char *mode = "multithread";
+    int positional = 0;
+    for(int i = 1; i < argc; i++){
+        if(std::strncmp(argv[i], "--", 2) == 0){
+            if(!parse_option(argv[i])){
+                std::cerr << "Unknown option: " << argv[i] << std::endl;
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }else if(positional++ == 0){
+            mode = argv[i];
+        }else{
+            thread_count = static_cast<unsigned>(std::stoul(argv[i]));
+        }
     }
 
-    std::cout << "Is server listening: " << sockchan.is_listening() << std::endl;
-    std::cout << "Server address: " << sockchan.get_local_addr().to_string() << std::endl;
+    StaticFileHandler staticFiles(doc_root, cache_size, cache_max_file);
+    if(!doc_root.empty()){
+        if(staticFiles.isOpen())
+            server_config.staticFiles = &staticFiles;
+        else
+            PD_LOG_WARN("Cannot open document root %s: %s, static files disabled",
+                        doc_root, std::strerror(errno));
+    }
 
-    while(1){
-        std::cout << "Waiting for connection from client" << std::endl;
-        SocketChannel accChan = sockchan.accept();
-        std::thread(connection_processor, std::move(accChan)).detach();
-        std::cout << "Main thread continue listening from clients" << std::endl;
+    ReverseProxy proxy;
+    proxy.balance(upstream_balance);
+    for(const std::string &u : upstreams){
+        if(proxy.addUpstream(u) < 0){
+            std::cerr << "Bad upstream: " << u << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if(proxy.upstreamCount() > 0)
+        server_config.proxy = &proxy;
+
+    // Writes and splice() to a client that went away must fail, not kill
+    signal(SIGPIPE, SIG_IGN);
+    server_metrics(staticFiles, proxy);
+    for(const ServerMode &m : server_modes){
+        if(std::strcmp(m.name, mode) == 0){
+            m.run();
+            return 0;
+        }
     }
+
+    std::cerr << "Unknown server mode: " << mode << std::endl;
+    usage(argv[0]);
+    return EXIT_FAILURE;
 }
 
+// Apply socket_options to listener, served by a thread pinned to core cpu
+// or by any with cpu -1; options the kernel refuses are only warned about
+static void server_tune(SocketChannel &listener, int cpu = -1){
+    SocketOptions opts = socket_options;
+    if(opts.incomingCpu == SOCKET_INCOMING_CPU_AUTO)
+        opts.incomingCpu = cpu;
+    if(listener.setOptions(opts) < 0)
+        PD_LOG_WARN("Socket options %s not all applied: %s", socket_options.toString(),
+                    std::strerror(errno));
+}
 
+// Block until a connection is accepted from a blocking listener
+// Out of descriptors or memory, wait as advised by the Acceptor and retry
+// instead of giving up.
+static SocketChannel server_accept(Acceptor &acceptor){
+    for(;;){
+        SocketChannel chan = acceptor.accept();
+        if(chan.isAccepted())
+            return chan;
+        if(errno == EINTR || errno == ECONNABORTED)
+            continue;
+        int ms = std::max(acceptor.backoffMs(), ACCEPT_BACKOFF_MIN_MS);
+        PD_LOG_WARN("Accept failed: %s, retrying in %d ms", std::strerror(errno), ms);
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    }
+}
+
+// Fork per connection. Children are reaped by the kernel (SA_NOCLDWAIT),
+// so exited ones do not pile up as zombies.
 void server_multiprocess(){
+    struct sigaction sa{};
+    sa.sa_handler = SIG_DFL;
+    sa.sa_flags = SA_NOCLDWAIT;
+    sigaction(SIGCHLD, &sa, nullptr);
+
     SocketChannel sockchan;
-    int server_fd = sockchan.listen(SocketAddress("localhost", SERVER_PORT));
+    int server_fd = sockchan.listen(SocketAddress("", SERVER_PORT), false, listen_backlog);
     if(server_fd < 0){
-        std::cerr << "Bind to port SERVER_PORT failed: " << std::strerror(errno) << std::endl;
+        PD_LOG_ERROR("Bind to port %d failed: %s", SERVER_PORT, std::strerror(errno));
+        return;
     }
+    server_tune(sockchan);
 
-    std::cout << "Is server listening: " << sockchan.is_listening() << std::endl;
-    std::cout << "Server address: " << sockchan.get_local_addr().to_string() << std::endl;
+    PD_LOG_INFO("Is server listening: %d", sockchan.isListening());
+    PD_LOG_INFO("Server address: %s", sockchan.getLocalAddr());
 
+    Acceptor acceptor(sockchan);
     while(1){
-        std::cout << "Waiting for connection from client" << std::endl;
-        SocketChannel accChan = std::move(sockchan.accept());
-        std::cout << "New connection from: " << accChan.get_remote_addr().to_string() << std::endl;
+        PD_LOG_DEBUG("Waiting for connection from client");
+        SocketChannel accChan = server_accept(acceptor);
+        PD_LOG_DEBUG("New connection from: %s", accChan.getRemoteAddr());
 
         pid_t pid;
         if((pid = fork()) < 0){
-            std::cerr << "Fork error: " << std::strerror(errno) << std::endl;
+            PD_LOG_ERROR("Fork error: %s", std::strerror(errno));
         }else if(pid == 0){
-            std::cout << "Child processing connection from: " << accChan.get_remote_addr().to_string() << std::endl;
-            // Read from channel
-            ByteBuffer buffer(BUFFSIZE);
-            buffer.clear();
-            accChan.read(buffer);
-            buffer.flip();
-            std::cout << buffer.to_string() << std::endl;
-
-            // Write to channel
-            buffer.clear();
-            buffer.put((Byte*)msg.c_str(), 0, msg.size());
-            buffer.flip();
-            accChan.write(buffer);
-
-            accChan.close();
+            PD_LOG_DEBUG("Child processing connection from: %s", accChan.getRemoteAddr());
+            // The listener stays with the parent; one connection does not
+            // need a log flusher thread. The file cache starts over, see
+            // FileCache::reopen().
+            sockchan.close();
+            pardus::log::setSynchronous(true);
+            if(server_config.staticFiles)
+                server_config.staticFiles->cache().reopen();
+            HttpConnection(std::move(accChan), server_config).serve();
             exit(0);
         }else{
-            std::cout << "Child pid is:" << pid << std::endl;
+            PD_LOG_DEBUG("Child pid is: %d", pid);
         }
     }
 }
@@ -131,32 +360,917 @@ void server_multiprocess(){
 
 void server_iterative(){
     SocketChannel sockchan;
-    int server_fd = sockchan.listen(SocketAddress("localhost", SERVER_PORT));
+    int server_fd = sockchan.listen(SocketAddress("", SERVER_PORT), false, listen_backlog);
     if(server_fd < 0){
-        std::cerr << "Bind to port SERVER_PORT failed: " << std::strerror(errno) << std::endl;
+        PD_LOG_ERROR("Bind to port %d failed: %s", SERVER_PORT, std::strerror(errno));
+        return;
+    }
+    server_tune(sockchan);
+
+    PD_LOG_INFO("Is server listening: %d", sockchan.isListening());
+    PD_LOG_INFO("Server address: %s", sockchan.getLocalAddr());
+
+    Acceptor acceptor(sockchan);
+    while(1){
+        PD_LOG_DEBUG("Waiting for connection from client");
+        SocketChannel accChan = server_accept(acceptor);
+        PD_LOG_DEBUG("New connection from: %s", accChan.getRemoteAddr());
+
+        // Keep-alive clients are served until they close or go idle,
+        // other clients wait meanwhile
+        HttpConnection(std::move(accChan), server_config).serve();
+    }
+}
+
+// ConnectionTimer - Deadline of a connection driven by an event loop
+// One Timer carries whichever deadline applies: the request head, the
+// keep-alive idle time, a stalled write or the upstream of a proxied
+// request. It fires from the loop's TimerWheel, its callback closes the
+// connection, or fails the upstream attempt.
+struct ConnectionTimer {
+    enum Phase {
+        IDLE,
+        HEAD,
+        WRITE,
+        UPSTREAM
+    };
+
+    ConnectionTimer(TimerWheel &wheel, Timer::Callback callback, void *arg)
+            : mWheel(wheel), mTimer(callback, arg) {}
+
+    // Time phase, the head deadline runs from when the head started arriving
+    // while the idle and write ones restart on every event
+    void arm(Phase phase){
+        if(phase == HEAD && mPhase == HEAD && mTimer.isArmed())
+            return;
+        mPhase = phase;
+        int ms = phase == HEAD ? server_config.headerTimeoutMs
+               : phase == WRITE ? server_config.writeTimeoutMs
+               : server_config.idleTimeoutMs;
+        if(ms > 0)
+            mWheel.schedule(mTimer, ms);
+        else
+            mWheel.cancel(mTimer);
+    }
+
+    // Time a wait for the upstream, see HttpConnection::upstreamTimeoutMs()
+    void armUpstream(int ms){
+        mPhase = UPSTREAM;
+        if(ms > 0)
+            mWheel.schedule(mTimer, ms);
+        else
+            mWheel.cancel(mTimer);
+    }
+
+    void cancel(){
+        mWheel.cancel(mTimer);
     }
 
-    std::cout << "Is server listening: " << sockchan.is_listening() << std::endl;
-    std::cout << "Server address: " << sockchan.get_local_addr().to_string() << std::endl;
+    TimerWheel &mWheel;
+    Timer mTimer;
+    Phase mPhase = IDLE;
+};
+
+struct EventConnection;
+
+// Handoff - ThreadPool an event loop has its connections served on
+// The loop keeps the keys and timers; a pool thread runs one onReadable()
+// or onWritable() of a ready connection and hands the Action back through
+// mDone, waking the loop up to apply it.
+struct Handoff {
+    Handoff(ThreadPool &pool, Selector &selector) : mPool(pool), mSelector(selector) {}
+
+    ThreadPool &mPool;
+    Selector &mSelector;
+    std::mutex mMutex;
+    std::vector<std::pair<EventConnection*, HttpConnection::Action>> mDone;
+};
+
+// EventConnection - Per-connection state of the event loop
+// A proxied request waiting for its upstream has the upstream connection
+// registered as well, level triggered, with the same attachment.
+struct EventConnection {
+    EventConnection(SocketChannel chan, TimerWheel &wheel, Selector &selector, Handoff *handoff)
+            : mConn(std::move(chan), server_config), mDeadline(wheel, expired, this),
+              mSelector(selector), mHandoff(handoff) {}
+
+    static void expired(Timer &timer, void *arg);
+
+    HttpConnection mConn;
+    SelectionKey *mKey = nullptr;
+    SelectionKey *mUpstreamKey = nullptr;
+    ConnectionTimer mDeadline;
+    Selector &mSelector;
+    Handoff *mHandoff;          // null to serve on the loop thread
+    bool mBusy = false;         // on a pool thread, the loop leaves it alone
+    bool mOverdue = false;      // mDeadline fired while busy
+};
+
+static void eventloop_close(EventConnection *conn){
+    conn->mKey->cancel();
+    if(conn->mUpstreamKey)
+        conn->mUpstreamKey->cancel();
+    conn->mConn.close();
+    delete conn;
+}
+
+// Wait for what action asks for
+// The upstream key is made anew for every wait: a failed attempt closes
+// its connection and the next one may reuse the descriptor.
+static void eventloop_update(EventConnection *conn, HttpConnection::Action action){
+    if(conn->mUpstreamKey){
+        conn->mUpstreamKey->cancel();
+        conn->mUpstreamKey = nullptr;
+    }
+    if(action == HttpConnection::CLOSE){
+        eventloop_close(conn);
+        return;
+    }
+    if(action == HttpConnection::WANT_WRITE){
+        conn->mKey->interestOps(SelectionKey::OP_WRITE);
+        conn->mDeadline.arm(ConnectionTimer::WRITE);
+        return;
+    }
+    conn->mKey->interestOps(SelectionKey::OP_READ);
+    if(action == HttpConnection::WANT_READ){
+        conn->mDeadline.arm(conn->mConn.readingHead() ? ConnectionTimer::HEAD : ConnectionTimer::IDLE);
+        return;
+    }
+    int ops = action == HttpConnection::WANT_UPSTREAM_READ ? SelectionKey::OP_READ
+                                                           : SelectionKey::OP_WRITE;
+    conn->mUpstreamKey = conn->mSelector.registerChannel(*conn->mConn.upstream(), ops, conn);
+    if(conn->mUpstreamKey == nullptr){
+        PD_LOG_ERROR("Register upstream failed: %s", std::strerror(errno));
+        eventloop_close(conn);
+        return;
+    }
+    conn->mDeadline.armUpstream(conn->mConn.upstreamTimeoutMs());
+}
+
+// Serve conn on a pool thread, writing if resume, else reading
+// Its keys are off until the Action comes back. The deadline stays armed,
+// so that a head trickling in does not restart it with every read.
+static void eventloop_dispatch(EventConnection *conn, bool resume){
+    conn->mBusy = true;
+    conn->mKey->interestOps(0);
+    if(conn->mUpstreamKey){
+        conn->mUpstreamKey->cancel();
+        conn->mUpstreamKey = nullptr;
+    }
+    conn->mHandoff->mPool.execute([conn, resume]{
+        HttpConnection::Action action = resume ? conn->mConn.onWritable() : conn->mConn.onReadable();
+        Handoff *handoff = conn->mHandoff;
+        {
+            std::lock_guard<std::mutex> lck(handoff->mMutex);
+            handoff->mDone.emplace_back(conn, action);
+        }
+        handoff->mSelector.wakeup();
+    });
+}
+
+// Apply the Actions of the connections the pool threads are done with
+static void eventloop_collect(Handoff &handoff){
+    std::vector<std::pair<EventConnection*, HttpConnection::Action>> done;
+    {
+        std::lock_guard<std::mutex> lck(handoff.mMutex);
+        done.swap(handoff.mDone);
+    }
+    for(auto &d : done){
+        EventConnection *conn = d.first;
+        conn->mBusy = false;
+        // The other deadlines restart with the event anyway
+        bool overdue = conn->mOverdue && conn->mDeadline.mPhase == ConnectionTimer::HEAD
+                       && d.second == HttpConnection::WANT_READ && conn->mConn.readingHead();
+        conn->mOverdue = false;
+        eventloop_update(conn, overdue ? HttpConnection::CLOSE : d.second);
+    }
+}
+
+// Close the connection, or fail the upstream attempt it waits for
+void EventConnection::expired(Timer &, void *arg){
+    auto *conn = static_cast<EventConnection*>(arg);
+    if(conn->mBusy){
+        conn->mOverdue = true;
+        return;
+    }
+    if(conn->mDeadline.mPhase != ConnectionTimer::UPSTREAM){
+        eventloop_close(conn);
+        return;
+    }
+    conn->mConn.expireUpstream();
+    if(conn->mHandoff)
+        eventloop_dispatch(conn, true);
+    else
+        eventloop_update(conn, conn->mConn.onWritable());
+}
+
+// Accept every pending connection, the listener is non-blocking
+// Each accept4() is timed from the end of the previous callback
+static void eventloop_accept(Selector &selector, Acceptor &acceptor, TimerWheel &wheel,
+                             Handoff *handoff){
+    Clock::time_point start = Clock::now();
+    acceptor.acceptBatch([&](SocketChannel accChan){
+        Metrics::record(pardus::metrics::STAGE_ACCEPT, Clock::now() - start);
+        auto *conn = new EventConnection(std::move(accChan), wheel, selector, handoff);
+        SocketChannel &chan = conn->mConn.channel();
+        if((conn->mKey = selector.registerChannel(chan, SelectionKey::OP_READ, conn, true)) == nullptr){
+            PD_LOG_ERROR("Register connection failed: %s", std::strerror(errno));
+            conn->mConn.close();
+            delete conn;
+        }else{
+            // Nothing received yet, the client owes a request head
+            conn->mDeadline.arm(ConnectionTimer::HEAD);
+        }
+        start = Clock::now();
+    });
+}
+
+// Drive the connection on readiness (edge triggered), or on that of the
+// upstream it waits for
+static void eventloop_serve(SelectionKey *key){
+    auto *conn = static_cast<EventConnection*>(key->attachment());
+    // Selected before it was handed off, with the key that was
+    if(conn->mBusy)
+        return;
+    bool resume = key == conn->mUpstreamKey || key->isWritable();
+    if(conn->mHandoff)
+        eventloop_dispatch(conn, resume);
+    else
+        eventloop_update(conn, resume ? conn->mConn.onWritable() : conn->mConn.onReadable());
+}
+
+// Run an event loop on listening channel sockchan, never return
+// Connections are served on the loop thread, or on pool when given.
+static void eventloop_run(SocketChannel &sockchan, ThreadPool *pool){
+    Selector selector;
+    TimerWheel wheel(EVENTLOOP_TICK_MS);
+    std::unique_ptr<Handoff> handoff(pool ? new Handoff(*pool, selector) : nullptr);
+    sockchan.configureBlocking(false);
+    Acceptor acceptor(sockchan);
+    SelectionKey *acceptKey = selector.registerChannel(sockchan, SelectionKey::OP_ACCEPT);
+    bool acceptPaused = false;
+    Clock::time_point acceptResume;
 
     while(1){
-        std::cout << "Waiting for connection from client" << std::endl;
-        SocketChannel accChan = std::move(sockchan.accept());
-        std::cout << "New connection from: " << accChan.get_remote_addr().to_string() << std::endl;
-
-        // Read from channel
-        ByteBuffer buffer(BUFFSIZE);
-        buffer.clear();
-        accChan.read(buffer);
-        buffer.flip();
-        std::cout << buffer.to_string() << std::endl;
-
-        // Write to channel
-        buffer.clear();
-        buffer.put((Byte*)msg.c_str(), 0, msg.size());
-        buffer.flip();
-        accChan.write(buffer);
-
-        accChan.close();
-    }
-}
\ No newline at end of file
+        long timeout = wheel.nextTimeoutMs();
+        if(acceptPaused && (timeout < 0 || timeout > ACCEPT_BACKOFF_MIN_MS))
+            timeout = ACCEPT_BACKOFF_MIN_MS;
+        if(selector.select(timeout) < 0){
+            PD_LOG_ERROR("Select failed: %s", std::strerror(errno));
+            continue;
+        }
+        Clock::time_point now = Clock::now();
+        wheel.advance(now);
+        if(handoff)
+            eventloop_collect(*handoff);
+        for(SelectionKey *key : selector.selectedKeys()){
+            if(!key->isValid())
+                continue;
+            if(!key->isAcceptable()){
+                eventloop_serve(key);
+                continue;
+            }
+            eventloop_accept(selector, acceptor, wheel, handoff.get());
+            if(acceptor.backoffMs() > 0){
+                // Out of descriptors, stop watching the listener for a while
+                acceptPaused = true;
+                acceptResume = now + std::chrono::milliseconds(acceptor.backoffMs());
+                acceptKey->interestOps(0);
+            }
+        }
+        if(acceptPaused && now >= acceptResume){
+            acceptPaused = false;
+            acceptKey->interestOps(SelectionKey::OP_ACCEPT);
+        }
+    }
+}
+
+static void eventloop_run(SocketChannel &sockchan){
+    eventloop_run(sockchan, nullptr);
+}
+
+
+// Single threaded event loop, all connections are multiplexed by one Selector
+void server_eventloop(){
+    SocketChannel sockchan;
+    int server_fd = sockchan.listen(SocketAddress("", SERVER_PORT), false, listen_backlog);
+    if(server_fd < 0){
+        PD_LOG_ERROR("Bind to port %d failed: %s", SERVER_PORT, std::strerror(errno));
+        return;
+    }
+    server_tune(sockchan);
+
+    PD_LOG_INFO("Is server listening: %d", sockchan.isListening());
+    PD_LOG_INFO("Server address: %s", sockchan.getLocalAddr());
+
+    eventloop_run(sockchan);
+}
+
+
+// Thread pool behind one event loop. The loop accepts and waits for
+// readiness, a work stealing ThreadPool serves whatever became ready, one
+// read or write at a time, so idle keep-alive connections hold no thread.
+// Handlers may still block, e.g. on the disk, so the pool is oversized
+// relative to the core count by default.
+void server_multithread(){
+    unsigned ncpu = std::max(1u, std::thread::hardware_concurrency());
+    ThreadPool pool(thread_count ? thread_count : std::max(16u, ncpu * 8));
+    Metrics::addGauge("pardus_threadpool_queue_depth", "Ready connections waiting for a pool thread",
+                      [&pool]{ return static_cast<double>(pool.pending()); });
+    Metrics::addGauge("pardus_threadpool_threads", "Threads of the pool",
+                      [&pool]{ return static_cast<double>(pool.size()); });
+
+    SocketChannel sockchan;
+    int server_fd = sockchan.listen(SocketAddress("", SERVER_PORT), false, listen_backlog);
+    if(server_fd < 0){
+        PD_LOG_ERROR("Bind to port %d failed: %s", SERVER_PORT, std::strerror(errno));
+        return;
+    }
+    server_tune(sockchan);
+
+    PD_LOG_INFO("Is server listening: %d", sockchan.isListening());
+    PD_LOG_INFO("Server address: %s", sockchan.getLocalAddr());
+
+    eventloop_run(sockchan, &pool);
+}
+
+
+// One reactor: own SO_REUSEPORT listener and event loop, pinned to a core.
+// Connections accepted by a reactor never leave its thread.
+static void reactor_run(unsigned id, unsigned ncpu, void (*run)(SocketChannel &sockchan)){
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(id % ncpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+    SocketChannel sockchan;
+    if(sockchan.listen(SocketAddress("", SERVER_PORT), true, listen_backlog) < 0){
+        PD_LOG_ERROR("Reactor %u bind to port %d failed: %s", id, SERVER_PORT, std::strerror(errno));
+        return;
+    }
+    server_tune(sockchan, id % ncpu);
+    run(sockchan);
+}
+
+// Start thread_count reactors, one per core by default, each running run
+static void reactors_start(void (*run)(SocketChannel &sockchan)){
+    unsigned ncpu = std::max(1u, std::thread::hardware_concurrency());
+    unsigned n = thread_count ? thread_count : ncpu;
+
+    PD_LOG_INFO("Starting %u reactors on port %d", n, SERVER_PORT);
+
+    std::vector<std::thread> reactors;
+    for(unsigned i = 0; i < n; i++)
+        reactors.emplace_back(reactor_run, i, ncpu, run);
+    for(std::thread &t : reactors)
+        t.join();
+}
+
+// Multi-reactor, one event loop per core, each with its own SO_REUSEPORT listener
+void server_multireactor(){
+    reactors_start(eventloop_run);
+}
+
+
+// Set by SIGTERM or SIGINT, the prefork supervisor stops its workers and exits
+static volatile sig_atomic_t prefork_stop = 0;
+
+static void prefork_signal(int){
+    prefork_stop = 1;
+}
+
+// PreforkWorker - A worker slot of the prefork supervisor
+// The slot owns its SO_REUSEPORT listener, so connections queued on it wait
+// for the replacement of a crashed worker instead of being reset.
+struct PreforkWorker {
+    SocketChannel mListener;
+    pid_t mPid = -1;
+    Clock::time_point mStarted;
+    int mRestartMs = 0;         // delay before the next restart, 0 after a stable run
+};
+
+// Body of worker id: an event loop on the listener of its slot, never returns
+static void prefork_worker(std::vector<PreforkWorker> &workers, unsigned id, pid_t supervisor){
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    // Do not outlive the supervisor
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if(getppid() != supervisor)
+        _exit(0);
+
+    if(pin_workers){
+        unsigned ncpu = std::max(1u, std::thread::hardware_concurrency());
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(id % ncpu, &cpus);
+        sched_setaffinity(0, sizeof(cpus), &cpus);
+    }
+    for(unsigned i = 0; i < workers.size(); i++)
+        if(i != id)
+            workers[i].mListener.close();
+    // The file cache of the supervisor would miss the changes seen by others
+    if(server_config.staticFiles)
+        server_config.staticFiles->cache().reopen();
+    eventloop_run(workers[id].mListener);
+    _exit(0);
+}
+
+// Fork the worker of slot id
+//    Return 0 on success
+//    On error, return -1 and sets errno
+static int prefork_spawn(std::vector<PreforkWorker> &workers, unsigned id){
+    pid_t supervisor = getpid();
+    pid_t pid = fork();
+    if(pid < 0)
+        return -1;
+    if(pid == 0)
+        prefork_worker(workers, id, supervisor);
+    workers[id].mPid = pid;
+    workers[id].mStarted = Clock::now();
+    PD_LOG_INFO("Worker %u started, pid %d", id, pid);
+    return 0;
+}
+
+// Prefork, a supervisor process forks thread_count long-lived workers (one
+// per core by default), each running an event loop on its own SO_REUSEPORT
+// listener. Workers that exit are restarted; a crashing worker takes down
+// only its own connections.
+void server_prefork(){
+    unsigned ncpu = std::max(1u, std::thread::hardware_concurrency());
+    unsigned n = thread_count ? thread_count : ncpu;
+
+    std::vector<PreforkWorker> workers(n);
+    for(unsigned i = 0; i < n; i++){
+        if(workers[i].mListener.listen(SocketAddress("", SERVER_PORT), true, listen_backlog) < 0){
+            PD_LOG_ERROR("Bind to port %d failed: %s", SERVER_PORT, std::strerror(errno));
+            return;
+        }
+        server_tune(workers[i].mListener, pin_workers ? static_cast<int>(i % ncpu) : -1);
+    }
+
+    struct sigaction sa{};
+    sa.sa_handler = prefork_signal;     // no SA_RESTART, so waitpid() is interrupted
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGINT, &sa, nullptr);
+
+    PD_LOG_INFO("Starting %u workers on port %d", n, SERVER_PORT);
+    for(unsigned i = 0; i < n; i++){
+        if(prefork_spawn(workers, i) < 0)
+            PD_LOG_ERROR("Fork error: %s", std::strerror(errno));
+    }
+
+    while(!prefork_stop){
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if(pid < 0){
+            if(errno == ECHILD){
+                // Every fork failed, try again later
+                std::this_thread::sleep_for(std::chrono::milliseconds(PREFORK_RESTART_MAX_MS));
+            }else if(errno != EINTR){
+                PD_LOG_ERROR("Wait failed: %s", std::strerror(errno));
+            }
+        }
+        for(unsigned i = 0; i < n && !prefork_stop; i++){
+            PreforkWorker &w = workers[i];
+            if(w.mPid == pid && pid > 0){
+                w.mPid = -1;
+                if(WIFSIGNALED(status))
+                    PD_LOG_WARN("Worker %u killed by signal %d", i, WTERMSIG(status));
+                else
+                    PD_LOG_WARN("Worker %u exited with status %d", i, WEXITSTATUS(status));
+                auto lived = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - w.mStarted);
+                if(lived.count() >= PREFORK_STABLE_MS)
+                    w.mRestartMs = 0;
+                else
+                    w.mRestartMs = std::min(std::max(w.mRestartMs * 2, PREFORK_RESTART_MIN_MS),
+                                            PREFORK_RESTART_MAX_MS);
+                if(w.mRestartMs > 0){
+                    PD_LOG_WARN("Worker %u restarting in %d ms", i, w.mRestartMs);
+                    std::this_thread::sleep_for(std::chrono::milliseconds(w.mRestartMs));
+                }
+            }
+            if(w.mPid < 0 && !prefork_stop && prefork_spawn(workers, i) < 0)
+                PD_LOG_ERROR("Fork error: %s", std::strerror(errno));
+        }
+    }
+
+    PD_LOG_INFO("Stopping workers");
+    for(PreforkWorker &w : workers)
+        if(w.mPid > 0)
+            kill(w.mPid, SIGTERM);
+    for(PreforkWorker &w : workers)
+        if(w.mPid > 0)
+            waitpid(w.mPid, nullptr, 0);
+}
+
+
+// Completions tell their operation by the low bits of user_data, the rest
+// is the UringConnection, null for the listener
+enum UringOp : uint64_t {
+    URING_ACCEPT,
+    URING_RECV,
+    URING_SEND,
+    URING_POLL,
+    URING_SHUTDOWN,
+    URING_CLOSE,
+    URING_UPSTREAM,     // poll of the upstream a proxied request waits for
+    URING_CANCEL,       // removal of that poll
+    URING_OP_MASK = 7
+};
+
+// UringLoop - State of one io_uring server loop
+struct UringLoop {
+    UringLoop(IoUring &ring, BufferRing &bufs, TimerWheel &wheel, int listenFd)
+            : mRing(ring), mBufs(bufs), mWheel(wheel), mListenFd(listenFd),
+              mAcceptRetry(retryAccept, this) {}
+
+    static void retryAccept(Timer &timer, void *arg);
+
+    IoUring &mRing;
+    BufferRing &mBufs;
+    TimerWheel &mWheel;
+    int mListenFd;
+    bool mMultishotRecv = true;     // cleared on kernels before 6.0
+    int mAcceptBackoffMs = 0;
+    Timer mAcceptRetry;
+};
+
+// UringConnection - Per-connection state of the io_uring loop
+// A receive stays armed for the whole connection, taking buffers from the
+// loop's BufferRing as data arrives. Responses go out with one sendmsg each;
+// the last one of the connection has the shutdown and close linked behind
+// it. Closing shuts the socket down so that whatever is in flight completes,
+// the connection is freed once nothing is. A proxied request waiting for its
+// upstream polls the upstream socket, a poll that is not cancelled that way.
+struct UringConnection {
+    UringConnection(int fd, UringLoop &loop)
+            : mConn(SocketChannel(Socket::adopt(fd, false)), server_config), mLoop(loop),
+              mDeadline(loop.mWheel, expired, this), mFd(fd) {}
+
+    static void expired(Timer &timer, void *arg);
+
+    HttpConnection mConn;
+    UringLoop &mLoop;
+    ConnectionTimer mDeadline;
+    int mFd;
+    unsigned mInflight = 0;     // operations submitted and not completed
+    unsigned mClosesQueued = 0; // linked closes in flight
+    bool mReceiving = false;
+    bool mSending = false;      // a sendmsg or POLLOUT, or upstream poll in flight
+    bool mUpstreamPolled = false;
+    bool mUpstreamExpired = false;  // the upstream poll was cancelled on timeout
+    bool mPeerClosed = false;
+    bool mClosing = false;
+    bool mFdClosed = false;     // closed by a linked close
+    std::string mBacklog;       // received bytes mConn had no room for yet
+    iovec mIov[3];
+    msghdr mMsg;
+};
+
+static uint64_t uring_data(void *ptr, UringOp op){
+    return reinterpret_cast<uint64_t>(ptr) | op;
+}
+
+// Free conn once it is closing and nothing is in flight anymore
+static void uring_release(UringConnection *conn){
+    if(!conn->mClosing || conn->mInflight > 0)
+        return;
+    if(conn->mFdClosed)
+        conn->mConn.channel().release();
+    conn->mConn.close();
+    delete conn;
+}
+
+// Cancel the poll of the upstream in flight
+static void uring_cancel_upstream(UringConnection *conn){
+    IoUring &ring = conn->mLoop.mRing;
+    io_uring_sqe *sqe = ring.getSqe();
+    if(sqe == nullptr){
+        ring.submit();
+        if((sqe = ring.getSqe()) == nullptr)
+            return;
+    }
+    IoUring::prepPollRemove(sqe, uring_data(conn, URING_UPSTREAM));
+    sqe->user_data = uring_data(conn, URING_CANCEL);
+    conn->mInflight++;
+}
+
+// Shut conn down so that its operations complete, it is freed by
+// uring_release() once they did
+static void uring_close(UringConnection *conn){
+    if(conn->mClosing)
+        return;
+    conn->mClosing = true;
+    conn->mDeadline.cancel();
+    if(conn->mUpstreamPolled && !conn->mUpstreamExpired)
+        uring_cancel_upstream(conn);
+    // A queued close may have released the number to a new connection
+    // already, its completion shuts down instead if it gets cancelled
+    if(conn->mClosesQueued == 0 && !conn->mFdClosed)
+        ::shutdown(conn->mFd, SHUT_RDWR);
+}
+
+// Close the connection, or fail the upstream attempt it waits for
+void UringConnection::expired(Timer &, void *arg){
+    auto *conn = static_cast<UringConnection*>(arg);
+    if(conn->mDeadline.mPhase == ConnectionTimer::UPSTREAM && conn->mUpstreamPolled){
+        conn->mUpstreamExpired = true;
+        uring_cancel_upstream(conn);
+        return;
+    }
+    uring_close(conn);
+    uring_release(conn);
+}
+
+static void uring_accept(UringLoop &loop){
+    io_uring_sqe *sqe = loop.mRing.getSqe();
+    if(sqe == nullptr){
+        loop.mWheel.schedule(loop.mAcceptRetry, ACCEPT_BACKOFF_MIN_MS);
+        return;
+    }
+    IoUring::prepAccept(sqe, loop.mListenFd, SOCK_NONBLOCK | SOCK_CLOEXEC, true);
+    sqe->user_data = uring_data(nullptr, URING_ACCEPT);
+}
+
+void UringLoop::retryAccept(Timer &, void *arg){
+    uring_accept(*static_cast<UringLoop*>(arg));
+}
+
+static void uring_recv(UringConnection *conn){
+    io_uring_sqe *sqe = conn->mLoop.mRing.getSqe();
+    if(sqe == nullptr){
+        uring_close(conn);
+        return;
+    }
+    IoUring::prepRecv(sqe, conn->mFd, conn->mLoop.mBufs.groupId(), conn->mLoop.mMultishotRecv);
+    sqe->user_data = uring_data(conn, URING_RECV);
+    conn->mReceiving = true;
+    conn->mInflight++;
+}
+
+// Send iovcnt iovecs of conn->mIov, then shut down and close if it is the
+// last response, as one linked chain
+static void uring_send(UringConnection *conn, int iovcnt){
+    IoUring &ring = conn->mLoop.mRing;
+    bool last = conn->mConn.isLastResponse();
+    // A chain must not be split across submissions
+    if(last && ring.spaceLeft() < 3)
+        ring.submit();
+    io_uring_sqe *sqe = ring.getSqe();
+    if(sqe == nullptr){
+        uring_close(conn);
+        return;
+    }
+    std::memset(&conn->mMsg, 0, sizeof(conn->mMsg));
+    conn->mMsg.msg_iov = conn->mIov;
+    conn->mMsg.msg_iovlen = iovcnt;
+    // MSG_WAITALL makes a short send fail the chain instead of closing early
+    IoUring::prepSendmsg(sqe, conn->mFd, &conn->mMsg, MSG_NOSIGNAL | (last ? MSG_WAITALL : 0));
+    sqe->user_data = uring_data(conn, URING_SEND);
+    conn->mSending = true;
+    conn->mInflight++;
+    conn->mDeadline.arm(ConnectionTimer::WRITE);
+    if(!last)
+        return;
+
+    sqe->flags |= IOSQE_IO_LINK;
+    sqe = ring.getSqe();
+    IoUring::prepShutdown(sqe, conn->mFd, SHUT_RDWR);
+    sqe->flags |= IOSQE_IO_LINK;
+    sqe->user_data = uring_data(conn, URING_SHUTDOWN);
+    sqe = ring.getSqe();
+    IoUring::prepClose(sqe, conn->mFd);
+    sqe->user_data = uring_data(conn, URING_CLOSE);
+    conn->mInflight += 2;
+    conn->mClosesQueued++;
+}
+
+// Wait for room in the socket buffer, a static file body is left
+static void uring_poll_out(UringConnection *conn){
+    io_uring_sqe *sqe = conn->mLoop.mRing.getSqe();
+    if(sqe == nullptr){
+        uring_close(conn);
+        return;
+    }
+    IoUring::prepPoll(sqe, conn->mFd, POLLOUT);
+    sqe->user_data = uring_data(conn, URING_POLL);
+    conn->mSending = true;
+    conn->mInflight++;
+    conn->mDeadline.arm(ConnectionTimer::WRITE);
+}
+
+// Wait for the upstream of a proxied request to be ready for action
+static void uring_poll_upstream(UringConnection *conn, HttpConnection::Action action){
+    io_uring_sqe *sqe = conn->mLoop.mRing.getSqe();
+    if(sqe == nullptr){
+        uring_close(conn);
+        return;
+    }
+    IoUring::prepPoll(sqe, conn->mConn.upstream()->getFd(),
+                      action == HttpConnection::WANT_UPSTREAM_READ ? POLLIN : POLLOUT);
+    sqe->user_data = uring_data(conn, URING_UPSTREAM);
+    conn->mSending = true;
+    conn->mUpstreamPolled = true;
+    conn->mInflight++;
+    conn->mDeadline.armUpstream(conn->mConn.upstreamTimeoutMs());
+}
+
+// Answer what conn received so far, unless a send is in flight already
+static void uring_pump(UringConnection *conn){
+    while(!conn->mClosing && !conn->mSending){
+        if(conn->mConn.isSendingFile()){
+            // sendfile() on the non-blocking socket until it is full
+            HttpConnection::Action action = conn->mConn.sent(0);
+            if(action == HttpConnection::CLOSE)
+                uring_close(conn);
+            else if(action == HttpConnection::WANT_WRITE)
+                uring_poll_out(conn);
+            else if(action != HttpConnection::WANT_READ)
+                uring_poll_upstream(conn, action);
+            continue;
+        }
+        int iovcnt = conn->mConn.pending(conn->mIov, 3);
+        if(iovcnt > 0){
+            uring_send(conn, iovcnt);
+            return;
+        }
+        // A proxied response has nothing in front of it to send first
+        if(conn->mConn.isSendingFile())
+            continue;
+        if(conn->mBacklog.empty())
+            break;
+        size_t n = conn->mConn.receive(conn->mBacklog.data(), conn->mBacklog.size());
+        if(n == 0){
+            // mConn answered all it could and has no room, can not happen
+            uring_close(conn);
+            return;
+        }
+        conn->mBacklog.erase(0, n);
+    }
+    if(conn->mClosing || conn->mSending)
+        return;
+    if(conn->mPeerClosed){
+        uring_close(conn);
+        return;
+    }
+    conn->mDeadline.arm(conn->mConn.readingHead() ? ConnectionTimer::HEAD : ConnectionTimer::IDLE);
+}
+
+static void uring_on_accept(UringLoop &loop, const io_uring_cqe &cqe){
+    if(cqe.res >= 0){
+        auto *conn = new UringConnection(cqe.res, loop);
+        // Accepted by the kernel, not by Socket::accept() which would set it
+        if(socket_options.quickAck > 0){
+            SocketOptions accepted;
+            accepted.quickAck = 1;
+            conn->mConn.channel().setOptions(accepted);
+        }
+        uring_recv(conn);
+        // Nothing received yet, the client owes a request head
+        conn->mDeadline.arm(ConnectionTimer::HEAD);
+        uring_release(conn);
+        loop.mAcceptBackoffMs = 0;
+    }else if(cqe.res == -EMFILE || cqe.res == -ENFILE || cqe.res == -ENOBUFS || cqe.res == -ENOMEM){
+        loop.mAcceptBackoffMs = std::min(std::max(loop.mAcceptBackoffMs * 2, ACCEPT_BACKOFF_MIN_MS),
+                                         ACCEPT_BACKOFF_MAX_MS);
+    }
+    if(cqe.flags & IORING_CQE_F_MORE)
+        return;
+    // The multishot accept ended, out of descriptors it waits for a while
+    if(loop.mAcceptBackoffMs > 0)
+        loop.mWheel.schedule(loop.mAcceptRetry, loop.mAcceptBackoffMs);
+    else
+        uring_accept(loop);
+}
+
+static void uring_on_recv(UringConnection *conn, const io_uring_cqe &cqe){
+    UringLoop &loop = conn->mLoop;
+    if(!(cqe.flags & IORING_CQE_F_MORE)){
+        conn->mReceiving = false;
+        conn->mInflight--;
+    }
+    if(cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER)){
+        auto bid = static_cast<unsigned short>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        const char *data = loop.mBufs.buffer(bid);
+        size_t length = cqe.res;
+        if(!conn->mClosing){
+            // Bytes held back go first, mConn takes more once it answered
+            size_t n = conn->mBacklog.empty() ? conn->mConn.receive(data, length) : 0;
+            conn->mBacklog.append(data + n, length - n);
+        }
+        loop.mBufs.recycle(bid);
+        if(conn->mBacklog.size() > URING_BACKLOG_MAX)
+            uring_close(conn);
+        uring_pump(conn);
+    }else if(cqe.res == -EINVAL && loop.mMultishotRecv){
+        // Multishot receive came with 6.0, receive once per submission
+        loop.mMultishotRecv = false;
+    }else if(cqe.res == 0){
+        // Nobody is left to take a response still waiting for its upstream
+        conn->mPeerClosed = true;
+        if(!conn->mSending || conn->mUpstreamPolled)
+            uring_close(conn);
+    }else if(cqe.res != -ENOBUFS){
+        uring_close(conn);
+    }
+    // Out of buffers (ENOBUFS) ends a multishot receive too, rearm
+    if(!conn->mReceiving && !conn->mClosing && !conn->mPeerClosed)
+        uring_recv(conn);
+}
+
+static void uring_complete(UringLoop &loop, const io_uring_cqe &cqe){
+    auto op = static_cast<UringOp>(cqe.user_data & URING_OP_MASK);
+    auto *conn = reinterpret_cast<UringConnection*>(cqe.user_data & ~static_cast<uint64_t>(URING_OP_MASK));
+    switch(op){
+    case URING_ACCEPT:
+        uring_on_accept(loop, cqe);
+        return;
+    case URING_RECV:
+        uring_on_recv(conn, cqe);
+        break;
+    case URING_SEND:
+        conn->mInflight--;
+        conn->mSending = false;
+        if(conn->mClosing)
+            break;
+        if(cqe.res < 0 || conn->mConn.sent(cqe.res) == HttpConnection::CLOSE)
+            uring_close(conn);
+        else
+            uring_pump(conn);
+        break;
+    case URING_POLL:
+        conn->mInflight--;
+        conn->mSending = false;
+        if(conn->mClosing)
+            break;
+        if(cqe.res < 0 || (cqe.res & (POLLERR | POLLHUP)))
+            uring_close(conn);
+        else
+            uring_pump(conn);
+        break;
+    case URING_UPSTREAM:
+        conn->mInflight--;
+        conn->mSending = false;
+        conn->mUpstreamPolled = false;
+        if(conn->mUpstreamExpired){
+            conn->mUpstreamExpired = false;
+            conn->mConn.expireUpstream();
+        }
+        if(!conn->mClosing)
+            uring_pump(conn);
+        break;
+    case URING_SHUTDOWN:
+    case URING_CANCEL:
+        conn->mInflight--;
+        break;
+    case URING_CLOSE:
+        conn->mInflight--;
+        conn->mClosesQueued--;
+        if(cqe.res >= 0)
+            conn->mFdClosed = true;
+        else if(conn->mClosing && conn->mClosesQueued == 0 && !conn->mFdClosed)
+            ::shutdown(conn->mFd, SHUT_RDWR);  // the chain was cut, still ours
+        break;
+    default:
+        return;
+    }
+    uring_release(conn);
+}
+
+// Run an io_uring loop on listening channel sockchan, never return
+// Submitting and reaping is one system call per iteration.
+static void uring_run(SocketChannel &sockchan){
+    IoUring ring;
+    if(ring.init(URING_ENTRIES) < 0){
+        PD_LOG_ERROR("io_uring setup failed: %s", std::strerror(errno));
+        return;
+    }
+    BufferRing bufs(ring, 0, URING_BUFFERS, URING_BUFFER_SIZE);
+    if(!bufs.isOpen()){
+        PD_LOG_ERROR("io_uring buffer ring setup failed: %s", std::strerror(errno));
+        return;
+    }
+    TimerWheel wheel(EVENTLOOP_TICK_MS);
+    UringLoop loop(ring, bufs, wheel, sockchan.getFd());
+    uring_accept(loop);
+
+    while(1){
+        if(ring.submitAndWait(1, wheel.nextTimeoutMs()) < 0 && errno != ETIME && errno != EINTR)
+            PD_LOG_ERROR("io_uring wait failed: %s", std::strerror(errno));
+        ring.forEachCqe([&](const io_uring_cqe &cqe){
+            uring_complete(loop, cqe);
+        });
+        wheel.advance(Clock::now());
+    }
+}
+
+// One io_uring loop per core like server_multireactor, which it falls back
+// to where io_uring is not available
+void server_uring(){
+    if(!IoUring::isSupported()){
+        PD_LOG_WARN("io_uring not available, falling back to multireactor");
+        server_multireactor();
+        return;
+    }
+    reactors_start(uring_run);
+}
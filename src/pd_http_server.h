@@ -1,5 +1,18 @@
 #ifndef PD_HTTP_SERVER_H
 #define PD_HTTP_SERVER_H
 
+// Resolution of the event loop connection timeouts
+#define EVENTLOOP_TICK_MS 10
+
+// A prefork worker dying sooner than PREFORK_STABLE_MS after it started is
+// restarted after a delay, doubled on every such crash up to the maximum
+#define PREFORK_STABLE_MS 1000
+#define PREFORK_RESTART_MIN_MS 100
+#define PREFORK_RESTART_MAX_MS 5000
+
+// Received bytes an io_uring connection holds while its responses are going
+// out, a client pipelining beyond that is dropped
+#define URING_BACKLOG_MAX (64 << 10)
+
 
 #endif //PD_HTTP_SERVER_H
\ No newline at end of file
@@ -0,0 +1,510 @@
+#include "pd_log.h"
+
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace pardus {
+namespace log {
+
+std::atomic<int> gLevel{LEVEL_INFO};
+std::atomic<bool> gAccess{false};
+std::atomic<bool> gSynchronous{false};
+
+namespace {
+
+const char *LEVEL_NAMES[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+// ThreadLog - Ring of records from one thread to the flusher
+// Single producer, single consumer: the owner thread moves mHead, the
+// flusher moves mTail. Both sit on their own cache line.
+struct ThreadLog {
+    std::atomic<uint64_t> mHead{0};
+    char mPad1[64 - sizeof(std::atomic<uint64_t>)];
+    std::atomic<uint64_t> mTail{0};
+    char mPad2[64 - sizeof(std::atomic<uint64_t>)];
+    uint64_t mCachedTail = 0;       // producer's last look at mTail
+    std::atomic<uint64_t> mDropped{0};
+    std::atomic<bool> mRetired{false};  // the thread exited, free once drained
+    uint32_t mId = 0;
+    ThreadLog *mNext = nullptr;
+    Byte mSlots[LOG_RING_SLOTS][LOG_RECORD_SIZE];
+};
+
+// Line formatted by the flusher, ordered by time before it is written
+struct Entry {
+    uint64_t timeNs;
+    uint8_t sink;
+    std::string line;
+};
+
+// Logger - Rings of all threads, the sinks and the flusher thread
+struct Logger {
+    std::mutex mMutex;              // mThreads, mFds, mFlusher
+    std::mutex mDrainMutex;         // one consumer at a time
+    ThreadLog *mThreads = nullptr;
+    uint32_t mNextId = 0;
+    int mFds[SINK_COUNT] = {STDERR_FILENO, -1};
+    uint64_t mDroppedFreed = 0;     // by rings already freed
+    uint64_t mDroppedReported = 0;
+    uint64_t mReportedNs = 0;       // when drops were last reported
+    std::thread *mFlusher = nullptr;    // leaked in a forked child, see afterForkChild()
+    std::atomic<bool> mRestart{false};  // start a flusher on the next record, in a child
+    bool mHooked = false;           // shutdown() and the fork handlers are registered
+    std::mutex mWakeMutex;
+    std::condition_variable mWake;
+    std::atomic<bool> mKick{false};     // a ring is half full, drain now
+    bool mStop = false;
+};
+
+// Never destroyed, threads may still log while the process exits
+Logger &logger() {
+    static Logger *l = new Logger;
+    return *l;
+}
+
+thread_local ThreadLog *tRing = nullptr;
+thread_local bool tRingGone = false;    // retired, later records are written directly
+thread_local Byte tDirect[LOG_RECORD_SIZE];     // a record written directly
+thread_local bool tDirectPending = false;       // beginRecord() handed out tDirect
+
+// Retires the ring of a thread when it exits
+// Destructors of other thread_local objects may still log after this one
+// ran; tRing and tRingGone have no destructor and stay usable for them.
+struct RingOwner {
+    ~RingOwner() {
+        if (tRing)
+            tRing->mRetired.store(true, std::memory_order_release);
+        tRing = nullptr;
+        tRingGone = true;
+    }
+};
+
+thread_local RingOwner tOwner;
+
+void writeAll(int fd, const std::string &buf) {
+    size_t off = 0;
+    while (off < buf.size()) {
+        ssize_t n = ::write(fd, buf.data() + off, buf.size() - off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        off += n;
+    }
+}
+
+uint64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Start of a server log line, e.g. "2026-10-17 10:00:00.123456 INFO  [3] "
+void serverPrefix(uint64_t timeNs, int level, const char *thread, std::string &out) {
+    time_t secs = static_cast<time_t>(timeNs / 1000000000);
+    tm t;
+    gmtime_r(&secs, &t);
+    char buf[64];
+    size_t n = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &t);
+    n += std::snprintf(buf + n, sizeof(buf) - n, ".%06u %-5s [%s] ",
+                       static_cast<unsigned>(timeNs / 1000 % 1000000),
+                       LEVEL_NAMES[std::min<int>(level, LEVEL_ERROR)], thread);
+    out.append(buf, std::min(n, sizeof(buf) - 1));
+}
+
+// Line of the record at rec, ending in a newline
+void formatRecord(const Byte *rec, Entry &e) {
+    const auto *h = reinterpret_cast<const RecordHeader*>(rec);
+    e.timeNs = h->timeNs;
+    e.sink = h->sink;
+    if (h->sink == SINK_SERVER) {
+        char thread[16];
+        std::snprintf(thread, sizeof(thread), "%u", h->thread);
+        serverPrefix(h->timeNs, h->level, thread, e.line);
+    }
+    h->format(h->fmt, rec + sizeof(RecordHeader), e.line);
+    e.line += '\n';
+}
+
+// Format everything queued so far and write it out, in time order
+// The records are copied out of the rings under mMutex and formatted
+// after it is released, so threads attaching meanwhile do not wait for it.
+void drain(Logger &l) {
+    std::lock_guard<std::mutex> drainLck(l.mDrainMutex);
+    static std::vector<Byte> records;   // guarded by mDrainMutex, kept for reuse
+    std::vector<Entry> entries;
+    int fds[SINK_COUNT];
+    uint64_t dropped;
+    records.clear();
+    {
+        std::lock_guard<std::mutex> lck(l.mMutex);
+        std::copy(l.mFds, l.mFds + SINK_COUNT, fds);
+        dropped = l.mDroppedFreed;
+        ThreadLog **link = &l.mThreads;
+        while (ThreadLog *r = *link) {
+            bool retired = r->mRetired.load(std::memory_order_acquire);
+            uint64_t tail = r->mTail.load(std::memory_order_relaxed);
+            uint64_t head = r->mHead.load(std::memory_order_acquire);
+            for (; tail != head; tail++) {
+                const Byte *rec = r->mSlots[tail & (LOG_RING_SLOTS - 1)];
+                records.insert(records.end(), rec, rec + LOG_RECORD_SIZE);
+            }
+            r->mTail.store(tail, std::memory_order_release);
+            dropped += r->mDropped.load(std::memory_order_relaxed);
+            if (retired) {
+                *link = r->mNext;
+                l.mDroppedFreed += r->mDropped.load(std::memory_order_relaxed);
+                delete r;
+            } else {
+                link = &r->mNext;
+            }
+        }
+        // At most once a second, so that the report does not add to the load
+        uint64_t now = nowNs();
+        if (dropped > l.mDroppedReported && now - l.mReportedNs >= LOG_DROP_REPORT_MS * 1000000ull) {
+            Entry e{now, SINK_SERVER, std::string()};
+            serverPrefix(now, LEVEL_WARN, "log", e.line);
+            char buf[96];
+            std::snprintf(buf, sizeof(buf), "%llu records dropped, the flusher fell behind\n",
+                          static_cast<unsigned long long>(dropped - l.mDroppedReported));
+            e.line += buf;
+            entries.push_back(std::move(e));
+            l.mDroppedReported = dropped;
+            l.mReportedNs = now;
+        }
+    }
+    for (size_t off = 0; off < records.size(); off += LOG_RECORD_SIZE) {
+        entries.push_back(Entry{0, 0, std::string()});
+        formatRecord(&records[off], entries.back());
+    }
+    if (entries.empty())
+        return;
+
+    std::stable_sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.timeNs < b.timeNs;
+    });
+    std::string out[SINK_COUNT];
+    for (const Entry &e : entries)
+        out[e.sink] += e.line;
+    for (int s = 0; s < SINK_COUNT; s++) {
+        if (fds[s] >= 0 && !out[s].empty())
+            writeAll(fds[s], out[s]);
+    }
+}
+
+void flusherRun(Logger *l) {
+    for (;;) {
+        bool stop;
+        {
+            std::unique_lock<std::mutex> lck(l->mWakeMutex);
+            l->mWake.wait_for(lck, std::chrono::milliseconds(LOG_FLUSH_MS),
+                              [l] { return l->mStop || l->mKick.exchange(false); });
+            stop = l->mStop;
+        }
+        drain(*l);
+        if (stop)
+            return;
+    }
+}
+
+// Stop the flusher and write out what is left, at exit
+void shutdown() {
+    Logger &l = logger();
+    std::thread *flusher;
+    {
+        std::lock_guard<std::mutex> lck(l.mMutex);
+        flusher = l.mFlusher;
+        l.mFlusher = nullptr;
+    }
+    if (flusher) {
+        {
+            std::lock_guard<std::mutex> lck(l.mWakeMutex);
+            l.mStop = true;
+        }
+        l.mWake.notify_one();
+        flusher->join();
+        delete flusher;
+    }
+    drain(l);
+}
+
+// mWakeMutex too, or a fork while the flusher checks its wait condition
+// leaves it locked in the child, where the next flusher blocks on it forever
+void beforeFork() {
+    Logger &l = logger();
+    l.mDrainMutex.lock();
+    l.mMutex.lock();
+    l.mWakeMutex.lock();
+}
+
+void afterForkParent() {
+    Logger &l = logger();
+    l.mWakeMutex.unlock();
+    l.mMutex.unlock();
+    l.mDrainMutex.unlock();
+}
+
+// Only the forking thread lives on in the child. Whatever the rings hold is
+// written by the parent, so the child drops it and retires the rings of the
+// threads it did not inherit. Its own flusher is only started once it logs,
+// as many children never do, or log synchronously, see setSynchronous().
+void afterForkChild() {
+    Logger &l = logger();
+    for (ThreadLog *r = l.mThreads; r; r = r->mNext) {
+        r->mTail.store(r->mHead.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        r->mCachedTail = r->mHead.load(std::memory_order_relaxed);
+        if (r != tRing)
+            r->mRetired.store(true, std::memory_order_relaxed);
+    }
+    if (l.mFlusher) {
+        // The thread is gone in the child; the object cannot be destroyed
+        l.mFlusher = nullptr;
+        l.mRestart.store(true, std::memory_order_relaxed);
+    }
+    // The condition may still count the parent's flusher as a waiter, which
+    // would make destroying it block; it holds nothing, so it is made anew
+    // in place
+    new (&l.mWake) std::condition_variable();
+    l.mWakeMutex.unlock();
+    l.mMutex.unlock();
+    l.mDrainMutex.unlock();
+}
+
+// Start the flusher unless it runs or the logger is shutting down
+// Call with mMutex held.
+void startFlusher(Logger &l) {
+    if (l.mFlusher != nullptr || l.mStop)
+        return;
+    l.mFlusher = new std::thread(flusherRun, &l);
+    l.mRestart.store(false, std::memory_order_relaxed);
+}
+
+// Create the ring of the calling thread, and the flusher with the first one
+ThreadLog *attach() {
+    Logger &l = logger();
+    auto *r = new ThreadLog;
+    std::lock_guard<std::mutex> lck(l.mMutex);
+    r->mId = l.mNextId++;
+    r->mNext = l.mThreads;
+    l.mThreads = r;
+    if (!l.mHooked) {
+        l.mHooked = true;
+        std::atexit(shutdown);
+        pthread_atfork(beforeFork, afterForkParent, afterForkChild);
+    }
+    startFlusher(l);
+    tRing = r;
+    (void)&tOwner;  // constructs it, so that the ring is retired on exit
+    return r;
+}
+
+// Format the record in tDirect and write it out right away, for threads
+// whose ring is retired and in synchronous mode
+void writeDirect() {
+    Entry e{0, 0, std::string()};
+    formatRecord(tDirect, e);
+    Logger &l = logger();
+    int fd;
+    {
+        std::lock_guard<std::mutex> lck(l.mMutex);
+        fd = l.mFds[e.sink];
+    }
+    if (fd >= 0)
+        writeAll(fd, e.line);
+}
+
+int openSink(Sink sink, const char *path) {
+    int fd = std::strcmp(path, "-") == 0 ? STDOUT_FILENO
+           : ::open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+    Logger &l = logger();
+    std::lock_guard<std::mutex> lck(l.mMutex);
+    int old = l.mFds[sink];
+    l.mFds[sink] = fd;
+    if (old > STDERR_FILENO)
+        ::close(old);
+    return 0;
+}
+
+} // namespace
+
+
+/***************************
+* Record encoding
+**************************/
+namespace detail {
+
+int formatLine(char *line, size_t size, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = std::vsnprintf(line, size, fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+TextBuffer Arg<nio::SocketAddress>::decode(const Byte *&p) {
+    nio::SocketAddress addr;
+    std::memcpy(static_cast<void*>(&addr), p, sizeof(addr));
+    p += sizeof(addr);
+    TextBuffer t;
+    if (addr.getFamily() == AF_UNSPEC)
+        std::strcpy(t.text, "-");
+    else
+        addr.format(t.text, sizeof(t.text));
+    return t;
+}
+
+Byte *Arg<ClfTime>::encode(Byte *p, size_t, ClfTime) {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t secs = ts.tv_sec;
+    std::memcpy(p, &secs, sizeof(secs));
+    return p + sizeof(secs);
+}
+
+TextBuffer Arg<ClfTime>::decode(const Byte *&p) {
+    uint64_t secs;
+    std::memcpy(&secs, p, sizeof(secs));
+    p += sizeof(secs);
+    time_t t = static_cast<time_t>(secs);
+    tm tm;
+    gmtime_r(&t, &tm);
+    TextBuffer buf;
+    strftime(buf.text, sizeof(buf.text), "%d/%b/%Y:%H:%M:%S +0000", &tm);
+    return buf;
+}
+
+} // namespace detail
+
+
+/***************************
+* Logging
+**************************/
+// Slot for the next record of the calling thread, its header time and
+// thread stamped; fill in the rest and commitRecord()
+// Without a ring to queue it in, once the thread retired it or when logging
+// synchronously, the record is written out by commitRecord() itself.
+//    Return nullptr when the ring is full, the record is dropped and counted
+Byte *beginRecord() {
+    ThreadLog *r = tRing;
+    if (tRingGone || gSynchronous.load(std::memory_order_relaxed)) {
+        auto *h = reinterpret_cast<RecordHeader*>(tDirect);
+        h->timeNs = nowNs();
+        h->thread = r ? r->mId : 0;
+        tDirectPending = true;
+        return tDirect;
+    }
+    if (r == nullptr) {
+        r = attach();
+    } else if (logger().mRestart.load(std::memory_order_relaxed)) {
+        Logger &l = logger();
+        std::lock_guard<std::mutex> lck(l.mMutex);
+        startFlusher(l);
+    }
+    uint64_t head = r->mHead.load(std::memory_order_relaxed);
+    if (head - r->mCachedTail >= LOG_RING_SLOTS) {
+        r->mCachedTail = r->mTail.load(std::memory_order_acquire);
+        if (head - r->mCachedTail >= LOG_RING_SLOTS) {
+            r->mDropped.store(r->mDropped.load(std::memory_order_relaxed) + 1,
+                              std::memory_order_relaxed);
+            return nullptr;
+        }
+    }
+    if (head - r->mCachedTail == LOG_RING_SLOTS / 2) {
+        // Half full by our last look at the tail: wake the flusher rather
+        // than wait for its tick, once per pass
+        r->mCachedTail = r->mTail.load(std::memory_order_acquire);
+        if (head - r->mCachedTail == LOG_RING_SLOTS / 2) {
+            Logger &l = logger();
+            l.mKick.store(true, std::memory_order_relaxed);
+            l.mWake.notify_one();
+        }
+    }
+    Byte *rec = r->mSlots[head & (LOG_RING_SLOTS - 1)];
+    auto *h = reinterpret_cast<RecordHeader*>(rec);
+    h->timeNs = nowNs();
+    h->thread = r->mId;
+    return rec;
+}
+
+// Hand the record of beginRecord() to the flusher
+void commitRecord() {
+    if (tDirectPending) {
+        tDirectPending = false;
+        writeDirect();
+        return;
+    }
+    ThreadLog *r = tRing;
+    r->mHead.store(r->mHead.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// Level named name, case sensitive: debug, info, warn, error or off
+//    Return false if there is no such level
+bool parseLevel(const char *name, Level &level) {
+    const char *names[] = {"debug", "info", "warn", "error", "off"};
+    for (int i = LEVEL_DEBUG; i <= LEVEL_OFF; i++) {
+        if (std::strcmp(name, names[i]) == 0) {
+            level = static_cast<Level>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void setLevel(Level level) {
+    gLevel.store(level, std::memory_order_relaxed);
+}
+
+// Send server messages to the file at path, "-" for stdout
+//    Return 0 on success
+//    On error, return -1 and sets errno
+int openServerLog(const char *path) {
+    return openSink(SINK_SERVER, path);
+}
+
+// Start writing the access log to the file at path, "-" for stdout
+//    Return 0 on success
+//    On error, return -1 and sets errno
+int openAccessLog(const char *path) {
+    if (openSink(SINK_ACCESS, path) < 0)
+        return -1;
+    gAccess.store(true, std::memory_order_relaxed);
+    return 0;
+}
+
+// Records dropped because a ring was full, since start
+uint64_t dropped() {
+    Logger &l = logger();
+    std::lock_guard<std::mutex> lck(l.mMutex);
+    uint64_t n = l.mDroppedFreed;
+    for (ThreadLog *r = l.mThreads; r; r = r->mNext)
+        n += r->mDropped.load(std::memory_order_relaxed);
+    return n;
+}
+
+// Write out everything logged so far, from the calling thread
+void flush() {
+    drain(logger());
+}
+
+// Write every record from the thread that logs it, without queuing, or
+// queue them for the flusher again. For processes serving a single
+// connection, e.g. the children of the multiprocess server, where a
+// flusher thread would cost more than it saves. Records queued before are
+// written by flush().
+void setSynchronous(bool on) {
+    gSynchronous.store(on, std::memory_order_relaxed);
+}
+
+} // namespace log
+} // namespace pardus
@@ -0,0 +1,333 @@
+#ifndef PD_LOG_H
+#define PD_LOG_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "pd_types.h"
+#include "pd_net.h"
+
+#define LOG_RING_SLOTS 512      // records buffered per thread, a power of two
+#define LOG_RECORD_SIZE 256     // bytes per record, string arguments are cut to fit
+#define LOG_FLUSH_MS 10         // how often the flusher drains the rings
+#define LOG_DROP_REPORT_MS 1000 // least time between warnings about dropped records
+
+// Log a printf style message if level is enabled; the arguments are not
+// evaluated otherwise. The format is checked against them at compile time.
+#define PD_LOG(level, ...) \
+    do { \
+        PD_LOG_CHECK(__VA_ARGS__); \
+        if (pardus::log::enabled(level)) \
+            pardus::log::write(level, pardus::log::SINK_SERVER, __VA_ARGS__); \
+    } while (0)
+#define PD_LOG_DEBUG(...) PD_LOG(pardus::log::LEVEL_DEBUG, __VA_ARGS__)
+#define PD_LOG_INFO(...) PD_LOG(pardus::log::LEVEL_INFO, __VA_ARGS__)
+#define PD_LOG_WARN(...) PD_LOG(pardus::log::LEVEL_WARN, __VA_ARGS__)
+#define PD_LOG_ERROR(...) PD_LOG(pardus::log::LEVEL_ERROR, __VA_ARGS__)
+
+// Log an access log line if the access log is open, see PD_LOG
+#define PD_LOG_ACCESS(...) \
+    do { \
+        PD_LOG_CHECK(__VA_ARGS__); \
+        if (pardus::log::accessEnabled()) \
+            pardus::log::access(__VA_ARGS__); \
+    } while (0)
+
+// Have the compiler check a format literal against up to 12 arguments, as
+// the flusher hands them to snprintf(); nothing is evaluated
+#define PD_LOG_CHECK(...) \
+    static_cast<void>(sizeof(pardus::log::detail::checkFormat( \
+        PD_LOG_CAT(PD_LOG_FMT_, PD_LOG_COUNT(__VA_ARGS__))(__VA_ARGS__))))
+#define PD_LOG_CAT(a, b) PD_LOG_CAT_(a, b)
+#define PD_LOG_CAT_(a, b) a##b
+#define PD_LOG_COUNT(...) PD_LOG_COUNT_(__VA_ARGS__, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define PD_LOG_COUNT_(a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, a11, a12, a13, n, ...) n
+#define PD_LOG_FMT_1(fmt) fmt
+#define PD_LOG_FMT_2(fmt, ...) fmt PD_LOG_MAP_1(__VA_ARGS__)
+#define PD_LOG_FMT_3(fmt, ...) fmt PD_LOG_MAP_2(__VA_ARGS__)
+#define PD_LOG_FMT_4(fmt, ...) fmt PD_LOG_MAP_3(__VA_ARGS__)
+#define PD_LOG_FMT_5(fmt, ...) fmt PD_LOG_MAP_4(__VA_ARGS__)
+#define PD_LOG_FMT_6(fmt, ...) fmt PD_LOG_MAP_5(__VA_ARGS__)
+#define PD_LOG_FMT_7(fmt, ...) fmt PD_LOG_MAP_6(__VA_ARGS__)
+#define PD_LOG_FMT_8(fmt, ...) fmt PD_LOG_MAP_7(__VA_ARGS__)
+#define PD_LOG_FMT_9(fmt, ...) fmt PD_LOG_MAP_8(__VA_ARGS__)
+#define PD_LOG_FMT_10(fmt, ...) fmt PD_LOG_MAP_9(__VA_ARGS__)
+#define PD_LOG_FMT_11(fmt, ...) fmt PD_LOG_MAP_10(__VA_ARGS__)
+#define PD_LOG_FMT_12(fmt, ...) fmt PD_LOG_MAP_11(__VA_ARGS__)
+#define PD_LOG_FMT_13(fmt, ...) fmt PD_LOG_MAP_12(__VA_ARGS__)
+#define PD_LOG_MAP_1(a) , pardus::log::detail::checkArg(a)
+#define PD_LOG_MAP_2(a, ...) PD_LOG_MAP_1(a) PD_LOG_MAP_1(__VA_ARGS__)
+#define PD_LOG_MAP_3(a, ...) PD_LOG_MAP_1(a) PD_LOG_MAP_2(__VA_ARGS__)
+#define PD_LOG_MAP_4(a, ...) PD_LOG_MAP_1(a) PD_LOG_MAP_3(__VA_ARGS__)
+#define PD_LOG_MAP_5(a, ...) PD_LOG_MAP_1(a) PD_LOG_MAP_4(__VA_ARGS__)
+#define PD_LOG_MAP_6(a, ...) PD_LOG_MAP_1(a) PD_LOG_MAP_5(__VA_ARGS__)
+#define PD_LOG_MAP_7(a, ...) PD_LOG_MAP_1(a) PD_LOG_MAP_6(__VA_ARGS__)
+#define PD_LOG_MAP_8(a, ...) PD_LOG_MAP_1(a) PD_LOG_MAP_7(__VA_ARGS__)
+#define PD_LOG_MAP_9(a, ...) PD_LOG_MAP_1(a) PD_LOG_MAP_8(__VA_ARGS__)
+#define PD_LOG_MAP_10(a, ...) PD_LOG_MAP_1(a) PD_LOG_MAP_9(__VA_ARGS__)
+#define PD_LOG_MAP_11(a, ...) PD_LOG_MAP_1(a) PD_LOG_MAP_10(__VA_ARGS__)
+#define PD_LOG_MAP_12(a, ...) PD_LOG_MAP_1(a) PD_LOG_MAP_11(__VA_ARGS__)
+
+namespace pardus {
+namespace log {
+
+enum Level {
+    LEVEL_DEBUG,
+    LEVEL_INFO,
+    LEVEL_WARN,
+    LEVEL_ERROR,
+    LEVEL_OFF
+};
+
+enum Sink {
+    SINK_SERVER,    // leveled messages, stderr unless openServerLog()
+    SINK_ACCESS,    // one line per request, only once openAccessLog()
+    SINK_COUNT
+};
+
+// Text - String argument given by pointer and length
+struct Text {
+    const char *data;
+    size_t length;
+};
+
+// ClfTime - Argument formatted as the time it was logged in the Common Log
+// Format, e.g. 17/Oct/2026:10:00:00 +0000
+struct ClfTime {
+};
+
+typedef void (*FormatFn)(const char *fmt, const Byte *args, std::string &out);
+
+// RecordHeader - Start of a record, the encoded arguments follow it
+struct RecordHeader {
+    uint64_t timeNs;        // CLOCK_REALTIME
+    const char *fmt;
+    FormatFn format;
+    uint32_t thread;
+    uint8_t level;
+    uint8_t sink;
+};
+
+extern std::atomic<int> gLevel;
+extern std::atomic<bool> gAccess;
+
+Byte *beginRecord();
+void commitRecord();
+
+bool parseLevel(const char *name, Level &level);
+void setLevel(Level level);
+int openServerLog(const char *path);
+int openAccessLog(const char *path);
+uint64_t dropped();
+void flush();
+void setSynchronous(bool on);
+
+inline bool enabled(Level level) {
+    return level >= gLevel.load(std::memory_order_relaxed);
+}
+
+inline bool accessEnabled() {
+    return gAccess.load(std::memory_order_relaxed);
+}
+
+namespace detail {
+
+// Compile time format checking, see PD_LOG_CHECK; declared only, as they
+// are only named in unevaluated operands
+int checkFormat(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+template <class T>
+typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value
+                        || std::is_pointer<T>::value, T>::type checkArg(T v);
+const char *checkArg(const std::string &s);
+const char *checkArg(const Text &t);
+const char *checkArg(const nio::SocketAddress &addr);
+const char *checkArg(ClfTime t);
+
+// snprintf() of a record, its format checked where it was logged
+int formatLine(char *line, size_t size, const char *fmt, ...) __attribute__((format(printf, 3, 0)));
+
+// Arg - How an argument of type T is stored in a record and handed back
+// to snprintf() by the flusher
+//    encode() writes at most fixedSize + extra bytes
+//    decode() returns an object that pass() turns into a printf argument
+template <class T, class Enable = void>
+struct Arg;
+
+template <class T>
+struct Arg<T, typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value>::type> {
+    static const size_t fixedSize = sizeof(T);
+    static Byte *encode(Byte *p, size_t, T v) {
+        std::memcpy(p, &v, sizeof(T));
+        return p + sizeof(T);
+    }
+    static T decode(const Byte *&p) {
+        T v;
+        std::memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        return v;
+    }
+    static T pass(T v) { return v; }
+};
+
+// Strings are copied, cut to the room left in the record
+struct StrArg {
+    static const size_t fixedSize = sizeof(uint16_t) + 1;
+    static Byte *encode(Byte *p, size_t extra, const char *s, size_t length) {
+        uint16_t n = static_cast<uint16_t>(std::min(length, std::min<size_t>(extra, UINT16_MAX)));
+        std::memcpy(p, &n, sizeof(n));
+        std::memcpy(p + sizeof(n), s, n);
+        p[sizeof(n) + n] = '\0';
+        return p + sizeof(n) + n + 1;
+    }
+    static const char *decode(const Byte *&p) {
+        uint16_t n;
+        std::memcpy(&n, p, sizeof(n));
+        const char *s = reinterpret_cast<const char*>(p + sizeof(n));
+        p += sizeof(n) + n + 1;
+        return s;
+    }
+    static const char *pass(const char *s) { return s; }
+};
+
+template <>
+struct Arg<const char*> : StrArg {
+    static Byte *encode(Byte *p, size_t extra, const char *s) {
+        if (s == nullptr)
+            s = "(null)";
+        return StrArg::encode(p, extra, s, std::strlen(s));
+    }
+};
+
+template <>
+struct Arg<char*> : Arg<const char*> {
+};
+
+template <>
+struct Arg<std::string> : StrArg {
+    static Byte *encode(Byte *p, size_t extra, const std::string &s) {
+        return StrArg::encode(p, extra, s.data(), s.size());
+    }
+};
+
+template <>
+struct Arg<Text> : StrArg {
+    static Byte *encode(Byte *p, size_t extra, const Text &t) {
+        return StrArg::encode(p, extra, t.data, t.length);
+    }
+};
+
+// Text made by the flusher out of a binary argument
+struct TextBuffer {
+    char text[64];
+};
+
+// Addresses go in binary, the text is only made by the flusher
+template <>
+struct Arg<nio::SocketAddress> {
+    static const size_t fixedSize = sizeof(nio::SocketAddress);
+    static Byte *encode(Byte *p, size_t, const nio::SocketAddress &addr) {
+        std::memcpy(static_cast<void*>(p), &addr, sizeof(addr));
+        return p + sizeof(addr);
+    }
+    static TextBuffer decode(const Byte *&p);
+    static const char *pass(const TextBuffer &a) { return a.text; }
+};
+
+template <>
+struct Arg<ClfTime> {
+    static const size_t fixedSize = sizeof(uint64_t);
+    static Byte *encode(Byte *p, size_t, ClfTime);
+    static TextBuffer decode(const Byte *&p);
+    static const char *pass(const TextBuffer &a) { return a.text; }
+};
+
+template <class T>
+using ArgOf = Arg<typename std::decay<T>::type>;
+
+inline size_t fixedSize() {
+    return 0;
+}
+
+template <class A, class... Rest>
+size_t fixedSize(const A &, const Rest &... rest) {
+    return ArgOf<A>::fixedSize + fixedSize(rest...);
+}
+
+// Encode args into [p, end), reserve being the fixed size of all of them
+inline void encode(Byte *, Byte *, size_t) {
+}
+
+template <class A, class... Rest>
+void encode(Byte *p, Byte *end, size_t reserve, const A &a, const Rest &... rest) {
+    size_t extra = static_cast<size_t>(end - p) - reserve;
+    p = ArgOf<A>::encode(p, extra, a);
+    encode(p, end, reserve - ArgOf<A>::fixedSize, rest...);
+}
+
+template <class... Args, size_t... I>
+void formatWith(const char *fmt, std::tuple<Args...> &decoded, std::string &out,
+                std::index_sequence<I...>) {
+    char line[1024];
+    int n = formatLine(line, sizeof(line), fmt, std::get<I>(decoded)...);
+    if (n > 0)
+        out.append(line, std::min(static_cast<size_t>(n), sizeof(line) - 1));
+}
+
+template <class... A>
+struct Formatter {
+    // Decode in argument order, a braced list guarantees it
+    static void format(const char *fmt, const Byte *args, std::string &out) {
+        std::tuple<decltype(ArgOf<A>::decode(args))...> decoded{ArgOf<A>::decode(args)...};
+        passAll(fmt, decoded, out, std::index_sequence_for<A...>());
+    }
+
+    template <class Tuple, size_t... I>
+    static void passAll(const char *fmt, Tuple &decoded, std::string &out,
+                        std::index_sequence<I...>) {
+        auto passed = std::make_tuple(ArgOf<A>::pass(std::get<I>(decoded))...);
+        formatWith(fmt, passed, out, std::index_sequence_for<A...>());
+    }
+};
+
+} // namespace detail
+
+// Queue a record for the flusher, dropping it if this thread's ring is full
+// Arguments are copied as they are and formatted by the flusher thread with
+// fmt, a printf format that has to outlive the program, i.e. a literal.
+// Call it through PD_LOG, which checks fmt against the arguments.
+template <class... A>
+void write(Level level, Sink sink, const char *fmt, const A &... args) {
+    size_t reserve = detail::fixedSize(args...);
+    if (reserve > LOG_RECORD_SIZE - sizeof(RecordHeader))
+        return;     // too many arguments to ever fit
+    Byte *rec = beginRecord();
+    if (rec == nullptr)
+        return;
+    auto *h = reinterpret_cast<RecordHeader*>(rec);
+    h->level = static_cast<uint8_t>(level);
+    h->sink = static_cast<uint8_t>(sink);
+    h->fmt = fmt;
+    h->format = &detail::Formatter<typename std::decay<A>::type...>::format;
+    detail::encode(rec + sizeof(RecordHeader), rec + LOG_RECORD_SIZE, reserve, args...);
+    commitRecord();
+}
+
+// Queue an access log line, see write()
+template <class... A>
+void access(const char *fmt, const A &... args) {
+    write(LEVEL_INFO, SINK_ACCESS, fmt, args...);
+}
+
+} // namespace log
+} // namespace pardus
+
+
+#endif //PD_LOG_H
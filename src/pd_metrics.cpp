@@ -0,0 +1,209 @@
+#include "pd_metrics.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+namespace pardus {
+namespace metrics {
+
+namespace {
+
+const char *STAGE_NAMES[STAGE_COUNT] = {
+    "accept", "first_byte", "parse", "handler", "write", "close"
+};
+
+// Upper bounds of the exported stage buckets, in seconds
+const double STAGE_BOUNDS[] = {
+    1e-6, 2.5e-6, 5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4,
+    1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+
+const double STAGE_QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+struct Gauge {
+    std::string name;       // with labels, if any
+    std::string help;
+    const char *type;
+    std::function<double()> value;
+};
+
+// Head of the list of every thread's metrics, only ever pushed to
+std::atomic<ThreadMetrics*> threads{nullptr};
+
+std::mutex gaugeMutex;
+std::vector<Gauge> gauges;
+
+void append(std::string &out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+void append(std::string &out, const char *fmt, ...) {
+    char line[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = std::vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        out.append(line, std::min(static_cast<size_t>(n), sizeof(line) - 1));
+}
+
+// Metric name without its labels
+std::string family(const std::string &name) {
+    return name.substr(0, name.find('{'));
+}
+
+void header(std::string &out, const std::string &name, const char *help, const char *type) {
+    out += "# HELP " + name + " " + help + "\n";
+    out += "# TYPE " + name + " " + type + "\n";
+}
+
+} // namespace
+
+
+/***************************
+* HistogramRecorder implementation
+**************************/
+HistogramRecorder::HistogramRecorder() {
+    for (std::atomic<uint64_t> &c : mCounts)
+        c.store(0, std::memory_order_relaxed);
+    mCount.store(0, std::memory_order_relaxed);
+    mSum.store(0, std::memory_order_relaxed);
+}
+
+// Add the counts recorded so far to into, at bucket resolution, and their
+// exact sum to sum
+void HistogramRecorder::snapshot(Histogram &into, uint64_t &sum) const {
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        uint64_t n = mCounts[i].load(std::memory_order_relaxed);
+        if (n)
+            into.record(Histogram::bucketHigh(i), n);
+    }
+    sum += mSum.load(std::memory_order_relaxed);
+}
+
+
+/***************************
+* Metrics implementation
+**************************/
+thread_local ThreadMetrics *Metrics::tLocal = nullptr;
+
+// Create the metrics of the calling thread and publish them to readers
+ThreadMetrics &Metrics::attach() {
+    auto *m = new ThreadMetrics;
+    for (std::atomic<uint64_t> &c : m->counters)
+        c.store(0, std::memory_order_relaxed);
+    ThreadMetrics *head = threads.load(std::memory_order_relaxed);
+    do {
+        m->next = head;
+    } while (!threads.compare_exchange_weak(head, m, std::memory_order_release,
+                                            std::memory_order_relaxed));
+    tLocal = m;
+    return *m;
+}
+
+// Export value() as metric name, which may carry labels
+// Gauges sharing a name up to the labels must be added one after another.
+void Metrics::addGauge(const std::string &name, const std::string &help,
+                       std::function<double()> value, const char *type) {
+    std::lock_guard<std::mutex> lck(gaugeMutex);
+    gauges.push_back({name, help, type, std::move(value)});
+}
+
+// Merge the histograms of stage over all threads
+//    Return the merged histogram, its exact sum in sum if given
+Histogram Metrics::stage(Stage stage, uint64_t *sum) {
+    Histogram h;
+    uint64_t total = 0;
+    for (ThreadMetrics *m = threads.load(std::memory_order_acquire); m; m = m->next)
+        m->stages[stage].snapshot(h, total);
+    if (sum)
+        *sum = total;
+    return h;
+}
+
+// Sum of counter over all threads
+uint64_t Metrics::counter(Counter counter) {
+    uint64_t total = 0;
+    for (ThreadMetrics *m = threads.load(std::memory_order_acquire); m; m = m->next)
+        total += m->counters[counter].load(std::memory_order_relaxed);
+    return total;
+}
+
+// Everything in the Prometheus text exposition format
+std::string Metrics::render() {
+    std::string out;
+    out.reserve(16 << 10);
+
+    header(out, "pardus_stage_seconds", "Time spent per stage of serving connections", "histogram");
+    std::vector<Histogram> hists(STAGE_COUNT);
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        uint64_t sum;
+        hists[s] = stage(static_cast<Stage>(s), &sum);
+        size_t b = 0;
+        uint64_t below = 0;
+        const size_t nbounds = sizeof(STAGE_BOUNDS) / sizeof(STAGE_BOUNDS[0]);
+        // Buckets of the Histogram are far finer than the exported ones, and
+        // counted under the first bound at or above their largest value
+        hists[s].forEachBucket([&](uint64_t high, uint64_t n) {
+            while (b < nbounds && high > STAGE_BOUNDS[b] * 1e9) {
+                append(out, "pardus_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n",
+                       STAGE_NAMES[s], STAGE_BOUNDS[b], static_cast<unsigned long long>(below));
+                b++;
+            }
+            below += n;
+        });
+        for (; b < nbounds; b++)
+            append(out, "pardus_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n",
+                   STAGE_NAMES[s], STAGE_BOUNDS[b], static_cast<unsigned long long>(below));
+        append(out, "pardus_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n",
+               STAGE_NAMES[s], static_cast<unsigned long long>(hists[s].count()));
+        append(out, "pardus_stage_seconds_sum{stage=\"%s\"} %.9f\n", STAGE_NAMES[s], sum / 1e9);
+        append(out, "pardus_stage_seconds_count{stage=\"%s\"} %llu\n",
+               STAGE_NAMES[s], static_cast<unsigned long long>(hists[s].count()));
+    }
+
+    header(out, "pardus_stage_quantile_seconds",
+           "Stage time quantiles since start, within 1/64 of the exact value", "gauge");
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        for (double q : STAGE_QUANTILES)
+            append(out, "pardus_stage_quantile_seconds{stage=\"%s\",quantile=\"%g\"} %.9f\n",
+                   STAGE_NAMES[s], q, hists[s].percentile(q * 100) / 1e9);
+    }
+
+    uint64_t opened = counter(CONNECTIONS_OPENED);
+    uint64_t closed = counter(CONNECTIONS_CLOSED);
+    header(out, "pardus_connections_opened_total", "Connections accepted", "counter");
+    append(out, "pardus_connections_opened_total %llu\n", static_cast<unsigned long long>(opened));
+    header(out, "pardus_connections_closed_total", "Connections closed", "counter");
+    append(out, "pardus_connections_closed_total %llu\n", static_cast<unsigned long long>(closed));
+    header(out, "pardus_connections_active", "Connections open", "gauge");
+    append(out, "pardus_connections_active %lld\n", static_cast<long long>(opened - closed));
+    header(out, "pardus_requests_total", "Requests parsed", "counter");
+    append(out, "pardus_requests_total %llu\n",
+           static_cast<unsigned long long>(counter(REQUESTS)));
+    header(out, "pardus_responses_total", "Responses by status class", "counter");
+    for (int c = 1; c <= 5; c++)
+        append(out, "pardus_responses_total{class=\"%dxx\"} %llu\n", c,
+               static_cast<unsigned long long>(counter(static_cast<Counter>(RESPONSES_1XX + c - 1))));
+    header(out, "pardus_received_bytes_total", "Bytes read from clients", "counter");
+    append(out, "pardus_received_bytes_total %llu\n",
+           static_cast<unsigned long long>(counter(BYTES_RECEIVED)));
+    header(out, "pardus_sent_bytes_total", "Bytes written to clients", "counter");
+    append(out, "pardus_sent_bytes_total %llu\n",
+           static_cast<unsigned long long>(counter(BYTES_SENT)));
+
+    std::lock_guard<std::mutex> lck(gaugeMutex);
+    std::string last;
+    for (const Gauge &g : gauges) {
+        std::string name = family(g.name);
+        if (name != last)
+            header(out, name, g.help.c_str(), g.type);
+        last = name;
+        append(out, "%s %.17g\n", g.name.c_str(), g.value());
+    }
+    return out;
+}
+
+} // namespace metrics
+} // namespace pardus
@@ -0,0 +1,117 @@
+#ifndef PD_METRICS_H
+#define PD_METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "pd_histogram.h"
+
+namespace pardus {
+namespace metrics {
+
+// Stages of serving a connection, each timed into its own histogram
+enum Stage {
+    STAGE_ACCEPT,       // one accept4() of a non-blocking acceptor
+    STAGE_FIRST_BYTE,   // connection accepted until its first bytes are read
+    STAGE_PARSE,        // parsing one request head
+    STAGE_HANDLER,      // producing one response
+    STAGE_WRITE,        // responses ready until written out
+    STAGE_CLOSE,        // closing a connection
+    STAGE_COUNT
+};
+
+enum Counter {
+    CONNECTIONS_OPENED,
+    CONNECTIONS_CLOSED,
+    REQUESTS,
+    RESPONSES_1XX,
+    RESPONSES_2XX,
+    RESPONSES_3XX,
+    RESPONSES_4XX,
+    RESPONSES_5XX,
+    BYTES_RECEIVED,
+    BYTES_SENT,
+    COUNTER_COUNT
+};
+
+// HistogramRecorder - Histogram buckets written by one thread, read by any
+// The owner adds with relaxed loads and stores, which compile to plain
+// moves: no lock prefix and no cache line bouncing. Readers may see a
+// recording half done, e.g. the bucket but not the sum, which is fine for
+// monitoring.
+class HistogramRecorder {
+public:
+    HistogramRecorder();
+
+    void record(uint64_t value) {
+        add(mCounts[Histogram::bucketOf(value)], 1);
+        add(mCount, 1);
+        add(mSum, value);
+    }
+
+    void snapshot(Histogram &into, uint64_t &sum) const;
+
+private:
+    static void add(std::atomic<uint64_t> &c, uint64_t n) {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> mCounts[HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> mCount;
+    std::atomic<uint64_t> mSum;
+};
+
+// ThreadMetrics - Stage histograms and counters of one thread
+struct ThreadMetrics {
+    HistogramRecorder stages[STAGE_COUNT];
+    std::atomic<uint64_t> counters[COUNTER_COUNT];
+    ThreadMetrics *next = nullptr;   // in the list of every thread's metrics
+};
+
+// Metrics - Process wide metrics, recorded per thread and merged on demand
+// Each thread records into its own ThreadMetrics, created on first use and
+// kept after the thread exits so nothing counted is lost. render() merges
+// them with the registered gauges into the Prometheus text format.
+class Metrics {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static void record(Stage stage, Clock::duration d) {
+        local().stages[stage].record(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+    }
+
+    static void count(Counter counter, uint64_t n = 1) {
+        std::atomic<uint64_t> &c = local().counters[counter];
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static void countResponse(int status) {
+        int cls = status / 100;
+        if (cls >= 1 && cls <= 5)
+            count(static_cast<Counter>(RESPONSES_1XX + cls - 1));
+    }
+
+    static void addGauge(const std::string &name, const std::string &help,
+                         std::function<double()> value, const char *type = "gauge");
+    static Histogram stage(Stage stage, uint64_t *sum = nullptr);
+    static uint64_t counter(Counter counter);
+    static std::string render();
+
+private:
+    static ThreadMetrics &local() {
+        ThreadMetrics *m = tLocal;
+        return m ? *m : attach();
+    }
+    static ThreadMetrics &attach();
+
+    static thread_local ThreadMetrics *tLocal;
+};
+
+} // namespace metrics
+} // namespace pardus
+
+
+#endif //PD_METRICS_H
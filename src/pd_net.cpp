@@ -1,9 +1,23 @@
 #include "pd_net.h"
+#include "pd_bufpool.h"
+#include "pd_bytescan.h"
 
 #include <unistd.h>
+#include <fcntl.h>
+#include <climits>
+#include <cstdlib>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <cerrno>
 #include <cstring>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <cstdio>
 #include <string>
 #include <memory>
 #include <iostream>
@@ -14,15 +28,15 @@ namespace nio {
 /***************************
 * BytBuffer implementation
 **************************/
+// Empty buffer, nothing is allocated until allocate()
 ByteBuffer::ByteBuffer(){
-    ByteBuffer(0);
 }
 
 ByteBuffer::ByteBuffer(size_t capacity){
     allocate(capacity);
 }
 
-ByteBuffer::ByteBuffer(ByteBuffer&& src){
+ByteBuffer::ByteBuffer(ByteBuffer&& src) noexcept {
     mPos = src.mPos;
     mLimit = src.mLimit;
     mCapacity = src.mCapacity;
@@ -38,7 +52,7 @@ ByteBuffer::~ByteBuffer(){
     deallocate();
 }
 
-ByteBuffer& ByteBuffer::operator=(ByteBuffer&& src){
+ByteBuffer& ByteBuffer::operator=(ByteBuffer&& src) noexcept {
     deallocate();
     // [Note] Effective cpp item12: copy or move all parts of an object
     mPos = src.mPos;
@@ -50,19 +64,22 @@ ByteBuffer& ByteBuffer::operator=(ByteBuffer&& src){
     src.mPos = 0;
     src.mLimit = 0;
     src.mCapacity = 0;
+    return *this;
 }
 
+// Storage comes from the BufferPool of the calling thread
 void ByteBuffer::allocate(size_t capacity){
     deallocate();
 
-    mBuff = new Byte[capacity];
+    mBuff = BufferPool::allocate(capacity);
     mPos = 0;
     mLimit = 0;
     mCapacity = capacity;
 }
 
+// Hand storage back to the BufferPool
 void ByteBuffer::deallocate(){
-    delete[](mBuff);
+    BufferPool::deallocate(mBuff, mCapacity);
 
     mBuff = nullptr;
     mPos = 0;
@@ -140,8 +157,8 @@ Byte ByteBuffer::get() {
 void ByteBuffer::get(Byte *dst, size_t offset, size_t length) {
     if(length > remaining())
         throw std::length_error("Not enough of remaining items");
-    for(int i = offset; i < offset+length; i++)
-        dst[i] = get();
+    std::memcpy(dst + offset, mBuff + mPos, length);
+    mPos += length;
 }
 
 // Return byte at index, mPos not changed
@@ -176,8 +193,8 @@ void ByteBuffer::put(Byte b) {
 void ByteBuffer::put(Byte *src, size_t offset, size_t length) {
     if(length > remaining())
         throw std::range_error("Not enough of remaining space");
-    for(int i = offset; i < offset+length; i++)
-        put(src[i]);
+    std::memcpy(mBuff + mPos, src + offset, length);
+    mPos += length;
 }
 
 // Put one byte at index, mPos is not changed.
@@ -191,9 +208,10 @@ void ByteBuffer::put(size_t index, Byte b) {
 void ByteBuffer::put(ByteBuffer &src) {
     if(src.remaining() > remaining())
         throw std::range_error("Not enough of remaining space");
-    while(src.hasRemaining()){
-        put(src.get());
-    }
+    size_t n = src.remaining();
+    std::memcpy(mBuff + mPos, src.mBuff + src.mPos, n);
+    mPos += n;
+    src.mPos += n;
 }
 
 // Put one char to this buffer
@@ -209,25 +227,287 @@ void ByteBuffer::putchar(size_t index, char val) {
 // Convert all data in buffer to a string
 // Buffer becomes empty
 std::string ByteBuffer::toString() {
-    std::string ret;
-    while(hasRemaining())
-        ret.push_back(static_cast<char>(get()));
+    std::string ret(mBuff + mPos, remaining());
+    mPos = mLimit;
     return ret;
 }
 
+// Index of the first b in [pos, limit), mPos is not changed
+//    Return -1 if not found
+ssize_t ByteBuffer::indexOf(Byte b) {
+    return indexOf(b, mPos);
+}
+
+// Index of the first b in [from, limit)
+ssize_t ByteBuffer::indexOf(Byte b, size_t from) {
+    if(from >= mLimit)
+        return -1;
+    const Byte *p = bytescan::findByte(mBuff + from, mBuff + mLimit, b);
+    return p ? p - mBuff : -1;
+}
+
+// Index of the first occurrence of C string str in [pos, limit),
+// e.g. indexOf("\r\n\r\n") to find the end of a header block
+ssize_t ByteBuffer::indexOf(const char *str) {
+    return indexOf(reinterpret_cast<const Byte*>(str), std::strlen(str), mPos);
+}
+
+ssize_t ByteBuffer::indexOf(const char *str, size_t from) {
+    return indexOf(reinterpret_cast<const Byte*>(str), std::strlen(str), from);
+}
+
+// Index of the first needle[0, length) in [from, limit)
+//    Return -1 if not found
+ssize_t ByteBuffer::indexOf(const Byte *needle, size_t length, size_t from) {
+    if(from > mLimit)
+        return -1;
+    const Byte *p = bytescan::find(mBuff + from, mBuff + mLimit, needle, length);
+    return p ? p - mBuff : -1;
+}
+
 
 /******************************
 * SocketAddress implementation
 ******************************/
+// Unspecified address, family AF_UNSPEC
+SocketAddress::SocketAddress(){
+    std::memset(&mAddr, 0, sizeof(mAddr));
+    mAddr.sa.sa_family = AF_UNSPEC;
+    mLength = 0;
+}
+
+// Address of host at port
+// An empty host is the wildcard address, IPv6 so that a listening socket
+// takes both families. Numeric hosts are parsed in place; names are looked
+// up with getaddrinfo() and the first result is kept. On failure the
+// family stays AF_UNSPEC.
+SocketAddress::SocketAddress(const std::string &host, int port) : SocketAddress() {
+    if(host.empty()){
+        mAddr.v6.sin6_family = AF_INET6;
+        mAddr.v6.sin6_addr = in6addr_any;
+        mAddr.v6.sin6_port = htons(static_cast<uint16_t>(port));
+        mLength = sizeof(sockaddr_in6);
+    }else if(inet_pton(AF_INET, host.c_str(), &mAddr.v4.sin_addr) == 1){
+        mAddr.v4.sin_family = AF_INET;
+        mAddr.v4.sin_port = htons(static_cast<uint16_t>(port));
+        mLength = sizeof(sockaddr_in);
+    }else if(inet_pton(AF_INET6, host.c_str(), &mAddr.v6.sin6_addr) == 1){
+        mAddr.v6.sin6_family = AF_INET6;
+        mAddr.v6.sin6_port = htons(static_cast<uint16_t>(port));
+        mLength = sizeof(sockaddr_in6);
+    }else{
+        addrinfo hints, *listp;
+        memset(&hints, 0, sizeof(struct addrinfo));
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_ADDRCONFIG;
+        if(getaddrinfo(host.c_str(), nullptr, &hints, &listp) == 0){
+            *this = fromSockaddr(listp->ai_addr, listp->ai_addrlen);
+            freeaddrinfo(listp);
+            if(getFamily() == AF_INET)
+                mAddr.v4.sin_port = htons(static_cast<uint16_t>(port));
+            else if(getFamily() == AF_INET6)
+                mAddr.v6.sin6_port = htons(static_cast<uint16_t>(port));
+        }
+    }
+}
+
+// Every address of host at port, numeric hosts without a lookup
+// Unlike the constructor, which keeps the first, all the addresses
+// getaddrinfo() returns are kept, in its order of preference, so that
+// connecting can fall back to the next one.
+//    Return 0 on success
+//    On error, return a getaddrinfo() error code, see gai_strerror()
+int SocketAddress::resolve(const std::string &host, int port, std::vector<SocketAddress> &addrs){
+    addrs.clear();
+    SocketAddress numeric;
+    if(inet_pton(AF_INET, host.c_str(), &numeric.mAddr.v4.sin_addr) == 1
+       || inet_pton(AF_INET6, host.c_str(), &numeric.mAddr.v6.sin6_addr) == 1){
+        addrs.push_back(SocketAddress(host, port));
+        return 0;
+    }
+    addrinfo hints, *listp;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG | AI_NUMERICSERV;
+    std::string service = std::to_string(port);
+    int rc = getaddrinfo(host.c_str(), service.c_str(), &hints, &listp);
+    if(rc != 0)
+        return rc;
+    for(addrinfo *p = listp; p; p = p->ai_next){
+        SocketAddress addr = fromSockaddr(p->ai_addr, p->ai_addrlen);
+        if(addr.getFamily() != AF_UNSPEC)
+            addrs.push_back(addr);
+    }
+    freeaddrinfo(listp);
+    return addrs.empty() ? EAI_NONAME : 0;
+}
+
 // Constructing SocketAddress from sockaddr
-// This is useful when accepting a socket connection
-SocketAddress SocketAddress::fromSockaddr(sockaddr* addr, int length){
-    char hostbuff[NI_MAXHOST];
-    char servbuff[NI_MAXSERV];
-    getnameinfo(addr, length, hostbuff, NI_MAXHOST,
-                servbuff, NI_MAXSERV, NI_NUMERICHOST|NI_NUMERICSERV);
+// This is useful when accepting a socket connection. Families other than
+// AF_INET and AF_INET6 give an unspecified address.
+SocketAddress SocketAddress::fromSockaddr(const sockaddr* addr, socklen_t length){
+    SocketAddress address;
+    if((addr->sa_family == AF_INET && length >= sizeof(sockaddr_in))
+       || (addr->sa_family == AF_INET6 && length >= sizeof(sockaddr_in6))){
+        address.mLength = addr->sa_family == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6);
+        std::memcpy(&address.mAddr, addr, address.mLength);
+    }
+    return address;
+}
+
+int SocketAddress::getFamily() const {
+    return mAddr.sa.sa_family;
+}
+
+// Port in host byte order, -1 if the address is unspecified
+int SocketAddress::getPort() const {
+    switch(getFamily()){
+    case AF_INET: return ntohs(mAddr.v4.sin_port);
+    case AF_INET6: return ntohs(mAddr.v6.sin6_port);
+    default: return -1;
+    }
+}
+
+// True for 0.0.0.0 and ::
+bool SocketAddress::isWildcard() const {
+    if(getFamily() == AF_INET)
+        return mAddr.v4.sin_addr.s_addr == htonl(INADDR_ANY);
+    if(getFamily() == AF_INET6)
+        return IN6_IS_ADDR_UNSPECIFIED(&mAddr.v6.sin6_addr);
+    return false;
+}
+
+const sockaddr* SocketAddress::getSockaddr() const {
+    return &mAddr.sa;
+}
+
+socklen_t SocketAddress::getLength() const {
+    return mLength;
+}
+
+// Write "host:port" to buf[0, size), "[host]:port" for IPv6
+// IPv4-mapped IPv6 addresses, as accepted on a dual-stack socket, are
+// written as IPv4.
+//    Return length of the text, truncated to size - 1
+size_t SocketAddress::format(char *buf, size_t size) const {
+    char host[INET6_ADDRSTRLEN];
+    bool bracket = false;
+    if(getFamily() == AF_INET){
+        inet_ntop(AF_INET, &mAddr.v4.sin_addr, host, sizeof(host));
+    }else if(getFamily() == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&mAddr.v6.sin6_addr)){
+        inet_ntop(AF_INET, &mAddr.v6.sin6_addr.s6_addr[12], host, sizeof(host));
+    }else if(getFamily() == AF_INET6){
+        inet_ntop(AF_INET6, &mAddr.v6.sin6_addr, host, sizeof(host));
+        bracket = true;
+    }else{
+        return std::snprintf(buf, size, "unspecified");
+    }
+    int n = std::snprintf(buf, size, bracket ? "[%s]:%d" : "%s:%d", host, getPort());
+    return std::min(static_cast<size_t>(n), size ? size - 1 : 0);
+}
+
+std::string SocketAddress::toString() const {
+    char buf[INET6_ADDRSTRLEN + 16];
+    return std::string(buf, format(buf, sizeof(buf)));
+}
+
+
+/******************************
+* SocketOptions implementation
+******************************/
+namespace {
+
+struct SocketOptionName {
+    const char *name;
+    int SocketOptions::*field;
+};
+
+const SocketOptionName SOCKET_OPTION_NAMES[] = {
+    {"nodelay", &SocketOptions::noDelay},
+    {"defer-accept", &SocketOptions::deferAcceptSec},
+    {"fastopen", &SocketOptions::fastOpenQueue},
+    {"rcvbuf", &SocketOptions::rcvBuf},
+    {"sndbuf", &SocketOptions::sndBuf},
+    {"quickack", &SocketOptions::quickAck},
+    {"busy-poll", &SocketOptions::busyPollUs},
+    {"incoming-cpu", &SocketOptions::incomingCpu},
+};
+
+// Options of a named profile, in the syntax of SocketOptions::parse
+struct SocketProfile {
+    const char *name;
+    const char *options;
+};
+
+const SocketProfile SOCKET_PROFILES[] = {
+    {"default", ""},
+    // Small responses leave at once and are acknowledged at once, reads
+    // spin briefly instead of sleeping, reactors take the connections of
+    // their own core
+    {"low-latency", "nodelay=1,quickack=1,defer-accept=1,fastopen=256,busy-poll=50,incoming-cpu=auto"},
+    // Large windows for large bodies, fewer and fuller segments
+    {"bulk-throughput", "nodelay=0,defer-accept=1,rcvbuf=4194304,sndbuf=4194304"},
+};
+
+} // namespace
+
+// Parse a comma separated list of profile names and name=value options
+// into opts, later items overriding earlier ones, e.g.
+// "low-latency,busy-poll=0". incoming-cpu=auto is SOCKET_INCOMING_CPU_AUTO.
+//    Return false if spec has an unknown name or a bad value
+bool SocketOptions::parse(const char *spec, SocketOptions &opts){
+    std::string list(spec);
+    size_t i = 0;
+    while(i <= list.size()){
+        size_t end = std::min(list.find(',', i), list.size());
+        std::string item = list.substr(i, end - i);
+        i = end + 1;
+        if(item.empty())
+            continue;
+        size_t eq = item.find('=');
+        if(eq == std::string::npos){
+            const SocketProfile *profile = nullptr;
+            for(const SocketProfile &p : SOCKET_PROFILES)
+                if(item == p.name)
+                    profile = &p;
+            if(profile == nullptr || !parse(profile->options, opts))
+                return false;
+            continue;
+        }
+        std::string name = item.substr(0, eq), value = item.substr(eq + 1);
+        const SocketOptionName *option = nullptr;
+        for(const SocketOptionName &o : SOCKET_OPTION_NAMES)
+            if(name == o.name)
+                option = &o;
+        if(option == nullptr)
+            return false;
+        if(option->field == &SocketOptions::incomingCpu && value == "auto"){
+            opts.incomingCpu = SOCKET_INCOMING_CPU_AUTO;
+            continue;
+        }
+        char *digitsEnd;
+        long v = std::strtol(value.c_str(), &digitsEnd, 10);
+        if(value.empty() || *digitsEnd != '\0' || v < -1 || v > INT_MAX)
+            return false;
+        opts.*(option->field) = static_cast<int>(v);
+    }
+    return true;
+}
 
-    return SocketAddress(std::string(hostbuff), std::stoi(std::string(servbuff)));
+// Options set, as name=value list in the syntax of parse()
+std::string SocketOptions::toString() const {
+    std::string list;
+    for(const SocketOptionName &o : SOCKET_OPTION_NAMES){
+        int v = this->*(o.field);
+        if(v == -1)
+            continue;
+        if(!list.empty())
+            list += ',';
+        list += o.name;
+        list += '=';
+        list += v == SOCKET_INCOMING_CPU_AUTO ? "auto" : std::to_string(v);
+    }
+    return list.empty() ? "default" : list;
 }
 
 
@@ -239,16 +519,20 @@ Socket::Socket(){
     clear();
 }
 
-Socket::Socket(Socket&& rhs){
+Socket::Socket(Socket&& rhs) noexcept {
+    clear();
     operator=(std::forward<Socket>(rhs));
 }
 
-Socket& Socket::operator=(Socket&& rhs){
+Socket& Socket::operator=(Socket&& rhs) noexcept {
     mSocketFd = rhs.mSocketFd;
-    mLocalAddr = rhs.mLocalAddr;
-    mRemoteAddr = rhs.mRemoteAddr;
+    mLocalAddr = std::move(rhs.mLocalAddr);
+    mRemoteAddr = std::move(rhs.mRemoteAddr);
     mStatus = rhs.mStatus;
+    mBlocking = rhs.mBlocking;
+    mQuickAck = rhs.mQuickAck;
     rhs.clear();
+    return *this;
 }
 
 Socket::~Socket(){
@@ -266,108 +550,262 @@ void Socket::clear(){
     mLocalAddr = SocketAddress();
     mRemoteAddr = SocketAddress();
     mStatus = Status::PD_SOCK_UNBOUND;
+    mBlocking = true;
+    mQuickAck = false;
 }
 
-// listen - Open and return a listening socket on port.
-// This function is reentrant and protocol-independent.
+// listen - Open and return a listening socket bound to bindpoint
+// backlog bounds the connections queued by the kernel; it is capped by
+// net.core.somaxconn. With reusePort, several sockets can bind the same port (SO_REUSEPORT)
+// and the kernel load balances incoming connections among them. The IPv6
+// wildcard also accepts IPv4 clients; without IPv6 support the IPv4
+// wildcard is used instead.
 //     Return listen socket discriptor
 //     On error, returns -1 and sets errno.
-int Socket::listen(const SocketAddress &bindpoint) {
-    addrinfo hints, *listp, *p;
-    int listenfd, optval=1;
+int Socket::listen(const SocketAddress &bindpoint, bool reusePort, int backlog) {
+    SocketAddress local = bindpoint;
+    if(local.getFamily() == AF_UNSPEC){
+        errno = EADDRNOTAVAIL;
+        return -1;
+    }
+    int listenfd = socket(local.getFamily(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(listenfd < 0 && local.getFamily() == AF_INET6 && local.isWildcard()){
+        local = SocketAddress("0.0.0.0", local.getPort());
+        listenfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    }
+    if(listenfd < 0)
+        return -1;
 
-    /* Get a list of potential server addresses */
-    memset(&hints, 0, sizeof(struct addrinfo));
-    hints.ai_socktype = SOCK_STREAM;  /* Accept TCP connections */
-    hints.ai_flags = AI_PASSIVE;      /* ... on any IP address */
-    hints.ai_flags |= AI_NUMERICSERV; /* ... using a numeric port arg. */
-    hints.ai_flags |= AI_ADDRCONFIG;  /* Recommended for connections */
-    getaddrinfo(NULL, std::to_string(bindpoint.mPort).c_str(), &hints, &listp);
-
-    /* Walk the list for one that we can bind to */
-    for (p = listp; p; p = p->ai_next) {
-        if ((listenfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0)
-            continue;
+    int optval = 1, v6only = 0;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR,
+               (const void *)&optval , sizeof(int));
+    if(local.getFamily() == AF_INET6 && local.isWildcard())
+        setsockopt(listenfd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+    if((reusePort && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+                                (const void *)&optval , sizeof(int)) < 0)
+       || ::bind(listenfd, local.getSockaddr(), local.getLength()) < 0
+       || ::listen(listenfd, backlog) < 0){
+        int err = errno;
+        ::close(listenfd);
+        errno = err;
+        return -1;
+    }
 
-        setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR,
-                   (const void *)&optval , sizeof(int));
+    // Learn the port picked by the kernel when binding port 0
+    socklen_t len = sizeof(local.mAddr);
+    getsockname(listenfd, &local.mAddr.sa, &len);
+    mSocketFd = listenfd;
+    mLocalAddr = local;
+    mStatus = Status::PD_SOCK_LISTENING;
+    return listenfd;
+}
 
-        if (::bind(listenfd, p->ai_addr, p->ai_addrlen) == 0){
-            break; /* Success */
+// Connect - Connecting to a remote server
+// The handshake runs non-blocking and is waited for with poll(), giving up
+// after timeoutMs with ETIMEDOUT; 0 waits as long as the kernel does. The
+// connected socket is blocking.
+//     Return connect socket discriptor
+//     On error, returns -1 and sets errno.
+int Socket::connect(const SocketAddress &endpoint, int timeoutMs) {
+    if(startConnect(endpoint) < 0){
+        if(errno != EINPROGRESS)
+            return -1;
+        pollfd pfd = {mSocketFd, POLLOUT, 0};
+        int n;
+        while((n = poll(&pfd, 1, timeoutMs > 0 ? timeoutMs : -1)) < 0 && errno == EINTR) {}
+        if(n <= 0){
+            int err = n == 0 ? ETIMEDOUT : errno;
+            close();
+            errno = err;
+            return -1;
         }
-        ::close(listenfd);
+        if(finishConnect() < 0)
+            return -1;
+    }
+    if(configureBlocking(true) < 0){
+        int err = errno;
+        close();
+        errno = err;
+        return -1;
     }
+    return mSocketFd;
+}
 
-    freeaddrinfo(listp);
-    if (!p)
+// Start connecting to a remote server without waiting for the handshake
+// The socket is non-blocking; once it is writable, finishConnect() tells
+// how the handshake went.
+//     Return connect socket discriptor when connected at once
+//     Return -1 with errno EINPROGRESS while the handshake goes on
+//     On error, returns -1 and sets errno.
+int Socket::startConnect(const SocketAddress &endpoint) {
+    if(endpoint.getFamily() == AF_UNSPEC){
+        errno = EADDRNOTAVAIL;
+        return -1;
+    }
+    int connectfd = socket(endpoint.getFamily(), SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if(connectfd < 0)
         return -1;
+    bool pending = false;
+    if(::connect(connectfd, endpoint.getSockaddr(), endpoint.getLength()) < 0){
+        int err = errno;
+        if(err != EINPROGRESS){
+            ::close(connectfd);
+            errno = err;
+            return -1;
+        }
+        pending = true;
+    }
 
-    if (::listen(listenfd, LISTENQ) < 0){
+    socklen_t len = sizeof(mLocalAddr.mAddr);
+    getsockname(connectfd, &mLocalAddr.mAddr.sa, &len);
+    mLocalAddr.mLength = len;
+    mSocketFd = connectfd;
+    mRemoteAddr = endpoint;
+    mBlocking = false;
+    if(pending){
+        mStatus = Status::PD_SOCK_CONNECTING;
+        errno = EINPROGRESS;
         return -1;
-    }else{
-        mSocketFd = listenfd;
-        mLocalAddr = bindpoint;
-        mStatus = Status::PD_SOCK_LISTENING;
-        return listenfd;
     }
+    mStatus = Status::PD_SOCK_CONNECTED;
+    return connectfd;
 }
 
-// Connect - Connecting to a remote server
-//     Return socket connect file discriptor
-//     One error, return -1
-int Socket::connect(const SocketAddress &endpoint) {
-    int connectfd;
-    addrinfo hints, *listp, *p;
+// Complete a connect started by startConnect(), the socket failing it is
+// closed
+//     Return 0 once connected
+//     Return -1 with errno EINPROGRESS while the handshake goes on
+//     On error, returns -1 and sets errno.
+int Socket::finishConnect() {
+    if(mStatus != Status::PD_SOCK_CONNECTING)
+        return 0;
+    pollfd pfd = {mSocketFd, POLLOUT, 0};
+    int n;
+    while((n = poll(&pfd, 1, 0)) < 0 && errno == EINTR) {}
+    if(n == 0){
+        errno = EINPROGRESS;
+        return -1;
+    }
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if(n < 0)
+        err = errno;
+    else if(getsockopt(mSocketFd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        err = errno;
+    if(err != 0){
+        close();
+        errno = err;
+        return -1;
+    }
+    mStatus = Status::PD_SOCK_CONNECTED;
+    return 0;
+}
 
-    /* Get a list of potential server addresses */
-    memset(&hints, 0, sizeof(struct addrinfo));
-    hints.ai_socktype = SOCK_STREAM;  /* Open a connection */
-    hints.ai_flags = AI_NUMERICSERV;  /* ... using a numeric port arg. */
-    hints.ai_flags |= AI_ADDRCONFIG;  /* Recommended for connections */
-    getaddrinfo(endpoint.mHost.c_str(), std::to_string(endpoint.mPort).c_str(), &hints, &listp);
-
-    /* Walk the list for one that we can successfully connect to */
-    for (p = listp; p != nullptr; p = p->ai_next) {
-        if ((connectfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0)
-            continue;
-        if (::connect(connectfd, p->ai_addr, p->ai_addrlen) != -1){
-            break; /* Success */
-        }
-        ::close(connectfd);
+namespace {
+
+// Fill addr with the Unix domain socket at path
+//     Return false if path does not fit
+bool unixAddress(const std::string &path, sockaddr_un &addr) {
+    std::memset(&addr, 0, sizeof(addr));
+    if(path.size() >= sizeof(addr.sun_path))
+        return false;
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+} // namespace
+
+// Connect to the Unix domain socket at path
+// A local connect completes or fails at once, there is nothing to time.
+// SocketAddress holds IP addresses only, so that it stays small enough to
+// be copied on the accept path; the remote address is left unspecified.
+//     Return connect socket discriptor
+//     On error, returns -1 and sets errno, ENAMETOOLONG if path does not fit
+int Socket::connect(const std::string &path) {
+    if(startConnect(path) < 0)
+        return -1;
+    if(configureBlocking(true) < 0){
+        int err = errno;
+        close();
+        errno = err;
+        return -1;
     }
+    return mSocketFd;
+}
 
-    freeaddrinfo(listp);
-    if (!p){
+// Connect to the Unix domain socket at path, the socket is non-blocking
+// A listener with a full backlog fails it with EAGAIN instead of making
+// it wait.
+//     Return connect socket discriptor
+//     On error, returns -1 and sets errno, ENAMETOOLONG if path does not fit
+int Socket::startConnect(const std::string &path) {
+    sockaddr_un addr;
+    if(!unixAddress(path, addr)){
+        errno = ENAMETOOLONG;
         return -1;
     }
-    else{
-        mSocketFd = connectfd;
-        mRemoteAddr = endpoint;
-        mStatus = Status::PD_SOCK_CONNECTED;
-        return connectfd;
+    int connectfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if(connectfd < 0)
+        return -1;
+    if(::connect(connectfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0){
+        int err = errno;
+        ::close(connectfd);
+        errno = err;
+        return -1;
     }
+    mSocketFd = connectfd;
+    mBlocking = false;
+    mStatus = Status::PD_SOCK_CONNECTED;
+    return connectfd;
 }
 
-// Accept - Accepting a new connection
+// Accept - Accepting a new connection with accept4()
+// The new socket is close-on-exec, and non-blocking if this one is.
 //     Return a new Socket
-//     One error, exit
+//     In non-blocking mode, return an unbound Socket when no connection is pending
+//     On error, return an unbound Socket and sets errno
 Socket Socket::accept(){
     if(!(getStatus() == Socket::Status::PD_SOCK_LISTENING))
         throw std::runtime_error("The server is not listening");
-    int cnxxfd;
-    sockaddr_in clientaddr;
-    int clientlen = sizeof(clientaddr);
-    if ((cnxxfd = ::accept(mSocketFd, (struct sockaddr *)&clientaddr, (socklen_t*)&clientlen)) < 0){
-        std::cerr << "In accept failed: " << std::strerror(errno) << std::endl;
-        exit(EXIT_FAILURE);
-    }
-
+    // The peer address is written straight into the new Socket
     Socket accSocket;
+    socklen_t clientlen = sizeof(accSocket.mRemoteAddr.mAddr);
+    int flags = SOCK_CLOEXEC | (mBlocking ? 0 : SOCK_NONBLOCK);
+    int cnxxfd = ::accept4(mSocketFd, &accSocket.mRemoteAddr.mAddr.sa, &clientlen, flags);
+    if (cnxxfd < 0)
+        return Socket();
+
+    if(mQuickAck){
+        int on = 1;
+        setsockopt(cnxxfd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+    }
     accSocket.mSocketFd = cnxxfd;
     accSocket.mStatus = Socket::Status::PD_SOCK_ACCEPTED;
-    accSocket.mLocalAddr = getLocalAddr();
-    accSocket.mRemoteAddr = SocketAddress::fromSockaddr((struct sockaddr *) &clientaddr, clientlen);
-    return std::move(accSocket);
+    accSocket.mBlocking = mBlocking;
+    accSocket.mLocalAddr = mLocalAddr;
+    accSocket.mRemoteAddr.mLength = clientlen;
+    return accSocket;
+}
+
+// Adopt - Wrap a connection accepted elsewhere, e.g. by io_uring
+// The addresses are left unspecified, looking them up costs system calls.
+//     Return a Socket owning fd
+Socket Socket::adopt(int fd, bool blocking){
+    Socket socket;
+    socket.mSocketFd = fd;
+    socket.mStatus = Socket::Status::PD_SOCK_ACCEPTED;
+    socket.mBlocking = blocking;
+    return socket;
+}
+
+// Give up the descriptor without closing it, e.g. once it was closed by io_uring
+//     Return the descriptor
+int Socket::release(){
+    int fd = mSocketFd;
+    clear();
+    mStatus = Status::PD_SOCK_CLOSED;
+    return fd;
 }
 
 void Socket::close() {
@@ -379,11 +817,93 @@ void Socket::close() {
     mStatus = Status::PD_SOCK_CLOSED;
 }
 
-SocketAddress Socket::getLocalAddr() {
+// Switch O_NONBLOCK on the underlying descriptor
+//     Return 0 on success
+//     On error, return -1 and sets errno
+int Socket::configureBlocking(bool block) {
+    int flags = fcntl(mSocketFd, F_GETFL, 0);
+    if(flags < 0)
+        return -1;
+    flags = block ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+    if(fcntl(mSocketFd, F_SETFL, flags) < 0)
+        return -1;
+    mBlocking = block;
+    return 0;
+}
+
+// Bound blocking reads and writes to timeoutMs (SO_RCVTIMEO, SO_SNDTIMEO),
+// they fail with EAGAIN once it elapses. 0 waits forever.
+//     Return 0 on success
+//     On error, return -1 and sets errno
+int Socket::setSoTimeout(int timeoutMs) {
+    timeval tv;
+    tv.tv_sec = timeoutMs / 1000;
+    tv.tv_usec = (timeoutMs % 1000) * 1000;
+    if(setsockopt(mSocketFd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
+        return -1;
+    return setsockopt(mSocketFd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+// Bound blocking writes only (SO_SNDTIMEO), see setSoTimeout
+//     Return 0 on success
+//     On error, return -1 and sets errno
+int Socket::setSendTimeout(int timeoutMs) {
+    timeval tv;
+    tv.tv_sec = timeoutMs / 1000;
+    tv.tv_usec = (timeoutMs % 1000) * 1000;
+    return setsockopt(mSocketFd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+// Apply opts, see SocketOptions
+// Every option set in opts is tried, even after one is refused, e.g. busy
+// polling above net.core.busy_poll without CAP_NET_ADMIN. Options of
+// listeners are skipped on other sockets, and so is an incomingCpu of
+// SOCKET_INCOMING_CPU_AUTO. On a listener, quickAck is remembered for
+// accept().
+//     Return 0 on success
+//     On error, return -1 and sets errno to why the first refused option was
+int Socket::setOptions(const SocketOptions &opts) {
+    bool listener = mStatus == Status::PD_SOCK_LISTENING;
+    struct {
+        int value;
+        int level;
+        int name;
+        bool listenerOnly;
+    } options[] = {
+        {opts.noDelay, IPPROTO_TCP, TCP_NODELAY, false},
+        {opts.deferAcceptSec, IPPROTO_TCP, TCP_DEFER_ACCEPT, true},
+        {opts.fastOpenQueue, IPPROTO_TCP, TCP_FASTOPEN, true},
+        {opts.rcvBuf, SOL_SOCKET, SO_RCVBUF, false},
+        {opts.sndBuf, SOL_SOCKET, SO_SNDBUF, false},
+        {opts.quickAck, IPPROTO_TCP, TCP_QUICKACK, false},
+        {opts.busyPollUs, SOL_SOCKET, SO_BUSY_POLL, false},
+        {opts.incomingCpu, SOL_SOCKET, SO_INCOMING_CPU, true},
+    };
+    int err = 0;
+    for(const auto &o : options){
+        if(o.value < 0 || (o.listenerOnly && !listener))
+            continue;
+        if(setsockopt(mSocketFd, o.level, o.name, &o.value, sizeof(o.value)) < 0 && err == 0)
+            err = errno;
+    }
+    if(listener && opts.quickAck >= 0)
+        mQuickAck = opts.quickAck > 0;
+    if(err != 0){
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+bool Socket::isBlocking() {
+    return mBlocking;
+}
+
+const SocketAddress& Socket::getLocalAddr() {
     return mLocalAddr;
 }
 
-SocketAddress Socket::getRemoteAddr() {
+const SocketAddress& Socket::getRemoteAddr() {
     return mRemoteAddr;
 }
 
@@ -399,28 +919,54 @@ int Socket::getSocketFd(){
 * SocketChannel implementation
 ******************************/
 SocketChannel::SocketChannel(){
-    SocketChannel(Socket());
 }
 
+// mRbuff is taken from the BufferPool on read and handed back while a
+// non-blocking channel waits for data, so idle channels only hold a descriptor
 SocketChannel::SocketChannel(Socket socket) {
     mSocket = std::move(socket);
-    mRbuff.allocate(BUFFSIZE);
 }
 
-// Listening at local.mPort
+// Listening at local
 //    Return listening socket file discriptor
-int SocketChannel::listen(const SocketAddress& local) {
-    return mSocket.listen(local);
+int SocketChannel::listen(const SocketAddress& local, bool reusePort, int backlog) {
+    return mSocket.listen(local, reusePort, backlog);
 }
 
-// Connect to remote server
+// Connect to remote server, waiting at most timeoutMs, see Socket::connect
 //    Return connect socket file discriptor
-int SocketChannel::connect(const SocketAddress& remote) {
-    return mSocket.connect(remote);
+int SocketChannel::connect(const SocketAddress& remote, int timeoutMs) {
+    return mSocket.connect(remote, timeoutMs);
+}
+
+// Apply opts to the socket, see Socket::setOptions
+int SocketChannel::setOptions(const SocketOptions &opts) {
+    return mSocket.setOptions(opts);
+}
+
+// Connect to the Unix domain socket at path, see Socket::connect
+int SocketChannel::connect(const std::string &path) {
+    return mSocket.connect(path);
+}
+
+// Start connecting to remote without waiting, see Socket::startConnect
+int SocketChannel::startConnect(const SocketAddress &remote) {
+    return mSocket.startConnect(remote);
+}
+
+// Connect to the Unix domain socket at path without waiting, see Socket::startConnect
+int SocketChannel::startConnect(const std::string &path) {
+    return mSocket.startConnect(path);
+}
+
+// Complete a connect started by startConnect(), see Socket::finishConnect
+int SocketChannel::finishConnect() {
+    return mSocket.finishConnect();
 }
 
 // Accept a new socket connection
 //    Return a new SocketChannel that's accepted
+//    Return an unbound SocketChannel when none is pending or on error
 SocketChannel SocketChannel::accept() {
     return std::move(SocketChannel(std::move(mSocket.accept())));
 }
@@ -430,13 +976,30 @@ SocketChannel SocketChannel::accept() {
 //    Return number of bytes transfered
 //    Return 0 when there is EOF
 //    On error, return -1
+//    In non-blocking mode, return -1 with errno EAGAIN when no data is ready
+//    When nothing is buffered and dst has room for a full refill, data is
+//    read straight into dst, bypassing mRbuff
 ssize_t SocketChannel::read(ByteBuffer &dst) {
+    if(!mRbuff.hasRemaining() && dst.remaining() >= BUFFSIZE){
+        ssize_t nread = ::read(mSocket.getSocketFd(), (void*)(dst.array() + dst.pos()), dst.remaining());
+        if(nread > 0)
+            dst.pos(dst.pos() + nread);
+        return nread;
+    }
+
+    if(mRbuff.capacity() == 0)
+        mRbuff.allocate(BUFFSIZE);
+
     // Refill mRbuff if it's empty
     while(!mRbuff.hasRemaining()){
-        size_t n = mRbuff.capacity();
-        std::unique_ptr<Byte[]> tmp(new Byte[n]);
-        ssize_t nread = ::read(mSocket.getSocketFd(), (void*)tmp.get(), n);
+        ssize_t nread = ::read(mSocket.getSocketFd(), (void*)mRbuff.array(), mRbuff.capacity());
         if(nread < 0){
+            // Nothing buffered while waiting for data, give the storage back
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
+                int err = errno;
+                mRbuff.deallocate();
+                errno = err;
+            }
             return -1;
         }else if(nread == 0){
             return 0; // EOF
@@ -444,15 +1007,13 @@ ssize_t SocketChannel::read(ByteBuffer &dst) {
 
         // Preparing for writing from mRbuff to dst
         mRbuff.clear();
-        mRbuff.put(tmp.get(), 0, nread);
+        mRbuff.pos(nread);
         mRbuff.flip();
     }
 
-    ssize_t count = 0;
-    while(mRbuff.hasRemaining() && dst.hasRemaining()){
-        dst.put(mRbuff.get());
-        count++;
-    }
+    size_t count = std::min(mRbuff.remaining(), dst.remaining());
+    dst.put(mRbuff.array(), mRbuff.pos(), count);
+    mRbuff.pos(mRbuff.pos() + count);
     return count;
 }
 
@@ -475,10 +1036,140 @@ ssize_t SocketChannel::write(ByteBuffer &src) {
     return count;
 }
 
+// Scattering read into dsts[0, n), filling each buffer before the next one
+// Buffered bytes are handed out first without a syscall, otherwise one
+// readv() reads straight into the buffers.
+//    Return number of bytes transfered
+//    Return 0 when there is EOF
+//    On error, return -1
+ssize_t SocketChannel::read(ByteBuffer *dsts, size_t n) {
+    if(mRbuff.hasRemaining()){
+        ssize_t count = 0;
+        for(size_t i = 0; i < n && mRbuff.hasRemaining(); i++)
+            count += read(dsts[i]);
+        return count;
+    }
+
+    iovec iov[IOV_MAX];
+    size_t iovcnt = 0;
+    for(size_t i = 0; i < n && iovcnt < IOV_MAX; i++){
+        if(!dsts[i].hasRemaining())
+            continue;
+        iov[iovcnt].iov_base = dsts[i].array() + dsts[i].pos();
+        iov[iovcnt].iov_len = dsts[i].remaining();
+        iovcnt++;
+    }
+    if(iovcnt == 0)
+        return 0;
+
+    ssize_t nread = ::readv(mSocket.getSocketFd(), iov, static_cast<int>(iovcnt));
+    if(nread <= 0)
+        return nread;
+    size_t left = nread;
+    for(size_t i = 0; i < n && left > 0; i++){
+        size_t k = std::min(left, dsts[i].remaining());
+        dsts[i].pos(dsts[i].pos() + k);
+        left -= k;
+    }
+    return nread;
+}
+
+// Gathering write of srcs[0, n) with one writev(), at best effort
+// Positions of fully or partially written buffers are advanced.
+//    Return number of bytes sent to network
+//    On error, return -1
+ssize_t SocketChannel::write(ByteBuffer *srcs, size_t n) {
+    iovec iov[IOV_MAX];
+    size_t iovcnt = 0;
+    for(size_t i = 0; i < n && iovcnt < IOV_MAX; i++){
+        if(!srcs[i].hasRemaining())
+            continue;
+        iov[iovcnt].iov_base = srcs[i].array() + srcs[i].pos();
+        iov[iovcnt].iov_len = srcs[i].remaining();
+        iovcnt++;
+    }
+    if(iovcnt == 0)
+        return 0;
+
+    ssize_t nwrite = ::writev(mSocket.getSocketFd(), iov, static_cast<int>(iovcnt));
+    if(nwrite < 0)
+        return -1;
+    size_t left = nwrite;
+    for(size_t i = 0; i < n && left > 0; i++){
+        size_t k = std::min(left, srcs[i].remaining());
+        srcs[i].pos(srcs[i].pos() + k);
+        left -= k;
+    }
+    return nwrite;
+}
+
+// Gathering write of memory not held in ByteBuffers, e.g. shared
+// read-only data; the caller advances iov by the returned count
+//    Return number of bytes transfered
+//    On error, return -1
+ssize_t SocketChannel::write(const iovec *iov, int iovcnt) {
+    return ::writev(mSocket.getSocketFd(), iov, iovcnt);
+}
+
+// Send up to count bytes of file fd starting at position, with sendfile()
+// The file data goes from the page cache to the socket without a copy
+// through user space.
+//    Return number of bytes transfered
+//    Return 0 when position is at or past the end of the file
+//    On error, return -1
+ssize_t SocketChannel::transferFrom(int fd, off_t position, size_t count) {
+    return ::sendfile(mSocket.getSocketFd(), fd, &position, count);
+}
+
+// Move up to count received bytes into the pipe pipeFd with splice()
+// The bytes stay in the kernel, see spliceFrom to send them on.
+//    Return number of bytes moved, 0 at end of stream
+//    On error, return -1
+ssize_t SocketChannel::spliceTo(int pipeFd, size_t count, unsigned flags) {
+    return ::splice(mSocket.getSocketFd(), nullptr, pipeFd, nullptr, count, SPLICE_F_MOVE | flags);
+}
+
+// Send up to count bytes out of the pipe pipeFd with splice()
+// SPLICE_F_MORE in flags tells that more data follows, like MSG_MORE.
+//    Return number of bytes sent
+//    On error, return -1
+ssize_t SocketChannel::spliceFrom(int pipeFd, size_t count, unsigned flags) {
+    return ::splice(pipeFd, nullptr, mSocket.getSocketFd(), nullptr, count, SPLICE_F_MOVE | flags);
+}
+
 void SocketChannel::close() {
     mSocket.close();
 }
 
+// Give up the descriptor without closing it, see Socket::release
+int SocketChannel::release() {
+    return mSocket.release();
+}
+
+int SocketChannel::getFd() {
+    return mSocket.getSocketFd();
+}
+
+// Put channel into blocking or non-blocking mode
+//    Return 0 on success, -1 on error
+int SocketChannel::configureBlocking(bool block) {
+    return mSocket.configureBlocking(block);
+}
+
+bool SocketChannel::isBlocking() {
+    return mSocket.isBlocking();
+}
+
+// Timeout of blocking reads and writes, see Socket::setSoTimeout
+int SocketChannel::setSoTimeout(int timeoutMs) {
+    return mSocket.setSoTimeout(timeoutMs);
+}
+
+// Timeout of blocking writes, see Socket::setSendTimeout
+int SocketChannel::setSendTimeout(int timeoutMs) {
+    return mSocket.setSendTimeout(timeoutMs);
+}
+
 bool SocketChannel::isOpen() {
     return !(mSocket.getStatus() == Socket::Status::PD_SOCK_CLOSED);
 }
@@ -503,29 +1194,71 @@ int SocketChannel::getStatus(){
     return mSocket.getStatus();
 }
 
-SocketAddress SocketChannel::getLocalAddr() {
+const SocketAddress& SocketChannel::getLocalAddr() {
     return mSocket.getLocalAddr();
 }
 
-SocketAddress SocketChannel::getRemoteAddr() {
+const SocketAddress& SocketChannel::getRemoteAddr() {
     return mSocket.getRemoteAddr();
 }
 
-} // namespace nio
-} // namespace pardus
-
-
-
-
-
-
-
-
-
 
+/***************************
+* Acceptor implementation
+**************************/
+Acceptor::Acceptor(SocketChannel &listener) : mListener(listener) {
+    mReserveFd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
 
+Acceptor::~Acceptor() {
+    if(mReserveFd >= 0)
+        ::close(mReserveFd);
+}
 
+// Accept one connection
+//    Return the accepted channel
+//    Return an unbound channel when none is pending or on error, errno is set
+SocketChannel Acceptor::accept() {
+    SocketChannel chan = mListener.accept();
+    if(chan.isAccepted()){
+        mBackoffMs = 0;
+        return chan;
+    }
+    int err = errno;
+    if(err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM){
+        if(err == EMFILE || err == ENFILE)
+            shed();
+        mBackoffMs = mBackoffMs ? std::min(mBackoffMs * 2, ACCEPT_BACKOFF_MAX_MS)
+                                : ACCEPT_BACKOFF_MIN_MS;
+    }
+    errno = err;
+    return chan;
+}
 
+// Milliseconds to wait before accepting again, 0 unless the last accept
+// failed for lack of descriptors or memory. Doubles on each such failure.
+int Acceptor::backoffMs() {
+    return mBackoffMs;
+}
 
+// Connections closed right away for lack of descriptors
+uint64_t Acceptor::shedCount() {
+    return mShed;
+}
 
+// Use the reserved descriptor to take the oldest pending connection off
+// the backlog and close it
+void Acceptor::shed() {
+    if(mReserveFd < 0)
+        return;
+    ::close(mReserveFd);
+    int fd = ::accept4(mListener.getFd(), nullptr, nullptr, SOCK_CLOEXEC);
+    if(fd >= 0){
+        ::close(fd);
+        mShed++;
+    }
+    mReserveFd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
 
+} // namespace nio
+} // namespace pardus
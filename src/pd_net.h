@@ -2,14 +2,24 @@
 #define PD_NET_H
 
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <cstdint>
 #include <string>
+#include <vector>
 #include <algorithm>
 
 #include "pd_types.h"
 
 #define LISTENQ 1024
+#define ACCEPT_BATCH 64
+#define ACCEPT_BACKOFF_MIN_MS 10
+#define ACCEPT_BACKOFF_MAX_MS 1000
 #define BUFFSIZE 8192
 #define SERVER_PORT 8008
+// SocketOptions::incomingCpu of a listener served by a pinned thread, to
+// be replaced with the core of that thread
+#define SOCKET_INCOMING_CPU_AUTO -2
 
 namespace pardus {
 namespace nio {
@@ -17,8 +27,11 @@ namespace nio {
 class ByteBuffer;
 class Socket;
 class SocketAddress;
+struct SocketOptions;
 class Channel;
+class SelectableChannel;
 class SocketChannel;
+class Acceptor;
 
 
 // ByteBuffer - Buffer of bytes
@@ -28,8 +41,8 @@ public:
     explicit ByteBuffer(size_t capacity);
     ByteBuffer(const ByteBuffer &) = delete;
     ByteBuffer& operator=(const ByteBuffer &) = delete;
-    ByteBuffer(ByteBuffer &&src);
-    ByteBuffer& operator=(ByteBuffer &&src);
+    ByteBuffer(ByteBuffer &&src) noexcept;
+    ByteBuffer& operator=(ByteBuffer &&src) noexcept;
     ~ByteBuffer();
 
     void allocate(size_t capacity);
@@ -61,6 +74,12 @@ public:
     void putchar(size_t index, char val);
     std::string toString();
 
+    ssize_t indexOf(Byte b);
+    ssize_t indexOf(Byte b, size_t from);
+    ssize_t indexOf(const char *str);
+    ssize_t indexOf(const char *str, size_t from);
+    ssize_t indexOf(const Byte *needle, size_t length, size_t from);
+
 private:
     size_t mPos = 0;
     size_t mLimit = 0;
@@ -78,17 +97,63 @@ public:
     virtual bool isOpen() = 0;
 };
 
-// SocketAddress
-class SocketAddress {
+// SelectableChannel - Channel that can be multiplexed by a Selector
+class SelectableChannel : public Channel {
 public:
-    SocketAddress() :mHost(""), mPort(-1){}
-    SocketAddress(const std::string &host, int port) : mHost(host), mPort(port) {}
-    static SocketAddress fromSockaddr(::sockaddr *addr, int length);
-    std::string toString() { return mHost + " " + std::to_string(mPort); }
+    virtual int getFd() = 0;
+    virtual int configureBlocking(bool block) = 0;
+    virtual bool isBlocking() = 0;
+};
 
+// SocketAddress - IPv4 or IPv6 address and port, kept in binary form
+// Text is only produced by format()/toString(), so copying an address on
+// the accept path costs a small memcpy and no allocation.
+class SocketAddress {
 public:
-    std::string mHost;
-    int mPort;
+    SocketAddress();
+    SocketAddress(const std::string &host, int port);
+    static SocketAddress fromSockaddr(const ::sockaddr *addr, socklen_t length);
+    static int resolve(const std::string &host, int port, std::vector<SocketAddress> &addrs);
+
+    int getFamily() const;
+    int getPort() const;
+    bool isWildcard() const;
+    const ::sockaddr *getSockaddr() const;
+    socklen_t getLength() const;
+    size_t format(char *buf, size_t size) const;
+    std::string toString() const;
+
+private:
+    friend class Socket;
+
+    union {
+        ::sockaddr sa;
+        ::sockaddr_in v4;
+        ::sockaddr_in6 v6;
+    } mAddr;
+    socklen_t mLength;
+};
+
+
+// SocketOptions - Kernel options of a socket, see Socket::setOptions()
+// An option left at -1 keeps the kernel default. TCP_DEFER_ACCEPT,
+// TCP_FASTOPEN and SO_INCOMING_CPU are options of listeners. Sockets
+// accepted from a listener inherit its TCP_NODELAY, buffer sizes and busy
+// polling from the kernel; TCP_QUICKACK is not inherited and is only
+// a hint, the kernel returns to delayed ACKs as it sees fit, so accept()
+// sets it on each new socket.
+struct SocketOptions {
+    int noDelay = -1;           // TCP_NODELAY, 1 sends small writes without waiting for ACKs
+    int deferAcceptSec = -1;    // TCP_DEFER_ACCEPT, accept only once data arrived, up to this long
+    int fastOpenQueue = -1;     // TCP_FASTOPEN, data-carrying SYNs pending at most
+    int rcvBuf = -1;            // SO_RCVBUF bytes, capped by net.core.rmem_max
+    int sndBuf = -1;            // SO_SNDBUF bytes, capped by net.core.wmem_max
+    int quickAck = -1;          // TCP_QUICKACK, 1 acknowledges at once instead of delaying
+    int busyPollUs = -1;        // SO_BUSY_POLL, us a blocking read spins on the device queue
+    int incomingCpu = -1;       // SO_INCOMING_CPU, core whose connections a SO_REUSEPORT listener takes
+
+    static bool parse(const char *spec, SocketOptions &opts);
+    std::string toString() const;
 };
 
 
@@ -97,22 +162,32 @@ class Socket {
 public:
     Socket();
     Socket(const Socket &) = delete;
-    Socket(Socket&& rhs);
+    Socket(Socket&& rhs) noexcept;
     Socket& operator=(const Socket &) = delete;
-    Socket& operator=(Socket &&);
+    Socket& operator=(Socket &&) noexcept;
     ~Socket();
 
 
-    int listen(const SocketAddress &bindpoint);
-    int connect(const SocketAddress &endpoint);
-    //int connect(const SocketAddress& endpoint, int timeout);
+    int listen(const SocketAddress &bindpoint, bool reusePort = false, int backlog = LISTENQ);
+    int connect(const SocketAddress &endpoint, int timeoutMs = 0);
+    int connect(const std::string &path);
+    int startConnect(const SocketAddress &endpoint);
+    int startConnect(const std::string &path);
+    int finishConnect();
     Socket accept();
+    static Socket adopt(int fd, bool blocking);
+    int release();
     void close();
+    int configureBlocking(bool block);
+    int setSoTimeout(int timeoutMs);
+    int setSendTimeout(int timeoutMs);
+    int setOptions(const SocketOptions &opts);
 
     int getStatus();
     int getSocketFd();
-    SocketAddress getLocalAddr();
-    SocketAddress getRemoteAddr();
+    bool isBlocking();
+    const SocketAddress &getLocalAddr();
+    const SocketAddress &getRemoteAddr();
 
 public:
     // [Note] Effective cpp item2: Prefer consts, enums, and inlines to #defines
@@ -120,6 +195,7 @@ public:
         PD_SOCK_UNBOUND,
         PD_SOCK_LISTENING,
         PD_SOCK_CONNECTED,
+        PD_SOCK_CONNECTING,     // startConnect() handshake still going on
         PD_SOCK_ACCEPTED,
         PD_SOCK_CLOSED
     };
@@ -132,37 +208,103 @@ private:
     SocketAddress mRemoteAddr;
     int mStatus;
     int mSocketFd;
+    bool mBlocking;
+    bool mQuickAck;     // set TCP_QUICKACK on accepted sockets
 };
 
 
 //SocketChannel - Channel of socket
-class SocketChannel : public Channel {
+class SocketChannel : public SelectableChannel {
 public:
     SocketChannel();
     SocketChannel(Socket socket);
 
-    int listen(const SocketAddress &local);
-    int connect(const SocketAddress &remote);
+    int listen(const SocketAddress &local, bool reusePort = false, int backlog = LISTENQ);
+    int connect(const SocketAddress &remote, int timeoutMs = 0);
+    int connect(const std::string &path);
+    int startConnect(const SocketAddress &remote);
+    int startConnect(const std::string &path);
+    int finishConnect();
     SocketChannel accept();
+    int release();
     void close() override;
 
     ssize_t read(ByteBuffer &dst);
+    ssize_t read(ByteBuffer *dsts, size_t n);
     ssize_t write(ByteBuffer &src);
-
+    ssize_t write(ByteBuffer *srcs, size_t n);
+    ssize_t write(const iovec *iov, int iovcnt);
+    ssize_t transferFrom(int fd, off_t position, size_t count);
+    ssize_t spliceTo(int pipeFd, size_t count, unsigned flags = 0);
+    ssize_t spliceFrom(int pipeFd, size_t count, unsigned flags = 0);
+
+    int getFd() override;
+    int configureBlocking(bool block) override;
+    bool isBlocking() override;
+    int setSoTimeout(int timeoutMs);
+    int setSendTimeout(int timeoutMs);
+    int setOptions(const SocketOptions &opts);
     bool isOpen() override;
     bool isListening();
     bool isConnected();
     bool isAccepted();
     bool isClosed();
     int getStatus();
-    SocketAddress getLocalAddr();
-    SocketAddress getRemoteAddr();
+    const SocketAddress &getLocalAddr();
+    const SocketAddress &getRemoteAddr();
 
 private:
     Socket mSocket;
     ByteBuffer mRbuff;
 };
 
+
+// Acceptor - Accepts the connections of a listening SocketChannel
+// Running out of descriptors (EMFILE/ENFILE) does not stop the server: a
+// reserved descriptor is released to accept and immediately close the
+// pending connection, so it does not sit in the backlog, and the caller
+// is advised to back off before accepting again. Accepted channels inherit
+// the blocking mode of the listener.
+class Acceptor {
+public:
+    explicit Acceptor(SocketChannel &listener);
+    Acceptor(const Acceptor &) = delete;
+    Acceptor& operator=(const Acceptor &) = delete;
+    ~Acceptor();
+
+    SocketChannel accept();
+    template <class Fn>
+    size_t acceptBatch(Fn &&fn, size_t max = ACCEPT_BATCH);
+
+    int backoffMs();
+    uint64_t shedCount();
+
+private:
+    void shed();
+
+private:
+    SocketChannel &mListener;
+    int mReserveFd;
+    int mBackoffMs = 0;
+    uint64_t mShed = 0;
+};
+
+// Accept up to max pending connections, handing each to fn(SocketChannel&&)
+// Stops early when the backlog is empty or on error, see backoffMs().
+//    Return number of connections accepted
+template <class Fn>
+size_t Acceptor::acceptBatch(Fn &&fn, size_t max) {
+    size_t n = 0;
+    while (n < max) {
+        SocketChannel chan = accept();
+        if (!chan.isAccepted())
+            break;
+        fn(std::move(chan));
+        n++;
+    }
+    return n;
+}
+
 } // namespace nio
 } // namespace pardus
 
@@ -0,0 +1,700 @@
+#include "pd_proxy.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "pd_bytescan.h"
+#include "pd_log.h"
+
+namespace pardus {
+namespace http {
+
+namespace {
+
+// Headers of one hop that are not forwarded, either way
+const char *const HOP_BY_HOP[] = {
+    "Connection", "Keep-Alive", "Proxy-Connection", "TE", "Trailer", "Upgrade",
+};
+
+bool isHopByHop(const char *name, size_t length) {
+    for (const char *h : HOP_BY_HOP) {
+        if (std::strlen(h) == length && strncasecmp(name, h, length) == 0)
+            return true;
+    }
+    return false;
+}
+
+// recv() retried on EINTR
+ssize_t receive(int fd, char *buf, size_t length, int flags) {
+    ssize_t n;
+    while ((n = ::recv(fd, buf, length, flags)) < 0 && errno == EINTR) {}
+    return n;
+}
+
+} // namespace
+
+
+/***************************
+* ReverseProxy implementation
+**************************/
+ReverseProxy::ReverseProxy(const ClientConfig &config) : mPool(config) {
+}
+
+// Add an upstream given as host:port, [address]:port or unix:path
+// The port defaults to 80.
+//    Return 0 on success
+//    On error, return -1 and sets errno to EINVAL
+int ReverseProxy::addUpstream(const std::string &spec) {
+    std::unique_ptr<Upstream> up(new Upstream);
+    up->name = spec;
+    if (spec.compare(0, 5, "unix:") == 0) {
+        up->host = spec.substr(5);
+        if (up->host.empty() || up->host[0] != '/') {
+            errno = EINVAL;
+            return -1;
+        }
+    } else {
+        size_t colon = spec.rfind(':');
+        size_t bracket = spec.rfind(']');
+        if (colon != std::string::npos && (bracket == std::string::npos || colon > bracket)) {
+            char *end;
+            long port = std::strtol(spec.c_str() + colon + 1, &end, 10);
+            if (*end != '\0' || port <= 0 || port > 65535) {
+                errno = EINVAL;
+                return -1;
+            }
+            up->host = spec.substr(0, colon);
+            up->port = static_cast<int>(port);
+        } else {
+            up->host = spec;
+            up->port = 80;
+        }
+        if (up->host.size() >= 2 && up->host.front() == '[' && up->host.back() == ']')
+            up->host = up->host.substr(1, up->host.size() - 2);
+        if (up->host.empty()) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    mUpstreams.push_back(std::move(up));
+    return 0;
+}
+
+void ReverseProxy::balance(Balance mode) {
+    mBalance = mode;
+}
+
+// Balance mode named round-robin or least-conn
+//    Return false if name is unknown
+bool ReverseProxy::parseBalance(const char *name, Balance &mode) {
+    if (std::strcmp(name, "round-robin") == 0)
+        mode = ROUND_ROBIN;
+    else if (std::strcmp(name, "least-conn") == 0)
+        mode = LEAST_CONNECTIONS;
+    else
+        return false;
+    return true;
+}
+
+size_t ReverseProxy::upstreamCount() {
+    return mUpstreams.size();
+}
+
+Upstream& ReverseProxy::upstream(size_t i) {
+    return *mUpstreams[i];
+}
+
+// Index of the upstream the next request goes to, the ones after it in
+// turn are tried should it fail
+size_t ReverseProxy::select() {
+    size_t n = mUpstreams.size();
+    size_t first = mNext.fetch_add(1, std::memory_order_relaxed) % n;
+    if (mBalance == ROUND_ROBIN)
+        return first;
+    size_t best = first;
+    int least = mUpstreams[first]->active.load(std::memory_order_relaxed);
+    for (size_t i = 1; i < n && least > 0; i++) {
+        size_t k = (first + i) % n;
+        int active = mUpstreams[k]->active.load(std::memory_order_relaxed);
+        if (active < least) {
+            least = active;
+            best = k;
+        }
+    }
+    return best;
+}
+
+ConnectionPool& ReverseProxy::pool() {
+    return mPool;
+}
+
+
+/***************************
+* ProxyRelay implementation
+**************************/
+ProxyRelay::ProxyRelay(ReverseProxy &proxy) : mProxy(proxy) {
+}
+
+ProxyRelay::~ProxyRelay() {
+    abort();
+    closePipe();
+}
+
+bool ProxyRelay::isActive() {
+    return mActive;
+}
+
+// Status of the response being relayed, or to answer with once REJECTED
+int ProxyRelay::status() {
+    return mStatus;
+}
+
+// Length of the response body, 0 unless the upstream gave a Content-Length
+size_t ProxyRelay::contentLength() {
+    return mFraming == FRAMING_LENGTH ? mLength : 0;
+}
+
+// Whether the client connection has to close after the response, as its
+// body ends with the upstream connection or the client asked for it
+bool ProxyRelay::closesClient() {
+    return !mClientKeepAlive;
+}
+
+// Connection to the upstream relay() waits for, null if none
+SocketChannel* ProxyRelay::upstream() {
+    return mActive && mConn.chan.getFd() >= 0 ? &mConn.chan : nullptr;
+}
+
+// Longest wait for the upstream: connectTimeoutMs of the pool while
+// connecting, ioTimeoutMs afterwards
+int ProxyRelay::timeoutMs() {
+    const ClientConfig &config = mProxy.pool().config();
+    return mPhase == PHASE_CONNECT ? config.connectTimeoutMs : config.ioTimeoutMs;
+}
+
+// The upstream did not get ready within timeoutMs(), the next relay() fails
+// the attempt with ETIMEDOUT
+void ProxyRelay::expire() {
+    if (mActive)
+        mExpired = true;
+}
+
+// Take req, parsed from in, to be forwarded by relay()
+// body holds the whole body of req when it was spilled out of in, see
+// HttpRequestParser::spill(); it is sent from the segments it is in.
+// keepAlive tells whether the client connection stays open afterwards.
+void ProxyRelay::start(ByteBuffer &in, const HttpRequest &req, const ByteBufferChain &body,
+                       bool keepAlive, const SocketAddress &client) {
+    abort();
+    if (req.bodySpilled > 0)
+        mBody = body;
+    else
+        mBody.append(req.body.data(in), req.body.length);
+    forwardHead(in, req, client);
+    mIdempotent = isIdempotent(req.method.data(in), req.method.length);
+    mHeadRequest = req.method.equals(in, "HEAD");
+    mLegacyClient = req.versionMinor < 1;
+    mKeepAlive = keepAlive;
+    mClientKeepAlive = keepAlive;
+    mStatus = 0;
+    mFraming = FRAMING_NONE;
+    mFirst = mProxy.select();
+    mTried = 0;
+    pickUpstream();
+}
+
+// Head of req as it goes to the upstream, into mRequest
+// Headers of the hop are dropped and X-Forwarded-For gets the client. A
+// chunked body was decoded by the parser, it is sent with a Content-Length.
+void ProxyRelay::forwardHead(ByteBuffer &in, const HttpRequest &req, const SocketAddress &client) {
+    mRequest.clear();
+    mRequest.append(req.method.data(in), req.method.length);
+    mRequest += ' ';
+    mRequest.append(req.target.data(in), req.target.length);
+    mRequest += req.versionMinor >= 1 ? " HTTP/1.1\r\n" : " HTTP/1.0\r\n";
+
+    const char *connection = nullptr;
+    size_t connectionLength = 0;
+    const HttpHeader *forwarded = nullptr;
+    for (size_t i = 0; i < req.headerCount; i++) {
+        const HttpHeader &h = req.headers[i];
+        if (h.name.equalsIgnoreCase(in, "Connection")) {
+            connection = h.value.data(in);
+            connectionLength = h.value.length;
+        }
+    }
+    for (size_t i = 0; i < req.headerCount; i++) {
+        const HttpHeader &h = req.headers[i];
+        const char *name = h.name.data(in);
+        if (isHopByHop(name, h.name.length) || tokenEquals(name, h.name.length, "Transfer-Encoding")
+            || tokenEquals(name, h.name.length, "Content-Length") || tokenEquals(name, h.name.length, "Expect"))
+            continue;
+        if (connection && hasToken(connection, connectionLength, h.name.toString(in).c_str()))
+            continue;
+        if (tokenEquals(name, h.name.length, "X-Forwarded-For")) {
+            forwarded = &h;
+            continue;
+        }
+        mRequest.append(name, h.name.length);
+        mRequest += ": ";
+        mRequest.append(h.value.data(in), h.value.length);
+        mRequest += "\r\n";
+    }
+
+    int family = client.getFamily();
+    if (family == AF_INET || family == AF_INET6 || forwarded) {
+        mRequest += "X-Forwarded-For: ";
+        if (forwarded) {
+            mRequest.append(forwarded->value.data(in), forwarded->value.length);
+            if (family == AF_INET || family == AF_INET6)
+                mRequest += ", ";
+        }
+        if (family == AF_INET || family == AF_INET6) {
+            // host:port or [host]:port, the port is dropped
+            std::string addr = client.toString();
+            addr.erase(addr.rfind(':'));
+            if (addr.front() == '[')
+                addr = addr.substr(1, addr.size() - 2);
+            mRequest += addr;
+        }
+        mRequest += "\r\n";
+    }
+    if (req.chunked || req.contentLength > 0 || !mBody.empty())
+        mRequest += "Content-Length: " + std::to_string(mBody.size()) + "\r\n";
+    mRequest += "\r\n";
+}
+
+// Make the next attempt on the upstream after those that failed
+void ProxyRelay::pickUpstream() {
+    size_t n = mProxy.upstreamCount();
+    mUpstream = &mProxy.upstream((mFirst + mTried) % n);
+    mUpstream->active.fetch_add(1, std::memory_order_relaxed);
+    mActive = true;
+    mPhase = PHASE_CONNECT;
+    mFresh = false;
+    mSent = false;
+    mAny = false;
+    mExpired = false;
+}
+
+// Send the request and read the response head, going on to the next
+// upstream when one fails
+//    Return HEAD once the head is read, relay() sends the rest
+//    Return WANT_UPSTREAM_READ or WANT_UPSTREAM_WRITE to wait for the upstream
+//    Return REJECTED once no upstream is left to try
+ProxyRelay::Result ProxyRelay::exchange() {
+    for (;;) {
+        int rc;
+        if (mExpired) {
+            mExpired = false;
+            errno = ETIMEDOUT;
+            rc = -1;
+        } else if (mPhase == PHASE_CONNECT) {
+            rc = connectUpstream();
+            if (rc > 0)
+                return WANT_UPSTREAM_WRITE;
+        } else if (mPhase == PHASE_SEND) {
+            rc = sendRequest();
+        } else {
+            rc = readHead();
+            if (rc == 0)
+                rc = parseHead();
+        }
+        if (rc == 0) {
+            if (mPhase != PHASE_BODY)
+                continue;
+            mBody.clear();
+            return HEAD;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return mPhase == PHASE_HEAD ? WANT_UPSTREAM_READ : WANT_UPSTREAM_WRITE;
+        if (!retry())
+            return REJECTED;
+    }
+}
+
+// Give up on the attempt that failed with errno
+// A reused connection that fails before anything came back was likely
+// closed by the upstream while idle, an idempotent request then goes once
+// more on a new connection. Otherwise the next upstream is tried, unless
+// the request may have been processed already and is not idempotent.
+//    Return false once no attempt is left, status() is 502, or 504 if the
+//    last upstream timed out
+bool ProxyRelay::retry() {
+    int err = errno;
+    if (mConn.reused && !mAny && mIdempotent && (err == ECONNRESET || err == EPIPE)) {
+        mConn.reusable = false;
+        mProxy.pool().release(mConn);
+        mPhase = PHASE_CONNECT;
+        mFresh = true;
+        mSent = false;
+        return true;
+    }
+    mUpstream->failures.fetch_add(1, std::memory_order_relaxed);
+    PD_LOG_WARN("Upstream %s failed: %s", mUpstream->name, std::strerror(err));
+    finish(false);
+    if ((mSent && !mIdempotent) || ++mTried == mProxy.upstreamCount()) {
+        mBody.clear();
+        mStatus = err == ETIMEDOUT ? 504 : 502;
+        return false;
+    }
+    pickUpstream();
+    return true;
+}
+
+// Take a connection to mUpstream from the pool, a new one may still be
+// connecting
+//    Return 0 once connected, 1 while connecting
+//    On error, return -1 and sets errno
+int ProxyRelay::connectUpstream() {
+    ConnectionPool &pool = mProxy.pool();
+    int rc = mConnecting ? pool.finishConnect(mConn)
+                         : pool.open(mUpstream->host, mUpstream->port, mConn, mFresh);
+    mConnecting = rc > 0;
+    if (rc != 0)
+        return rc;
+    // Each attempt sends from a copy, sharing the segments of mBody
+    mOut = mBody;
+    mOut.prepend(mRequest);
+    mPhase = PHASE_SEND;
+    return 0;
+}
+
+// Send what is left of the request
+//    Return 0 once all of it is sent
+//    On error, return -1 and sets errno, EAGAIN if the socket is full
+int ProxyRelay::sendRequest() {
+    msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    while (!mOut.empty()) {
+        iovec iov[CHAIN_MAX_IOV];
+        msg.msg_iov = iov;
+        msg.msg_iovlen = mOut.iov(iov, CHAIN_MAX_IOV);
+        ssize_t n = ::sendmsg(mConn.chan.getFd(), &msg, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        mSent = true;
+        mOut.consume(n);
+    }
+    mPhase = PHASE_HEAD;
+    mHead.clear();
+    return 0;
+}
+
+// Read the response head into mHead, leaving the body on the socket
+// The bytes are peeked first; only those up to the end of the head are
+// then taken off the socket. A head cut short by EAGAIN is continued by
+// the next call.
+//    Return 0 once the head is complete
+//    On error, return -1 and sets errno
+int ProxyRelay::readHead() {
+    int fd = mConn.chan.getFd();
+    for (;;) {
+        size_t have = mHead.size();
+        if (have >= PROXY_MAX_HEAD_BYTES) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        mHead.resize(PROXY_MAX_HEAD_BYTES);
+        ssize_t n = receive(fd, &mHead[have], PROXY_MAX_HEAD_BYTES - have, MSG_PEEK);
+        if (n <= 0) {
+            mHead.resize(have);
+            if (n == 0)
+                errno = ECONNRESET;
+            return -1;
+        }
+        mAny = true;
+        const Byte *base = mHead.data();
+        const Byte *eoh = nio::bytescan::find(base + (have >= 3 ? have - 3 : 0), base + have + n,
+                                              CRLFCRLF, 4);
+        size_t take = eoh ? eoh + 4 - (base + have) : n;
+        if (receive(fd, &mHead[have], take, MSG_WAITALL) != static_cast<ssize_t>(take)) {
+            mHead.resize(have);
+            return -1;
+        }
+        mHead.resize(have + take);
+        if (eoh)
+            return 0;
+    }
+}
+
+// Rewrite the response head in mHead for the client, into mPending, and
+// learn how its body is framed. An interim 1xx response is dropped, the
+// head after it is read next.
+//    Return 0 on success
+//    On error, return -1 and sets errno, EPROTO if malformed
+int ProxyRelay::parseHead() {
+    if (parseResponseHead(mHead.data(), mHead.size(), mResponse) < 0)
+        return -1;
+    mStatus = mResponse.status;
+    if (mStatus >= 100 && mStatus < 200) {
+        mHead.clear();
+        return 0;
+    }
+    mLength = mResponse.contentLength;
+    if (mHeadRequest || mStatus == 204 || mStatus == 304)
+        mFraming = FRAMING_NONE;
+    else if (mResponse.chunked)
+        mFraming = FRAMING_CHUNKED;
+    else if (mResponse.hasLength)
+        mFraming = FRAMING_LENGTH;
+    else
+        mFraming = FRAMING_CLOSE;
+
+    // An HTTP/1.0 client knows no transfer coding. A chunked body reaches it
+    // without the framing and ends with the connection, other codings cannot
+    // be taken off here.
+    bool dropCoding = mLegacyClient && mResponse.transferEncoded;
+    if (dropCoding && mFraming != FRAMING_NONE) {
+        for (const HttpField &f : mResponse.fields) {
+            if (tokenEquals(f.name, f.nameLength, "Transfer-Encoding")
+                && !tokenEquals(f.value, f.valueLength, "chunked")) {
+                errno = EPROTO;
+                return -1;
+            }
+        }
+    }
+    mDechunk = dropCoding && mFraming == FRAMING_CHUNKED;
+
+    mPending.assign("HTTP/1.1 ");
+    mPending += std::to_string(mStatus);
+    mPending += ' ';
+    mPending.append(mResponse.reason, mResponse.reasonLength);
+    mPending += "\r\n";
+    // A Content-Length next to a Transfer-Encoding does not go on
+    for (const HttpField &f : mResponse.fields) {
+        if (isHopByHop(f.name, f.nameLength)
+            || (mResponse.transferEncoded && tokenEquals(f.name, f.nameLength, "Content-Length"))
+            || (dropCoding && tokenEquals(f.name, f.nameLength, "Transfer-Encoding")))
+            continue;
+        mPending.append(f.name, f.nameLength);
+        mPending += ": ";
+        mPending.append(f.value, f.valueLength);
+        mPending += "\r\n";
+    }
+    mUpstreamKeepAlive = mFraming != FRAMING_CLOSE && mResponse.keepAlive;
+    mClientKeepAlive = mKeepAlive && mFraming != FRAMING_CLOSE && !mDechunk;
+    mPending += mClientKeepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    mPendingOff = 0;
+    mLeft = mFraming == FRAMING_LENGTH ? mLength : 0;
+    mInPipe = 0;
+    mTrailers = false;
+    mChunkEnd = false;
+    mEnded = mFraming == FRAMING_NONE || (mFraming == FRAMING_LENGTH && mLength == 0);
+    if (!mEnded && openPipe() < 0)
+        return -1;
+    mPhase = PHASE_BODY;
+    return 0;
+}
+
+// Take one line, up to and including its LF, off the upstream socket into
+// mLine. A line cut short by EAGAIN is continued by the next call.
+//    Return 0 once the line is complete
+//    On error, return -1 and sets errno, EPROTO if too long
+int ProxyRelay::readLine() {
+    int fd = mConn.chan.getFd();
+    for (;;) {
+        char buf[256];
+        ssize_t n = receive(fd, buf, sizeof(buf), MSG_PEEK);
+        if (n <= 0) {
+            if (n == 0)
+                errno = ECONNRESET;
+            return -1;
+        }
+        const char *lf = static_cast<const char*>(std::memchr(buf, '\n', n));
+        size_t take = lf ? lf + 1 - buf : n;
+        if (receive(fd, buf, take, MSG_WAITALL) != static_cast<ssize_t>(take))
+            return -1;
+        mLine.append(buf, take);
+        if (lf)
+            return 0;
+        if (mLine.size() >= PROXY_MAX_LINE_BYTES) {
+            errno = EPROTO;
+            return -1;
+        }
+    }
+}
+
+// Read the next chunk-size or trailer line of a chunked body into mPending
+// A chunk is followed by its CRLF, both are spliced: mLeft counts them.
+// With mDechunk the lines and that CRLF are read but not sent on.
+//    Return 0 on success
+//    On error, return -1 and sets errno
+int ProxyRelay::nextChunk() {
+    if (readLine() < 0)
+        return -1;
+    mPending.swap(mLine);
+    mLine.clear();
+    mPendingOff = 0;
+    bool blank = mPending == "\r\n" || mPending == "\n";
+    if (mTrailers) {
+        mEnded = blank;
+    } else if (mChunkEnd) {
+        if (!blank) {
+            errno = EPROTO;
+            return -1;
+        }
+        mChunkEnd = false;
+    } else {
+        uint64_t size;
+        if (!parseChunkSize(mPending.data(), mPending.size(), size)) {
+            errno = EPROTO;
+            return -1;
+        }
+        if (size == 0)
+            mTrailers = true;
+        else if (mDechunk) {
+            mLeft = size;
+            mChunkEnd = true;
+        } else
+            mLeft = size + 2;
+    }
+    if (mDechunk)
+        mPending.clear();
+    return 0;
+}
+
+// Take the request on as far as the sockets allow, see Result
+// sent is set to the bytes sent to client.
+//    Return DONE once the whole response is sent
+ProxyRelay::Result ProxyRelay::relay(SocketChannel &client, size_t &sent) {
+    sent = 0;
+    if (mPhase != PHASE_BODY)
+        return exchange();
+    if (mExpired) {
+        mExpired = false;
+        errno = ETIMEDOUT;
+        return fail("upstream");
+    }
+    for (;;) {
+        // MSG_MORE and SPLICE_F_MORE keep a small head from leaving alone
+        bool more = !mEnded || mInPipe > 0 || mLeft > 0;
+        while (mPendingOff < mPending.size()) {
+            ssize_t n = ::send(client.getFd(), mPending.data() + mPendingOff,
+                               mPending.size() - mPendingOff, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return WANT_WRITE;
+            if (n < 0)
+                return fail("client");
+            mPendingOff += n;
+            sent += n;
+        }
+        while (mInPipe > 0) {
+            bool last = mEnded && mLeft == 0;
+            ssize_t n = client.spliceFrom(mPipe[0], mInPipe,
+                                          SPLICE_F_NONBLOCK | (last ? 0 : SPLICE_F_MORE));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return WANT_WRITE;
+            if (n <= 0)
+                return fail("client");
+            mInPipe -= n;
+            sent += n;
+        }
+
+        if (mLeft > 0 || (mFraming == FRAMING_CLOSE && !mEnded)) {
+            size_t want = mFraming == FRAMING_CLOSE ? mPipeBytes : std::min<uint64_t>(mLeft, mPipeBytes);
+            ssize_t n;
+            while ((n = mConn.chan.spliceTo(mPipe[1], want)) < 0 && errno == EINTR) {}
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return WANT_UPSTREAM_READ;
+            if (n == 0 && mFraming == FRAMING_CLOSE) {
+                mEnded = true;
+                continue;
+            }
+            if (n == 0)
+                errno = ECONNRESET;
+            if (n <= 0)
+                return fail("upstream");
+            mInPipe = n;
+            if (mFraming != FRAMING_CLOSE) {
+                mLeft -= n;
+                mEnded = mFraming == FRAMING_LENGTH && mLeft == 0;
+            }
+            continue;
+        }
+        if (!mEnded) {
+            if (nextChunk() == 0)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return WANT_UPSTREAM_READ;
+            return fail("upstream");
+        }
+        finish(mUpstreamKeepAlive);
+        return DONE;
+    }
+}
+
+// Give up on the response, closing the upstream connection
+void ProxyRelay::abort() {
+    if (mActive)
+        finish(false);
+}
+
+// Log why the relay failed and abort it
+ProxyRelay::Result ProxyRelay::fail(const char *what) {
+    if (mUpstream)
+        PD_LOG_DEBUG("Relay from upstream %s failed at the %s: %s",
+                     mUpstream->name, what, std::strerror(errno));
+    abort();
+    return FAILED;
+}
+
+// Hand the upstream connection back to the pool, kept if reusable
+void ProxyRelay::finish(bool reusable) {
+    if (mConn.chan.isOpen()) {
+        mConn.reusable = reusable;
+        mProxy.pool().release(mConn);
+    }
+    if (mUpstream) {
+        mUpstream->active.fetch_sub(1, std::memory_order_relaxed);
+        mUpstream = nullptr;
+    }
+    // Bytes left in the pipe belong to this response, the pipe goes with it
+    if (mInPipe > 0)
+        closePipe();
+    mInPipe = 0;
+    mLeft = 0;
+    mOut.clear();
+    mLine.clear();
+    mPending.clear();
+    mPendingOff = 0;
+    mConnecting = false;
+    mExpired = false;
+    mActive = false;
+}
+
+// Open the pipe bodies go through, kept for the next responses
+//    Return 0 on success
+//    On error, return -1 and sets errno
+int ProxyRelay::openPipe() {
+    if (mPipe[0] >= 0)
+        return 0;
+    if (pipe2(mPipe, O_CLOEXEC) < 0)
+        return -1;
+    fcntl(mPipe[0], F_SETPIPE_SZ, PROXY_PIPE_BYTES);
+    int size = fcntl(mPipe[0], F_GETPIPE_SZ);
+    mPipeBytes = size > 0 ? size : 65536;
+    return 0;
+}
+
+void ProxyRelay::closePipe() {
+    if (mPipe[0] >= 0) {
+        ::close(mPipe[0]);
+        ::close(mPipe[1]);
+        mPipe[0] = mPipe[1] = -1;
+    }
+}
+
+} // namespace http
+} // namespace pardus
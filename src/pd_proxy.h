@@ -0,0 +1,180 @@
+#ifndef PD_PROXY_H
+#define PD_PROXY_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pd_net.h"
+#include "pd_http.h"
+#include "pd_http_client.h"
+
+#define PROXY_PIPE_BYTES (256 << 10)    // pipe size asked for, capped by pipe-max-size
+#define PROXY_MAX_HEAD_BYTES 16384      // longest upstream response head accepted
+#define PROXY_MAX_LINE_BYTES 4096       // longest chunk-size or trailer line
+
+namespace pardus {
+namespace http {
+
+// Upstream - Server requests are forwarded to
+struct Upstream {
+    std::string name;       // as configured, for the log
+    std::string host;       // name, address or path of a Unix domain socket
+    int port = 0;
+    std::atomic<int> active{0};     // requests in flight
+    std::atomic<uint64_t> failures{0};
+};
+
+// ReverseProxy - Upstreams requests are balanced over, and their connections
+// Round robin hands requests to the upstreams in turn; least connections
+// picks the one with the fewest requests in flight, in turn among equals.
+// Keep-alive connections to the upstreams are kept in one ConnectionPool,
+// shared by all threads.
+class ReverseProxy {
+public:
+    enum Balance {
+        ROUND_ROBIN,
+        LEAST_CONNECTIONS
+    };
+
+    explicit ReverseProxy(const ClientConfig &config = ClientConfig());
+    ReverseProxy(const ReverseProxy &) = delete;
+    ReverseProxy& operator=(const ReverseProxy &) = delete;
+
+    int addUpstream(const std::string &spec);
+    void balance(Balance mode);
+    static bool parseBalance(const char *name, Balance &mode);
+
+    size_t upstreamCount();
+    Upstream &upstream(size_t i);
+    size_t select();
+    ConnectionPool &pool();
+
+private:
+    std::vector<std::unique_ptr<Upstream>> mUpstreams;
+    Balance mBalance = ROUND_ROBIN;
+    std::atomic<size_t> mNext{0};
+    ConnectionPool mPool;
+};
+
+// ProxyRelay - Forwards the requests of one client connection, one at a time
+// start() takes a request, its head rewritten and put in front of its body
+// in a ByteBufferChain. relay() then takes it as far as the sockets allow:
+// it takes a pooled upstream connection or connects a new one, sends the
+// request with writev() of the segments and reads back the response head,
+// returning HEAD once it is rewritten for the client. The next calls send
+// that head and move the body from the upstream socket to the client
+// socket through a pipe with splice(), so payload bytes never enter user
+// space. Of a chunked body only the chunk-size lines are read, peeked first
+// so that no body byte is consumed with them.
+// The upstream socket is non-blocking: relay() returns WANT_UPSTREAM_READ
+// or WANT_UPSTREAM_WRITE when it has to wait for it. The caller waits for
+// upstream() to be ready for up to timeoutMs(), then calls relay() again,
+// after expire() if the time ran out. The client socket may be blocking;
+// a non-blocking one makes relay() return WANT_WRITE when it is full.
+class ProxyRelay {
+public:
+    enum Result {
+        DONE,
+        HEAD,                   // the response head was read, status() is known
+        WANT_WRITE,             // the client socket is full
+        WANT_UPSTREAM_READ,
+        WANT_UPSTREAM_WRITE,
+        REJECTED,               // no upstream took the request, answer it with status()
+        FAILED                  // either connection failed, the client has to close
+    };
+
+    explicit ProxyRelay(ReverseProxy &proxy);
+    ProxyRelay(const ProxyRelay &) = delete;
+    ProxyRelay& operator=(const ProxyRelay &) = delete;
+    ~ProxyRelay();
+
+    void start(ByteBuffer &in, const HttpRequest &req, const ByteBufferChain &body, bool keepAlive,
+               const SocketAddress &client);
+    Result relay(SocketChannel &client, size_t &sent);
+    void expire();
+    void abort();
+
+    bool isActive();
+    int status();
+    size_t contentLength();
+    bool closesClient();
+    SocketChannel *upstream();
+    int timeoutMs();
+
+private:
+    enum Phase {
+        PHASE_CONNECT,      // taking a connection to mUpstream
+        PHASE_SEND,         // sending the request
+        PHASE_HEAD,         // reading the response head
+        PHASE_BODY          // relaying the response
+    };
+
+    enum Framing {
+        FRAMING_NONE,
+        FRAMING_LENGTH,
+        FRAMING_CHUNKED,
+        FRAMING_CLOSE       // the body ends with the connection
+    };
+
+    void forwardHead(ByteBuffer &in, const HttpRequest &req, const SocketAddress &client);
+    Result exchange();
+    void pickUpstream();
+    bool retry();
+    int connectUpstream();
+    int sendRequest();
+    int readHead();
+    int parseHead();
+    int readLine();
+    int nextChunk();
+    int openPipe();
+    void closePipe();
+    void finish(bool reusable);
+    Result fail(const char *what);
+
+private:
+    ReverseProxy &mProxy;
+    Upstream *mUpstream = nullptr;
+    PooledConnection mConn;
+    int mPipe[2] = {-1, -1};
+    size_t mPipeBytes = 0;      // capacity of the pipe
+    std::string mRequest;       // head of the forwarded request
+    ByteBufferChain mBody;      // body of the forwarded request
+    ByteBufferChain mOut;       // request bytes still to send on this attempt
+    std::string mHead;          // upstream response head as received
+    HttpResponseHead mResponse; // mHead parsed
+    std::string mLine;          // chunk-size or trailer line being read
+    std::string mPending;       // response head or chunk framing still to send
+    size_t mPendingOff = 0;
+    Phase mPhase = PHASE_CONNECT;
+    Framing mFraming = FRAMING_NONE;
+    size_t mFirst = 0;          // upstream tried first
+    size_t mTried = 0;          // upstreams that failed the request
+    bool mActive = false;
+    bool mConnecting = false;   // a connect of open() is going on
+    bool mFresh = false;        // this attempt takes a new connection
+    bool mSent = false;         // the request may have reached the upstream
+    bool mAny = false;          // anything came back from the upstream
+    bool mExpired = false;      // the upstream took longer than timeoutMs()
+    bool mIdempotent = false;
+    bool mHeadRequest = false;
+    bool mLegacyClient = false; // the client speaks HTTP/1.0
+    bool mDechunk = false;      // chunk framing is taken off for the client
+    bool mKeepAlive = false;    // the client asked for it
+    bool mUpstreamKeepAlive = false;
+    bool mClientKeepAlive = false;
+    bool mTrailers = false;     // reading the trailer section of a chunked body
+    bool mChunkEnd = false;     // the CRLF after a chunk is read next
+    bool mEnded = false;        // the whole body was read from upstream
+    int mStatus = 0;
+    uint64_t mLength = 0;       // of a FRAMING_LENGTH body
+    uint64_t mLeft = 0;         // bytes to splice before the next framing
+    size_t mInPipe = 0;
+};
+
+} // namespace http
+} // namespace pardus
+
+
+#endif //PD_PROXY_H
@@ -0,0 +1,260 @@
+#include "pd_selector.h"
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+
+#define MAX_EVENTS 1024
+
+namespace pardus {
+namespace nio {
+
+/******************************
+* SelectionKey implementation
+******************************/
+SelectionKey::SelectionKey(Selector *sel, SelectableChannel *chan, int ops,
+                           bool edgeTriggered, void *att)
+        : mSelector(sel), mChannel(chan), mFd(chan->getFd()),
+          mInterestOps(ops), mEdgeTriggered(edgeTriggered), mAttachment(att) {}
+
+SelectableChannel* SelectionKey::channel() {
+    return mChannel;
+}
+
+Selector* SelectionKey::selector() {
+    return mSelector;
+}
+
+// Get interest set
+int SelectionKey::interestOps() {
+    return mInterestOps;
+}
+
+// Set interest set, it takes effect on the next select()
+//    Return 0 on success, -1 on error
+int SelectionKey::interestOps(int ops) {
+    if(!mValid)
+        throw std::runtime_error("Cancelled selection key");
+    if(ops == mInterestOps)
+        return 0;
+    mInterestOps = ops;
+    return mSelector->updateKey(this);
+}
+
+// Ready set filled in by the last select()
+int SelectionKey::readyOps() {
+    return mReadyOps;
+}
+
+bool SelectionKey::isReadable() {
+    return (mReadyOps & OP_READ) != 0;
+}
+
+bool SelectionKey::isWritable() {
+    return (mReadyOps & OP_WRITE) != 0;
+}
+
+bool SelectionKey::isAcceptable() {
+    return (mReadyOps & OP_ACCEPT) != 0;
+}
+
+bool SelectionKey::isConnectable() {
+    return (mReadyOps & OP_CONNECT) != 0;
+}
+
+bool SelectionKey::isValid() {
+    return mValid;
+}
+
+bool SelectionKey::isEdgeTriggered() {
+    return mEdgeTriggered;
+}
+
+void* SelectionKey::attachment() {
+    return mAttachment;
+}
+
+// Attach an object, return the previous one
+void* SelectionKey::attach(void *ob) {
+    void *prev = mAttachment;
+    mAttachment = ob;
+    return prev;
+}
+
+// Deregister the channel. Must be called before the channel is closed.
+void SelectionKey::cancel() {
+    if(mValid)
+        mSelector->cancelKey(this);
+}
+
+
+/**************************
+* Selector implementation
+**************************/
+Selector::Selector() : mEvents(MAX_EVENTS) {
+    if((mEpollFd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        throw std::runtime_error("Selector epoll_create failed");
+
+    // eventfd used by wakeup(), registered with a null data pointer
+    if((mWakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0){
+        ::close(mEpollFd);
+        throw std::runtime_error("Selector eventfd failed");
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeupFd, &ev);
+}
+
+Selector::~Selector() {
+    close();
+}
+
+uint32_t Selector::toEpollEvents(int ops, bool edgeTriggered) {
+    uint32_t events = 0;
+    if(ops & (SelectionKey::OP_READ | SelectionKey::OP_ACCEPT))
+        events |= EPOLLIN | EPOLLRDHUP;
+    if(ops & (SelectionKey::OP_WRITE | SelectionKey::OP_CONNECT))
+        events |= EPOLLOUT;
+    if(edgeTriggered)
+        events |= EPOLLET;
+    return events;
+}
+
+// Register chan with interest set ops
+//    Return the new key
+//    On error, return nullptr and sets errno
+SelectionKey* Selector::registerChannel(SelectableChannel &chan, int ops,
+                                        void *att, bool edgeTriggered) {
+    if(!isOpen())
+        throw std::runtime_error("Selector is closed");
+    if(chan.isBlocking())
+        throw std::runtime_error("Channel must be in non-blocking mode");
+
+    std::unique_ptr<SelectionKey> key(new SelectionKey(this, &chan, ops, edgeTriggered, att));
+    epoll_event ev{};
+    ev.events = toEpollEvents(ops, edgeTriggered);
+    ev.data.ptr = key.get();
+    if(epoll_ctl(mEpollFd, EPOLL_CTL_ADD, key->mFd, &ev) < 0)
+        return nullptr;
+
+    SelectionKey *ret = key.get();
+    mKeys.emplace(ret, std::move(key));
+    return ret;
+}
+
+int Selector::updateKey(SelectionKey *key) {
+    epoll_event ev{};
+    ev.events = toEpollEvents(key->mInterestOps, key->mEdgeTriggered);
+    ev.data.ptr = key;
+    return epoll_ctl(mEpollFd, EPOLL_CTL_MOD, key->mFd, &ev);
+}
+
+void Selector::cancelKey(SelectionKey *key) {
+    auto it = mKeys.find(key);
+    if(it == mKeys.end())
+        return;
+    // The fd may be closed already, in which case epoll dropped it by itself
+    epoll_ctl(mEpollFd, EPOLL_CTL_DEL, key->mFd, nullptr);
+    key->mValid = false;
+    key->mReadyOps = 0;
+    mCancelled.push_back(std::move(it->second));
+    mKeys.erase(it);
+}
+
+// Block until at least one channel is ready or wakeup() is called
+//    Return number of keys selected
+int Selector::select() {
+    return doSelect(-1);
+}
+
+// Block for at most timeoutMs milliseconds
+int Selector::select(long timeoutMs) {
+    return doSelect(timeoutMs < 0 ? -1 : static_cast<int>(timeoutMs));
+}
+
+// Non-blocking select
+int Selector::selectNow() {
+    return doSelect(0);
+}
+
+int Selector::doSelect(int timeoutMs) {
+    if(!isOpen())
+        throw std::runtime_error("Selector is closed");
+    mCancelled.clear();
+    mSelected.clear();
+
+    int n = epoll_wait(mEpollFd, mEvents.data(), static_cast<int>(mEvents.size()), timeoutMs);
+    if(n < 0){
+        if(errno == EINTR)
+            return 0;
+        return -1;
+    }
+
+    for(int i = 0; i < n; i++){
+        SelectionKey *key = static_cast<SelectionKey*>(mEvents[i].data.ptr);
+        if(key == nullptr){
+            uint64_t val;
+            while(::read(mWakeupFd, &val, sizeof(val)) > 0);
+            continue;
+        }
+
+        uint32_t events = mEvents[i].events;
+        int ready = 0;
+        if(events & EPOLLIN)
+            ready |= key->mInterestOps & (SelectionKey::OP_READ | SelectionKey::OP_ACCEPT);
+        if(events & EPOLLOUT)
+            ready |= key->mInterestOps & (SelectionKey::OP_WRITE | SelectionKey::OP_CONNECT);
+        // Report errors and hangups as readiness, the following read/write surfaces them
+        if(events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+            ready |= key->mInterestOps;
+        key->mReadyOps = ready;
+        if(ready)
+            mSelected.push_back(key);
+    }
+
+    // Grow the event array when it was saturated
+    if(static_cast<size_t>(n) == mEvents.size())
+        mEvents.resize(mEvents.size() * 2);
+    return static_cast<int>(mSelected.size());
+}
+
+// Keys that became ready during the last select()
+std::vector<SelectionKey*>& Selector::selectedKeys() {
+    return mSelected;
+}
+
+// Number of registered keys
+size_t Selector::keyCount() {
+    return mKeys.size();
+}
+
+// Make a blocking select() return immediately, callable from any thread
+void Selector::wakeup() {
+    uint64_t one = 1;
+    if(mWakeupFd >= 0)
+        ::write(mWakeupFd, &one, sizeof(one));
+}
+
+void Selector::close() {
+    if(mEpollFd >= 0){
+        for(auto &kv : mKeys)
+            kv.second->mValid = false;
+        mKeys.clear();
+        mCancelled.clear();
+        mSelected.clear();
+        ::close(mWakeupFd);
+        ::close(mEpollFd);
+        mWakeupFd = -1;
+        mEpollFd = -1;
+    }
+}
+
+bool Selector::isOpen() {
+    return mEpollFd >= 0;
+}
+
+} // namespace nio
+} // namespace pardus
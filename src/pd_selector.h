@@ -0,0 +1,103 @@
+#ifndef PD_SELECTOR_H
+#define PD_SELECTOR_H
+
+#include <sys/epoll.h>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+#include "pd_net.h"
+
+namespace pardus {
+namespace nio {
+
+class Selector;
+
+// SelectionKey - Registration of a SelectableChannel with a Selector
+// A key stays valid until it is cancelled; cancelled keys are released
+// by the next select(), so it's safe to cancel while iterating selectedKeys().
+class SelectionKey {
+public:
+    enum Ops {
+        OP_READ = 1 << 0,
+        OP_WRITE = 1 << 2,
+        OP_CONNECT = 1 << 3,
+        OP_ACCEPT = 1 << 4
+    };
+
+    SelectionKey(const SelectionKey &) = delete;
+    SelectionKey& operator=(const SelectionKey &) = delete;
+
+    SelectableChannel *channel();
+    Selector *selector();
+    int interestOps();
+    int interestOps(int ops);
+    int readyOps();
+    bool isReadable();
+    bool isWritable();
+    bool isAcceptable();
+    bool isConnectable();
+    bool isValid();
+    bool isEdgeTriggered();
+    void *attachment();
+    void *attach(void *ob);
+    void cancel();
+
+private:
+    friend class Selector;
+    SelectionKey(Selector *sel, SelectableChannel *chan, int ops,
+                 bool edgeTriggered, void *att);
+
+private:
+    Selector *mSelector;
+    SelectableChannel *mChannel;
+    int mFd;
+    int mInterestOps;
+    int mReadyOps = 0;
+    bool mEdgeTriggered;
+    bool mValid = true;
+    void *mAttachment;
+};
+
+
+// Selector - Multiplexor of SelectableChannels, backed by Linux epoll
+// Registered channels must not move in memory until their key is cancelled.
+class Selector {
+public:
+    Selector();
+    Selector(const Selector &) = delete;
+    Selector& operator=(const Selector &) = delete;
+    ~Selector();
+
+    SelectionKey *registerChannel(SelectableChannel &chan, int ops,
+                                  void *att = nullptr, bool edgeTriggered = false);
+    int select();
+    int select(long timeoutMs);
+    int selectNow();
+    std::vector<SelectionKey*> &selectedKeys();
+    size_t keyCount();
+    void wakeup();
+    void close();
+    bool isOpen();
+
+private:
+    friend class SelectionKey;
+    int doSelect(int timeoutMs);
+    int updateKey(SelectionKey *key);
+    void cancelKey(SelectionKey *key);
+    static uint32_t toEpollEvents(int ops, bool edgeTriggered);
+
+private:
+    int mEpollFd = -1;
+    int mWakeupFd = -1;
+    std::vector<epoll_event> mEvents;
+    std::vector<SelectionKey*> mSelected;
+    std::unordered_map<SelectionKey*, std::unique_ptr<SelectionKey>> mKeys;
+    std::vector<std::unique_ptr<SelectionKey>> mCancelled;
+};
+
+} // namespace nio
+} // namespace pardus
+
+
+#endif //PD_SELECTOR_H
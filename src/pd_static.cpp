@@ -0,0 +1,247 @@
+#include "pd_static.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <strings.h>
+#include <cerrno>
+
+namespace pardus {
+namespace http {
+
+namespace {
+
+struct MimeType {
+    const char *ext;
+    const char *type;
+};
+
+const MimeType mime_types[] = {
+    {"html", "text/html; charset=utf-8"},
+    {"htm", "text/html; charset=utf-8"},
+    {"css", "text/css; charset=utf-8"},
+    {"js", "text/javascript; charset=utf-8"},
+    {"json", "application/json"},
+    {"txt", "text/plain; charset=utf-8"},
+    {"xml", "application/xml"},
+    {"svg", "image/svg+xml"},
+    {"png", "image/png"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"webp", "image/webp"},
+    {"ico", "image/x-icon"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"wasm", "application/wasm"},
+    {"pdf", "application/pdf"},
+};
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+} // namespace
+
+
+/***************************
+* StaticFile implementation
+**************************/
+StaticFile::~StaticFile() {
+    if (fd >= 0)
+        ::close(fd);
+}
+
+// Give up ownership of the descriptor
+int StaticFile::release() {
+    int ret = fd;
+    fd = -1;
+    return ret;
+}
+
+
+/*********************************
+* StaticFileHandler implementation
+*********************************/
+StaticFileHandler::StaticFileHandler(const std::string &docRoot, size_t cacheBytes,
+                                     size_t cacheFileBytes)
+        : mDocRoot(docRoot), mCache(docRoot, cacheBytes, cacheFileBytes) {
+    mRootFd = ::open(docRoot.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+StaticFileHandler::~StaticFileHandler() {
+    if (mRootFd >= 0)
+        ::close(mRootFd);
+}
+
+// False if the document root could not be opened
+bool StaticFileHandler::isOpen() {
+    return mRootFd >= 0;
+}
+
+const std::string& StaticFileHandler::docRoot() {
+    return mDocRoot;
+}
+
+FileCache& StaticFileHandler::cache() {
+    return mCache;
+}
+
+// Turn request target [target, target+length) into a path relative to the
+// document root, written to path[0, size)
+//    Return 0 on success
+//    Return the HTTP status to answer otherwise, 400 or 404
+int StaticFileHandler::resolve(const char *target, size_t length, char *path, size_t size) {
+    if (length == 0 || target[0] != '/')
+        return 400;
+
+    size_t n = 0;
+    size_t segment = 0;   // start of the current segment in path
+    for (size_t i = 1; i <= length; i++) {
+        char c = i < length ? target[i] : '\0';
+        if (c == '?' || c == '#')
+            c = '\0';
+        if (c == '%') {
+            int hi = i + 2 < length ? hexValue(target[i + 1]) : -1;
+            int lo = i + 2 < length ? hexValue(target[i + 2]) : -1;
+            if (hi < 0 || lo < 0)
+                return 400;
+            c = static_cast<char>(hi << 4 | lo);
+            if (c == '\0' || c == '/')
+                return 404;
+            i += 2;
+        } else if (c == '/' || c == '\0') {
+            // Segment ended, reject "..", drop "." and empty ones
+            size_t len = n - segment;
+            if (len == 2 && path[segment] == '.' && path[segment + 1] == '.')
+                return 404;
+            if (len == 0 || (len == 1 && path[segment] == '.')) {
+                n = segment;
+                if (c == '\0')
+                    break;
+                continue;
+            }
+            if (c == '\0')
+                break;
+        }
+        if (n + 1 >= size)
+            return 404;
+        path[n++] = c;
+        if (c == '/')
+            segment = n;
+    }
+
+    // A trailing slash means the directory index
+    if (n == 0 || path[n - 1] == '/') {
+        const char index[] = "index.html";
+        if (n + sizeof(index) > size)
+            return 404;
+        std::memcpy(path + n, index, sizeof(index));
+        n += sizeof(index) - 1;
+    }
+    path[n] = '\0';
+    return 0;
+}
+
+// Content-Type of path, from its extension
+const char* StaticFileHandler::contentType(const char *path) {
+    const char *dot = std::strrchr(path, '.');
+    if (dot && !std::strchr(dot, '/')) {
+        for (const MimeType &m : mime_types) {
+            if (strcasecmp(dot + 1, m.ext) == 0)
+                return m.type;
+        }
+    }
+    return "application/octet-stream";
+}
+
+// Open the regular file named by target
+//    Return 0 on success
+//    Return the HTTP status to answer otherwise, e.g. 404
+int StaticFileHandler::open(ByteBuffer &buf, const Slice &target, StaticFile &file) {
+    if (mRootFd < 0)
+        return 404;
+    char path[PATH_MAX];
+    int status = resolve(target.data(buf), target.length, path, sizeof(path));
+    if (status != 0)
+        return status;
+
+    // A hit is answered without touching the filesystem
+    uint64_t epoch = 0;
+    bool cacheable = false;
+    if (mCache.isEnabled()) {
+        file.asset = mCache.get(path, std::strlen(path));
+        if (file.asset)
+            return 0;
+        cacheable = mCache.watch(path, epoch);
+    }
+
+    int fd = ::openat(mRootFd, path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+        return errno == EACCES ? 403 : 404;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        ::close(fd);
+        return 500;
+    }
+
+    // Directory named without a trailing slash, serve its index
+    if (S_ISDIR(st.st_mode)) {
+        cacheable = false;
+        int dirfd = fd;
+        fd = ::openat(dirfd, "index.html", O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        ::close(dirfd);
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            if (fd >= 0)
+                ::close(fd);
+            return 404;
+        }
+        std::strncat(path, "/index.html", sizeof(path) - std::strlen(path) - 1);
+    }
+    if (!S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return 404;
+    }
+
+    file.fd = fd;
+    file.size = st.st_size;
+    file.mtime = st.st_mtime;
+    file.contentType = contentType(path);
+    if (cacheable && static_cast<size_t>(st.st_size) <= mCache.maxFileBytes())
+        load(file, path, epoch);
+    return 0;
+}
+
+// Read the open file into a CachedAsset and add it to the cache
+// On success the descriptor is closed and file.asset is set.
+//    Return false if the file could not be read whole
+bool StaticFileHandler::load(StaticFile &file, const char *path, uint64_t epoch) {
+    std::string body(static_cast<size_t>(file.size), '\0');
+    size_t done = 0;
+    while (done < body.size()) {
+        ssize_t n = ::pread(file.fd, &body[done], body.size() - done, done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+
+    std::shared_ptr<const CachedAsset> asset =
+            CachedAsset::build(path, std::move(body), file.mtime, file.contentType);
+    mCache.put(asset, epoch);
+    file.asset = std::move(asset);
+    ::close(file.release());
+    return true;
+}
+
+} // namespace http
+} // namespace pardus
@@ -0,0 +1,65 @@
+#ifndef PD_STATIC_H
+#define PD_STATIC_H
+
+#include <string>
+#include <memory>
+#include <sys/types.h>
+
+#include "pd_http.h"
+#include "pd_filecache.h"
+
+namespace pardus {
+namespace http {
+
+// StaticFile - File selected by StaticFileHandler::open()
+// Either asset is set and the file is served from memory, or fd is open.
+// The descriptor is closed by the destructor unless it is released.
+struct StaticFile {
+    std::shared_ptr<const CachedAsset> asset;
+    int fd = -1;
+    off_t size = 0;
+    time_t mtime = 0;
+    const char *contentType = nullptr;
+
+    StaticFile() = default;
+    StaticFile(const StaticFile &) = delete;
+    StaticFile& operator=(const StaticFile &) = delete;
+    ~StaticFile();
+    int release();
+};
+
+// StaticFileHandler - Maps request targets to files under a document root
+// Targets are percent-decoded, the query is dropped and any ".." segment is
+// rejected, so no path can resolve outside the document root. A target that
+// names a directory serves its index.html. Files up to cacheFileBytes are
+// kept in a FileCache of cacheBytes.
+class StaticFileHandler {
+public:
+    explicit StaticFileHandler(const std::string &docRoot, size_t cacheBytes = 0,
+                               size_t cacheFileBytes = 0);
+    StaticFileHandler(const StaticFileHandler &) = delete;
+    StaticFileHandler& operator=(const StaticFileHandler &) = delete;
+    ~StaticFileHandler();
+
+    bool isOpen();
+    const std::string &docRoot();
+    FileCache &cache();
+    int open(ByteBuffer &buf, const Slice &target, StaticFile &file);
+
+    static int resolve(const char *target, size_t length, char *path, size_t size);
+    static const char *contentType(const char *path);
+
+private:
+    bool load(StaticFile &file, const char *path, uint64_t epoch);
+
+private:
+    std::string mDocRoot;
+    int mRootFd = -1;
+    FileCache mCache;
+};
+
+} // namespace http
+} // namespace pardus
+
+
+#endif //PD_STATIC_H
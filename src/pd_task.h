@@ -0,0 +1,151 @@
+#ifndef PD_TASK_H
+#define PD_TASK_H
+
+#include <new>
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+
+// Inline storage of a Task, enough for a lambda capturing a SocketChannel
+// and a few pointers
+#define TASK_INLINE_SIZE 192
+
+namespace pardus {
+namespace threadpool{
+
+// Task - Move-only void() callable with inline small-buffer storage
+// Callables up to TASK_INLINE_SIZE bytes that are nothrow movable live
+// inside the Task, so wrapping them never allocates. Larger ones fall
+// back to the heap. Unlike std::function, move-only captures are accepted.
+class Task {
+public:
+    Task() = default;
+    Task(std::nullptr_t) {}
+    template <class Fn, class = typename std::enable_if<
+            !std::is_same<typename std::decay<Fn>::type, Task>::value>::type>
+    Task(Fn&& fn);
+    Task(const Task &) = delete;
+    Task& operator=(const Task &) = delete;
+    Task(Task &&src) noexcept;
+    Task& operator=(Task &&src) noexcept;
+    Task& operator=(std::nullptr_t);
+    ~Task();
+
+    void operator()();
+    explicit operator bool() const;
+
+    // True if a callable of type Fn is stored without allocation
+    template <class Fn>
+    static constexpr bool fitsInline();
+
+private:
+    struct Ops {
+        void (*invoke)(void *storage);
+        void (*move)(void *dst, void *src);
+        void (*destroy)(void *storage);
+    };
+    template <class Fn> struct InlineOps;
+    template <class Fn> struct HeapOps;
+
+    void reset();
+
+    typename std::aligned_storage<TASK_INLINE_SIZE, alignof(std::max_align_t)>::type mStorage;
+    const Ops *mOps = nullptr;
+};
+
+// Callable stored in mStorage
+template <class Fn>
+struct Task::InlineOps {
+    static void invoke(void *s) { (*static_cast<Fn*>(s))(); }
+    static void move(void *dst, void *src) {
+        ::new(dst) Fn(std::move(*static_cast<Fn*>(src)));
+        static_cast<Fn*>(src)->~Fn();
+    }
+    static void destroy(void *s) { static_cast<Fn*>(s)->~Fn(); }
+    static const Ops ops;
+};
+
+template <class Fn>
+const Task::Ops Task::InlineOps<Fn>::ops = {invoke, move, destroy};
+
+// Callable on the heap, mStorage holds the pointer
+template <class Fn>
+struct Task::HeapOps {
+    static void invoke(void *s) { (**static_cast<Fn**>(s))(); }
+    static void move(void *dst, void *src) {
+        *static_cast<Fn**>(dst) = *static_cast<Fn**>(src);
+    }
+    static void destroy(void *s) { delete *static_cast<Fn**>(s); }
+    static const Ops ops;
+};
+
+template <class Fn>
+const Task::Ops Task::HeapOps<Fn>::ops = {invoke, move, destroy};
+
+template <class Fn>
+constexpr bool Task::fitsInline() {
+    return sizeof(Fn) <= TASK_INLINE_SIZE
+           && alignof(std::max_align_t) % alignof(Fn) == 0
+           && std::is_nothrow_move_constructible<Fn>::value;
+}
+
+template <class Fn, class>
+Task::Task(Fn&& fn) {
+    typedef typename std::decay<Fn>::type Callable;
+    if (fitsInline<Callable>()) {
+        ::new(&mStorage) Callable(std::forward<Fn>(fn));
+        mOps = &InlineOps<Callable>::ops;
+    } else {
+        *reinterpret_cast<Callable**>(&mStorage) = new Callable(std::forward<Fn>(fn));
+        mOps = &HeapOps<Callable>::ops;
+    }
+}
+
+inline Task::Task(Task &&src) noexcept {
+    if (src.mOps) {
+        src.mOps->move(&mStorage, &src.mStorage);
+        mOps = src.mOps;
+        src.mOps = nullptr;
+    }
+}
+
+inline Task& Task::operator=(Task &&src) noexcept {
+    if (this != &src) {
+        reset();
+        if (src.mOps) {
+            src.mOps->move(&mStorage, &src.mStorage);
+            mOps = src.mOps;
+            src.mOps = nullptr;
+        }
+    }
+    return *this;
+}
+
+inline Task& Task::operator=(std::nullptr_t) {
+    reset();
+    return *this;
+}
+
+inline Task::~Task() {
+    reset();
+}
+
+inline void Task::reset() {
+    if (mOps) {
+        mOps->destroy(&mStorage);
+        mOps = nullptr;
+    }
+}
+
+inline void Task::operator()() {
+    mOps->invoke(&mStorage);
+}
+
+inline Task::operator bool() const {
+    return mOps != nullptr;
+}
+
+}// namespace threadpool
+}// namespace pardus
+
+#endif //PD_TASK_H
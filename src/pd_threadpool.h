@@ -1,33 +1,81 @@
+#ifndef PD_THREADPOOL_H
+#define PD_THREADPOOL_H
+
 #include <mutex>
-#include <queue>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <future>
 #include <thread>
 #include <functional>
+#include <type_traits>
 #include <condition_variable>
 
+#include "pd_task.h"
+
 namespace pardus {
 namespace threadpool{
 
-typedef std::function<void()> Task;
-
+// ThreadPool - Work stealing thread pool
+// Every worker owns a deque. Workers pop their own deque from the back (LIFO)
+// and steal from the front of a random victim when it runs dry. Tasks
+// submitted by a worker go to its own deque without touching shared state,
+// other submitters spread tasks round-robin over the workers.
 class ThreadPool {
 public:
     ThreadPool() = default;
     ThreadPool(ThreadPool&&) = default;
     explicit ThreadPool(size_t size);
     ~ThreadPool();
+    template <class Fn>
+    void execute(Fn&& fn);
     template <class Fn, class... Args>
-    void submit(Fn&& fn, Args&&... args);
+    auto submit(Fn&& fn, Args&&... args)
+        -> std::future<typename std::result_of<Fn(Args...)>::type>;
+    size_t size();
+    size_t pending();
 private:
+    // Growable ring buffer of tasks, it does not allocate in steady state
+    class TaskDeque {
+    public:
+        bool empty() { return mCount == 0; }
+        void pushBack(Task task);
+        Task popBack();
+        Task popFront();
+    private:
+        std::vector<Task> mRing;
+        size_t mHead = 0;
+        size_t mCount = 0;
+    };
+    struct Worker {
+        std::mutex mMutex;
+        TaskDeque mTasks;
+    };
     struct Pool {
+        std::vector<std::unique_ptr<Worker>> mWorkers;
         std::mutex mMutex;
         std::condition_variable mCV;
         bool mIsShutdown = false;
-        std::queue<Task> taskQueue;
+        std::atomic<size_t> mPending{0};
+        std::atomic<size_t> mIdle{0};
+        std::atomic<size_t> mNext{0};
+
+        void push(Task task);
+        bool pop(size_t index, Task &task);
+        bool steal(size_t index, uint32_t &seed, Task &task);
+    };
+    // Worker the calling thread belongs to, if any
+    struct Current {
+        Pool *mPool = nullptr;
+        size_t mIndex = 0;
     };
+    static Current &current();
+    static void run(std::shared_ptr<Pool> p, size_t index);
+
     std::shared_ptr<Pool> mPool;
 };
 
-ThreadPool::~ThreadPool() {
+inline ThreadPool::~ThreadPool() {
     if (mPool) {
         {
             std::lock_guard<std::mutex> lck(mPool->mMutex);
@@ -37,37 +85,149 @@ ThreadPool::~ThreadPool() {
     }
 }
 
+// Run fn() on the pool, fire and forget
+// Small closures are stored inline in the Task, so this does not allocate
+template <class Fn>
+void ThreadPool::execute(Fn&& fn) {
+    mPool->push(Task(std::forward<Fn>(fn)));
+}
+
+// Submit fn(args...), return a future of its result
 template <class Fn, class... Args>
-void ThreadPool::submit(Fn&& fn, Args&&... args) {
-    auto task = std::bind(std::forward<Fn>(fn), std::forward<Args>(args)...);
+auto ThreadPool::submit(Fn&& fn, Args&&... args)
+        -> std::future<typename std::result_of<Fn(Args...)>::type> {
+    typedef typename std::result_of<Fn(Args...)>::type Result;
+    std::packaged_task<Result()> task(
+            std::bind(std::forward<Fn>(fn), std::forward<Args>(args)...));
+    std::future<Result> ret = task.get_future();
+    mPool->push(Task(std::move(task)));
+    return ret;
+}
+
+// Number of workers
+inline size_t ThreadPool::size() {
+    return mPool ? mPool->mWorkers.size() : 0;
+}
+
+// Number of tasks queued and not started yet
+inline size_t ThreadPool::pending() {
+    return mPool ? mPool->mPending.load(std::memory_order_relaxed) : 0;
+}
+
+inline void ThreadPool::TaskDeque::pushBack(Task task) {
+    if (mCount == mRing.size()) {
+        std::vector<Task> ring(mRing.empty() ? 64 : mRing.size() * 2);
+        for (size_t i = 0; i < mCount; ++i)
+            ring[i] = std::move(mRing[(mHead + i) % mRing.size()]);
+        mRing.swap(ring);
+        mHead = 0;
+    }
+    mRing[(mHead + mCount) % mRing.size()] = std::move(task);
+    ++mCount;
+}
+
+inline Task ThreadPool::TaskDeque::popBack() {
+    --mCount;
+    return std::move(mRing[(mHead + mCount) % mRing.size()]);
+}
+
+inline Task ThreadPool::TaskDeque::popFront() {
+    Task task = std::move(mRing[mHead]);
+    mHead = (mHead + 1) % mRing.size();
+    --mCount;
+    return task;
+}
+
+inline ThreadPool::Current& ThreadPool::current() {
+    static thread_local Current cur;
+    return cur;
+}
+
+inline void ThreadPool::Pool::push(Task task) {
+    Current &cur = current();
+    size_t index = cur.mPool == this
+                   ? cur.mIndex
+                   : mNext.fetch_add(1, std::memory_order_relaxed) % mWorkers.size();
+    // Counted before it is visible, so the decrement of whoever takes it can
+    // never run first and wrap the counter. Pairs with the mIdle increment
+    // of a parking worker: either it sees this task pending, or we see it
+    // idle and wake it up.
+    mPending.fetch_add(1);
     {
-        std::lock_guard<std::mutex> lck(mPool->mMutex);
-        mPool->taskQueue.emplace(task);
+        Worker &w = *mWorkers[index];
+        std::lock_guard<std::mutex> lck(w.mMutex);
+        w.mTasks.pushBack(std::move(task));
+    }
+    if (mIdle.load() > 0) {
+        std::lock_guard<std::mutex> lck(mMutex);
+        mCV.notify_one();
     }
-    mPool->mCV.notify_one();
 }
 
-ThreadPool::ThreadPool(size_t size)
-        : mPool(std::make_shared<Pool>()) {
-    for (size_t i = 0; i < size; ++i) {
-        std::thread([p = mPool] {
-            std::unique_lock<std::mutex> lck(p->mMutex);
-            for (;;) {
-                if (!p->taskQueue.empty()) {
-                    auto task = std::move(p->taskQueue.front());
-                    p->taskQueue.pop();
-                    lck.unlock();
-                    task();
-                    lck.lock();
-                } else if (p->mIsShutdown) {
-                    break;
-                } else {
-                    p->mCV.wait(lck);
-                }
-            }
-        }).detach();
+inline bool ThreadPool::Pool::pop(size_t index, Task &task) {
+    Worker &w = *mWorkers[index];
+    std::lock_guard<std::mutex> lck(w.mMutex);
+    if (w.mTasks.empty())
+        return false;
+    task = w.mTasks.popBack();
+    return true;
+}
+
+inline bool ThreadPool::Pool::steal(size_t index, uint32_t &seed, Task &task) {
+    size_t n = mWorkers.size();
+    // xorshift32 picks the first victim, then walk the others in order
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    size_t start = seed % n;
+    for (size_t i = 0; i < n; ++i) {
+        size_t victim = (start + i) % n;
+        if (victim == index)
+            continue;
+        Worker &w = *mWorkers[victim];
+        std::unique_lock<std::mutex> lck(w.mMutex, std::try_to_lock);
+        if (!lck.owns_lock() || w.mTasks.empty())
+            continue;
+        task = w.mTasks.popFront();
+        return true;
     }
+    return false;
+}
+
+inline void ThreadPool::run(std::shared_ptr<Pool> p, size_t index) {
+    current().mPool = p.get();
+    current().mIndex = index;
+    uint32_t seed = static_cast<uint32_t>(index) * 2654435761u + 1;
+    Task task;
+    for (;;) {
+        if (p->pop(index, task) || p->steal(index, seed, task)) {
+            p->mPending.fetch_sub(1, std::memory_order_relaxed);
+            task();
+            task = nullptr;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lck(p->mMutex);
+        p->mIdle.fetch_add(1);
+        while (p->mPending.load() == 0 && !p->mIsShutdown)
+            p->mCV.wait(lck);
+        p->mIdle.fetch_sub(1);
+        if (p->mPending.load() == 0 && p->mIsShutdown)
+            break;
+    }
+    current() = Current();
+}
+
+inline ThreadPool::ThreadPool(size_t size)
+        : mPool(std::make_shared<Pool>()) {
+    size = size ? size : 1;
+    for (size_t i = 0; i < size; ++i)
+        mPool->mWorkers.emplace_back(new Worker);
+    for (size_t i = 0; i < size; ++i)
+        std::thread(run, mPool, i).detach();
 }
 
 }// namespace threadpool
 }// namespace pardus
+
+#endif //PD_THREADPOOL_H
@@ -0,0 +1,183 @@
+#include "pd_timer.h"
+
+#include <algorithm>
+
+namespace pardus {
+namespace timer {
+
+namespace {
+
+const uint64_t SLOT_MASK = TIMER_SLOTS - 1;
+
+// Ticks covered by the whole wheel, later timers wait in the last level
+const uint64_t MAX_DELTA = (1ULL << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1;
+
+// Rotate right, n in [0, 64]
+uint64_t rotr(uint64_t v, unsigned n) {
+    n &= 63;
+    return n ? (v >> n) | (v << (64 - n)) : v;
+}
+
+} // namespace
+
+
+/***************************
+* Timer implementation
+**************************/
+Timer::Timer(Callback callback, void *arg) : mCallback(callback), mArg(arg) {
+}
+
+Timer::~Timer() {
+    if (mWheel)
+        mWheel->cancel(*this);
+}
+
+bool Timer::isArmed() const {
+    return mWheel != nullptr;
+}
+
+
+/***************************
+* TimerWheel implementation
+**************************/
+TimerWheel::TimerWheel(unsigned tickMs, Clock::time_point start)
+        : mTickMs(tickMs ? tickMs : 1), mStart(start) {
+}
+
+// Armed timers are disarmed, their callbacks never run
+TimerWheel::~TimerWheel() {
+    for (auto &level : mSlots) {
+        for (Timer *&head : level) {
+            while (head) {
+                Timer *t = head;
+                head = t->mNext;
+                t->mPrev = t->mNext = nullptr;
+                t->mWheel = nullptr;
+            }
+        }
+    }
+}
+
+// Arm timer to fire delayMs after the last advance(), re-arming it if it
+// was armed already. Rounded up to whole ticks.
+void TimerWheel::schedule(Timer &timer, long delayMs) {
+    if (timer.mWheel)
+        timer.mWheel->cancel(timer);
+    uint64_t ticks = delayMs > 0 ? (static_cast<uint64_t>(delayMs) + mTickMs - 1) / mTickMs : 0;
+    // One more tick, mNow may have started up to a tick ago
+    timer.mExpires = mNow + ticks + 1;
+    timer.mWheel = this;
+    insert(timer);
+    mCount++;
+}
+
+// Disarm timer, nothing happens if it is not armed
+void TimerWheel::cancel(Timer &timer) {
+    if (timer.mWheel != this)
+        return;
+    if (timer.mPrev == nullptr) {
+        mSlots[timer.mLevel][timer.mSlot] = timer.mNext;
+        if (timer.mNext == nullptr)
+            mOccupied[timer.mLevel] &= ~(1ULL << timer.mSlot);
+    } else {
+        timer.mPrev->mNext = timer.mNext;
+    }
+    if (timer.mNext)
+        timer.mNext->mPrev = timer.mPrev;
+    timer.mPrev = timer.mNext = nullptr;
+    timer.mWheel = nullptr;
+    mCount--;
+}
+
+// Move time forward to now, running the callbacks of every timer due
+//    Return number of timers fired
+size_t TimerWheel::advance(Clock::time_point now) {
+    uint64_t target = ticksAt(now);
+    size_t fired = 0;
+    while (mNow < target) {
+        if (mCount == 0) {
+            mNow = target;
+            break;
+        }
+        // Nothing due in level 0, skip to the end of its rotation
+        if (mOccupied[0] == 0 && (mNow | SLOT_MASK) < target)
+            mNow |= SLOT_MASK;
+
+        mNow++;
+        uint64_t slot = mNow & SLOT_MASK;
+        for (int level = 1; level < TIMER_LEVELS && ((mNow >> (TIMER_SLOT_BITS * (level - 1))) & SLOT_MASK) == 0; level++)
+            cascade(level);
+
+        while (Timer *t = mSlots[0][slot]) {
+            cancel(*t);
+            t->mCallback(*t, t->mArg);
+            fired++;
+        }
+    }
+    return fired;
+}
+
+// Milliseconds until advance() may have work to do, e.g. as select()
+// timeout; -1 if no timer is armed
+long TimerWheel::nextTimeoutMs() {
+    if (mCount == 0)
+        return -1;
+    uint64_t slot = mNow & SLOT_MASK;
+    // Level 0 slots after the current one, or the next cascade
+    uint64_t ticks = TIMER_SLOTS - slot;
+    uint64_t ahead = rotr(mOccupied[0], static_cast<unsigned>(slot + 1));
+    if (ahead)
+        ticks = std::min(ticks, static_cast<uint64_t>(__builtin_ctzll(ahead)) + 1);
+
+    Clock::time_point due = mStart + std::chrono::milliseconds((mNow + ticks) * mTickMs);
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(due - Clock::now()).count() + 1;
+    return left > 0 ? static_cast<long>(left) : 0;
+}
+
+// Number of armed timers
+size_t TimerWheel::size() {
+    return mCount;
+}
+
+// Link timer into the slot of its expiry, relative to mNow
+void TimerWheel::insert(Timer &timer) {
+    uint64_t expires = std::min(timer.mExpires, mNow + MAX_DELTA);
+    uint64_t delta = expires > mNow ? expires - mNow : 0;
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >> (TIMER_SLOT_BITS * (level + 1)))
+        level++;
+    uint64_t slot = (expires >> (TIMER_SLOT_BITS * level)) & SLOT_MASK;
+
+    Timer *&head = mSlots[level][slot];
+    timer.mLevel = static_cast<uint8_t>(level);
+    timer.mSlot = static_cast<uint8_t>(slot);
+    timer.mPrev = nullptr;
+    timer.mNext = head;
+    if (head)
+        head->mPrev = &timer;
+    head = &timer;
+    mOccupied[level] |= 1ULL << slot;
+}
+
+// Redistribute the level slot mNow just entered to lower levels
+void TimerWheel::cascade(int level) {
+    uint64_t slot = (mNow >> (TIMER_SLOT_BITS * level)) & SLOT_MASK;
+    Timer *t = mSlots[level][slot];
+    mSlots[level][slot] = nullptr;
+    mOccupied[level] &= ~(1ULL << slot);
+    while (t) {
+        Timer *next = t->mNext;
+        insert(*t);
+        t = next;
+    }
+}
+
+uint64_t TimerWheel::ticksAt(Clock::time_point t) {
+    if (t <= mStart)
+        return 0;
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t - mStart).count();
+    return static_cast<uint64_t>(ms) / mTickMs;
+}
+
+} // namespace timer
+} // namespace pardus
@@ -0,0 +1,84 @@
+#ifndef PD_TIMER_H
+#define PD_TIMER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#define TIMER_LEVELS 4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+
+namespace pardus {
+namespace timer {
+
+class TimerWheel;
+
+// Timer - Intrusive timer, embedded in the object it times out
+// Holds no heap memory; an armed timer sits in exactly one wheel slot.
+// The callback runs from TimerWheel::advance() after the timer is
+// disarmed, so it may re-arm the timer or destroy its owner.
+class Timer {
+public:
+    typedef void (*Callback)(Timer &timer, void *arg);
+
+    Timer(Callback callback, void *arg);
+    Timer(const Timer &) = delete;
+    Timer& operator=(const Timer &) = delete;
+    ~Timer();
+
+    bool isArmed() const;
+
+private:
+    friend class TimerWheel;
+
+    Timer *mPrev = nullptr;
+    Timer *mNext = nullptr;
+    TimerWheel *mWheel = nullptr;
+    uint64_t mExpires = 0;      // in ticks of mWheel
+    uint8_t mLevel = 0;         // slot holding the timer while armed
+    uint8_t mSlot = 0;
+    Callback mCallback;
+    void *mArg;
+};
+
+// TimerWheel - Hierarchical timing wheel
+// TIMER_LEVELS wheels of TIMER_SLOTS slots each, level n slots being
+// TIMER_SLOTS^n ticks wide. Arming, re-arming and cancelling are O(1);
+// timers due in later levels are cascaded down as time reaches them.
+// Timers fire at tick granularity and never early. Not thread safe, a
+// wheel belongs to the thread driving it, e.g. an event loop.
+class TimerWheel {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit TimerWheel(unsigned tickMs = 10, Clock::time_point start = Clock::now());
+    TimerWheel(const TimerWheel &) = delete;
+    TimerWheel& operator=(const TimerWheel &) = delete;
+    ~TimerWheel();
+
+    void schedule(Timer &timer, long delayMs);
+    void cancel(Timer &timer);
+    size_t advance(Clock::time_point now);
+    long nextTimeoutMs();
+    size_t size();
+
+private:
+    void insert(Timer &timer);
+    void cascade(int level);
+    uint64_t ticksAt(Clock::time_point t);
+
+private:
+    unsigned mTickMs;
+    Clock::time_point mStart;
+    uint64_t mNow = 0;              // current tick, every timer expiring at or before it fired
+    size_t mCount = 0;
+    uint64_t mOccupied[TIMER_LEVELS] = {};
+    Timer *mSlots[TIMER_LEVELS][TIMER_SLOTS] = {};
+};
+
+} // namespace timer
+} // namespace pardus
+
+
+#endif //PD_TIMER_H
@@ -0,0 +1,355 @@
+#include "pd_uring.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <algorithm>
+
+#include "pd_bufpool.h"
+
+namespace pardus {
+namespace nio {
+
+namespace {
+
+int uring_setup(unsigned entries, io_uring_params *p) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+int uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags,
+                const void *arg, size_t argSize) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags,
+                                    arg, argSize));
+}
+
+int uring_register(int fd, unsigned opcode, const void *arg, unsigned nrArgs) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs));
+}
+
+// Operations the server loop submits
+const int REQUIRED_OPS[] = {
+    IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_POLL_ADD,
+    IORING_OP_SHUTDOWN, IORING_OP_CLOSE,
+};
+
+} // namespace
+
+
+/***************************
+* IoUring implementation
+**************************/
+IoUring::IoUring() {
+}
+
+IoUring::~IoUring() {
+    unmap();
+    if (mRingFd >= 0)
+        ::close(mRingFd);
+}
+
+// Whether this kernel has everything the io_uring server loop needs:
+// extended enter arguments, provided buffer rings and the operations it
+// submits. False as well where io_uring is disabled or filtered, e.g. by
+// kernel.io_uring_disabled or a seccomp policy.
+bool IoUring::isSupported() {
+    static const bool supported = [] {
+        IoUring ring;
+        if (ring.init(8) < 0 || !(ring.mFeatures & IORING_FEAT_EXT_ARG))
+            return false;
+
+        const unsigned nops = 256;
+        std::vector<char> buf(sizeof(io_uring_probe) + nops * sizeof(io_uring_probe_op));
+        io_uring_probe *probe = reinterpret_cast<io_uring_probe*>(buf.data());
+        if (uring_register(ring.mRingFd, IORING_REGISTER_PROBE, probe, nops) < 0)
+            return false;
+        for (int op : REQUIRED_OPS) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+                return false;
+        }
+
+        BufferRing bufs(ring, 0, 2, 64);
+        return bufs.isOpen();
+    }();
+    return supported;
+}
+
+// Set up a ring of entries submission slots
+// Asks for deferred task running first, so completions are only processed
+// when the thread waits for them.
+//     Return 0 on success
+//     On error, return -1 and sets errno
+int IoUring::init(unsigned entries) {
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN
+              | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    mRingFd = uring_setup(entries, &p);
+    if (mRingFd < 0 && errno == EINVAL) {
+        // Before 6.1
+        std::memset(&p, 0, sizeof(p));
+        mRingFd = uring_setup(entries, &p);
+    }
+    if (mRingFd < 0)
+        return -1;
+    mFeatures = p.features;
+    if (map(p) < 0) {
+        int err = errno;
+        unmap();
+        ::close(mRingFd);
+        mRingFd = -1;
+        errno = err;
+        return -1;
+    }
+    // Slot i always holds sqe i, so getSqe() only has to fill the sqe
+    for (unsigned i = 0; i < mSqEntries; i++)
+        mSqArray[i] = i;
+    mSqLocalTail = *mSqTail;
+    return 0;
+}
+
+bool IoUring::isOpen() {
+    return mRingFd >= 0;
+}
+
+// Next free submission entry, zeroed; queued until submit()
+// Submits what is queued if the ring is full.
+//    Return nullptr if no entry could be freed
+io_uring_sqe* IoUring::getSqe() {
+    unsigned head = __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE);
+    if (mSqLocalTail - head >= mSqEntries) {
+        submit();
+        head = __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE);
+        if (mSqLocalTail - head >= mSqEntries)
+            return nullptr;
+    }
+    io_uring_sqe *sqe = &mSqes[mSqLocalTail & mSqMask];
+    std::memset(sqe, 0, sizeof(*sqe));
+    mSqLocalTail++;
+    return sqe;
+}
+
+// Number of getSqe() calls that succeed without submitting
+unsigned IoUring::spaceLeft() {
+    return mSqEntries - (mSqLocalTail - __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE));
+}
+
+// Hand the queued entries to the kernel without waiting
+//     Return number of entries submitted
+//     On error, return -1 and sets errno
+int IoUring::submit() {
+    unsigned n = mSqLocalTail - *mSqTail;
+    if (n == 0)
+        return 0;
+    __atomic_store_n(mSqTail, mSqLocalTail, __ATOMIC_RELEASE);
+    return uring_enter(mRingFd, n, 0, 0, nullptr, 0);
+}
+
+// Submit the queued entries and wait until waitNr completions are ready or
+// timeoutMs elapsed, -1 waits without limit. One system call for both.
+//     Return number of entries submitted
+//     On error, return -1 and sets errno, ETIME if the time ran out
+int IoUring::submitAndWait(unsigned waitNr, long timeoutMs) {
+    unsigned n = mSqLocalTail - *mSqTail;
+    __atomic_store_n(mSqTail, mSqLocalTail, __ATOMIC_RELEASE);
+    if (timeoutMs < 0)
+        return uring_enter(mRingFd, n, waitNr, IORING_ENTER_GETEVENTS, nullptr, 0);
+
+    __kernel_timespec ts;
+    ts.tv_sec = timeoutMs / 1000;
+    ts.tv_nsec = (timeoutMs % 1000) * 1000000;
+    io_uring_getevents_arg arg;
+    std::memset(&arg, 0, sizeof(arg));
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+    return uring_enter(mRingFd, n, waitNr, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                       &arg, sizeof(arg));
+}
+
+// Register ring as the buffer ring of group bgid, entries a power of two
+//     Return 0 on success
+//     On error, return -1 and sets errno
+int IoUring::registerBufRing(io_uring_buf_ring *ring, unsigned entries, unsigned short bgid) {
+    io_uring_buf_reg reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+    return uring_register(mRingFd, IORING_REGISTER_PBUF_RING, &reg, 1);
+}
+
+int IoUring::unregisterBufRing(unsigned short bgid) {
+    io_uring_buf_reg reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.bgid = bgid;
+    return uring_register(mRingFd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+}
+
+// Accept on listening fd with accept4() flags; a multishot accept keeps
+// completing with one descriptor per connection until it fails
+void IoUring::prepAccept(io_uring_sqe *sqe, int fd, int flags, bool multishot) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->accept_flags = static_cast<__u32>(flags);
+    if (multishot)
+        sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+}
+
+// Receive into a buffer picked from group bgid when data arrives
+void IoUring::prepRecv(io_uring_sqe *sqe, int fd, unsigned short bgid, bool multishot) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bgid;
+    if (multishot)
+        sqe->ioprio |= IORING_RECV_MULTISHOT;
+}
+
+// msg has to stay valid until the completion
+void IoUring::prepSendmsg(io_uring_sqe *sqe, int fd, const msghdr *msg, int flags) {
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(msg);
+    sqe->len = 1;
+    sqe->msg_flags = static_cast<__u32>(flags);
+}
+
+// One-shot readiness of fd for poll() events
+void IoUring::prepPoll(io_uring_sqe *sqe, int fd, unsigned events) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+}
+
+// Cancel the poll submitted with userData, it completes with -ECANCELED
+void IoUring::prepPollRemove(io_uring_sqe *sqe, uint64_t userData) {
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = userData;
+}
+
+void IoUring::prepShutdown(io_uring_sqe *sqe, int fd, int how) {
+    sqe->opcode = IORING_OP_SHUTDOWN;
+    sqe->fd = fd;
+    sqe->len = static_cast<__u32>(how);
+}
+
+void IoUring::prepClose(io_uring_sqe *sqe, int fd) {
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+}
+
+// Map the rings and the submission entries set up as described by p
+//     Return 0 on success
+//     On error, return -1 and sets errno
+int IoUring::map(const io_uring_params &p) {
+    mSqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    mCqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (mFeatures & IORING_FEAT_SINGLE_MMAP)
+        mSqMapSize = mCqMapSize = std::max(mSqMapSize, mCqMapSize);
+
+    void *sq = mmap(nullptr, mSqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    mRingFd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+        return -1;
+    mSqMap = sq;
+    void *cq = sq;
+    if (!(mFeatures & IORING_FEAT_SINGLE_MMAP)) {
+        cq = mmap(nullptr, mCqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  mRingFd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED)
+            return -1;
+    }
+    mCqMap = cq;
+    mSqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      mRingFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        return -1;
+    mSqes = static_cast<io_uring_sqe*>(sqes);
+
+    char *sqp = static_cast<char*>(sq);
+    char *cqp = static_cast<char*>(cq);
+    mSqHead = reinterpret_cast<unsigned*>(sqp + p.sq_off.head);
+    mSqTail = reinterpret_cast<unsigned*>(sqp + p.sq_off.tail);
+    mSqArray = reinterpret_cast<unsigned*>(sqp + p.sq_off.array);
+    mSqMask = *reinterpret_cast<unsigned*>(sqp + p.sq_off.ring_mask);
+    mSqEntries = p.sq_entries;
+    mCqHead = reinterpret_cast<unsigned*>(cqp + p.cq_off.head);
+    mCqTail = reinterpret_cast<unsigned*>(cqp + p.cq_off.tail);
+    mCqMask = *reinterpret_cast<unsigned*>(cqp + p.cq_off.ring_mask);
+    mCqes = reinterpret_cast<io_uring_cqe*>(cqp + p.cq_off.cqes);
+    return 0;
+}
+
+void IoUring::unmap() {
+    if (mSqes)
+        munmap(mSqes, mSqesSize);
+    if (mCqMap && mCqMap != mSqMap)
+        munmap(mCqMap, mCqMapSize);
+    if (mSqMap)
+        munmap(mSqMap, mSqMapSize);
+    mSqes = nullptr;
+    mCqMap = mSqMap = nullptr;
+}
+
+
+/***************************
+* BufferRing implementation
+**************************/
+// count buffers of size bytes for group bgid of ring, count a power of two
+BufferRing::BufferRing(IoUring &ring, unsigned short bgid, unsigned count, unsigned size)
+        : mRing(ring), mGroupId(bgid), mCount(count), mSize(size) {
+    long page = sysconf(_SC_PAGESIZE);
+    mBufRingSize = (count * sizeof(io_uring_buf) + page - 1) / page * page;
+    void *mem = mmap(nullptr, mBufRingSize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return;
+    mBufRing = static_cast<io_uring_buf_ring*>(mem);
+    mBuffers = BufferPool::allocate(static_cast<size_t>(count) * size);
+    if (mRing.registerBufRing(mBufRing, count, bgid) < 0)
+        return;
+    mRegistered = true;
+    for (unsigned i = 0; i < count; i++)
+        recycle(static_cast<unsigned short>(i));
+}
+
+BufferRing::~BufferRing() {
+    if (mRegistered)
+        mRing.unregisterBufRing(mGroupId);
+    if (mBufRing)
+        munmap(mBufRing, mBufRingSize);
+    if (mBuffers)
+        BufferPool::deallocate(mBuffers, static_cast<size_t>(mCount) * mSize);
+}
+
+bool BufferRing::isOpen() {
+    return mRegistered;
+}
+
+unsigned short BufferRing::groupId() {
+    return mGroupId;
+}
+
+// Buffer bid, as reported by a completion with IORING_CQE_F_BUFFER
+Byte* BufferRing::buffer(unsigned short bid) {
+    return mBuffers + static_cast<size_t>(bid) * mSize;
+}
+
+// Give buffer bid back to the kernel
+void BufferRing::recycle(unsigned short bid) {
+    unsigned short tail = mBufRing->tail;
+    // Not mBufRing->bufs, C++ lays the flexible array of the uapi header
+    // out past the tail instead of over it
+    io_uring_buf *buf = reinterpret_cast<io_uring_buf*>(mBufRing) + (tail & (mCount - 1));
+    buf->addr = reinterpret_cast<uint64_t>(buffer(bid));
+    buf->len = mSize;
+    buf->bid = bid;
+    __atomic_store_n(&mBufRing->tail, static_cast<unsigned short>(tail + 1), __ATOMIC_RELEASE);
+}
+
+} // namespace nio
+} // namespace pardus
@@ -0,0 +1,125 @@
+#ifndef PD_URING_H
+#define PD_URING_H
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <cstddef>
+#include <cstdint>
+
+#include "pd_types.h"
+
+#define URING_ENTRIES 1024      // submission queue size, completions get twice as many
+#define URING_BUFFERS 512       // provided receive buffers per ring, a power of two
+#define URING_BUFFER_SIZE 4096
+
+namespace pardus {
+namespace nio {
+
+// IoUring - Submission and completion rings of one io_uring instance
+// Talks to the kernel with the raw io_uring_setup/enter/register system
+// calls, no liburing. Not thread safe: a ring belongs to the thread
+// submitting to it and reaping its completions.
+class IoUring {
+public:
+    IoUring();
+    IoUring(const IoUring &) = delete;
+    IoUring& operator=(const IoUring &) = delete;
+    ~IoUring();
+
+    static bool isSupported();
+
+    int init(unsigned entries);
+    bool isOpen();
+    io_uring_sqe *getSqe();
+    unsigned spaceLeft();
+    int submit();
+    int submitAndWait(unsigned waitNr, long timeoutMs);
+    template <class Fn>
+    unsigned forEachCqe(Fn &&fn);
+    int registerBufRing(io_uring_buf_ring *ring, unsigned entries, unsigned short bgid);
+    int unregisterBufRing(unsigned short bgid);
+
+    static void prepAccept(io_uring_sqe *sqe, int fd, int flags, bool multishot);
+    static void prepRecv(io_uring_sqe *sqe, int fd, unsigned short bgid, bool multishot);
+    static void prepSendmsg(io_uring_sqe *sqe, int fd, const msghdr *msg, int flags);
+    static void prepPoll(io_uring_sqe *sqe, int fd, unsigned events);
+    static void prepPollRemove(io_uring_sqe *sqe, uint64_t userData);
+    static void prepShutdown(io_uring_sqe *sqe, int fd, int how);
+    static void prepClose(io_uring_sqe *sqe, int fd);
+
+private:
+    int map(const io_uring_params &p);
+    void unmap();
+
+private:
+    int mRingFd = -1;
+    unsigned mFeatures = 0;
+
+    void *mSqMap = nullptr;
+    size_t mSqMapSize = 0;
+    void *mCqMap = nullptr;     // same mapping as mSqMap with IORING_FEAT_SINGLE_MMAP
+    size_t mCqMapSize = 0;
+    io_uring_sqe *mSqes = nullptr;
+    size_t mSqesSize = 0;
+
+    unsigned *mSqHead = nullptr;
+    unsigned *mSqTail = nullptr;
+    unsigned *mSqArray = nullptr;
+    unsigned mSqMask = 0;
+    unsigned mSqEntries = 0;
+    unsigned mSqLocalTail = 0;  // getSqe() position, published by submit()
+
+    unsigned *mCqHead = nullptr;
+    unsigned *mCqTail = nullptr;
+    unsigned mCqMask = 0;
+    io_uring_cqe *mCqes = nullptr;
+};
+
+// Call fn(const io_uring_cqe&) for every completion ready, consuming them
+//    Return number of completions
+template <class Fn>
+unsigned IoUring::forEachCqe(Fn &&fn) {
+    unsigned head = *mCqHead;
+    unsigned tail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+    unsigned n = 0;
+    for (; head != tail; head++, n++) {
+        fn(mCqes[head & mCqMask]);
+        // Hand the slot back right away, fn may submit more work
+        __atomic_store_n(mCqHead, head + 1, __ATOMIC_RELEASE);
+    }
+    return n;
+}
+
+// BufferRing - Receive buffers provided to the kernel (IORING_REGISTER_PBUF_RING)
+// Receives submitted with its group id pick a free buffer when data
+// arrives, instead of pinning one per idle connection; the completion tells
+// which one. The buffers are one block of BufferPool memory and go back to
+// the kernel with recycle() once their data has been consumed.
+class BufferRing {
+public:
+    BufferRing(IoUring &ring, unsigned short bgid, unsigned count, unsigned size);
+    BufferRing(const BufferRing &) = delete;
+    BufferRing& operator=(const BufferRing &) = delete;
+    ~BufferRing();
+
+    bool isOpen();
+    unsigned short groupId();
+    Byte *buffer(unsigned short bid);
+    void recycle(unsigned short bid);
+
+private:
+    IoUring &mRing;
+    unsigned short mGroupId;
+    unsigned mCount;
+    unsigned mSize;
+    io_uring_buf_ring *mBufRing = nullptr;
+    size_t mBufRingSize = 0;
+    Byte *mBuffers = nullptr;
+    bool mRegistered = false;
+};
+
+} // namespace nio
+} // namespace pardus
+
+
+#endif //PD_URING_H